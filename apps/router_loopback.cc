@@ -0,0 +1,483 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ End-to-end loopback benchmark: a root and N children in one process, talking over localhost.
+
+ 	source -> stamp -> queue_sink -> root ==> child i: queue_source -> kernel -> queue_sink_byte ==> root
+ 	       -> queue_source_byte -> measure -> null_sink
+
+ The kernel costs --cost dependent multiply-adds per item (0 just copies), so the router's own overhead shows
+ at 0 and its scaling as the children get work to do. Every combination of --sizes (items per segment),
+ --children, --order and --transport (tcp, udp, uring) runs in a fresh process (the router's connections cannot
+ be torn down and set up again in one), for --warmup seconds and then --duration measured ones, and reports:
+
+ 	throughput   payload MB/s out of the last queue source
+ 	latency      p50/p90/p99/max from a segment's first item passing the stamp block to it coming out of the
+ 	             queue source (with --order 0 the nth segment out is paired with the nth in)
+ 	CPU          process CPU time per payload byte, and cores busy
+
+ --rate caps the input (items per second) to measure latency below saturation; --json writes every run to a
+ file. The root listens on port 8080, as it always does.
+
+ --loss drops that fraction of the UDP backend's outgoing datagrams (ROUTER_UDP_LOSS), so its retransmission
+ is exercised. With --cost=0 and --order=1 the output has to be the input ramp byte for byte, and is checked:
+ a segment lost, repeated or out of order fails the run.
+ */
+
+#include <gnuradio/top_block.h>
+#include <gnuradio/sync_block.h>
+#include <gnuradio/sync_interpolator.h>
+#include <gnuradio/io_signature.h>
+#include <gnuradio/blocks/vector_source_f.h>
+#include <gnuradio/blocks/throttle.h>
+#include <gnuradio/blocks/null_sink.h>
+#include <router/root.h>
+#include <router/child.h>
+#include <router/queue_sink.h>
+#include <router/queue_source_byte.h>
+#include <router/queue_source.h>
+#include <router/queue_sink_byte.h>
+
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define QUEUE_CAPACITY	64 // Segments each shared queue holds
+#define STAMPS			65536 // Segments in flight the latency ring can tell apart (a power of two)
+#define SPARE_SECONDS	30 // Time a run gets beyond warmup and duration before it is killed
+
+typedef boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > float_queue;
+typedef boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > byte_queue;
+
+static uint64_t now_ns(){
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static uint64_t cpu_ns(){
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return ((uint64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000 + ((uint64_t)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+}
+
+// When each segment's first item went in, and how long each took to come out
+struct timeline{
+	timeline(int items, int ramp, bool check) : segment_items(items), stamps(STAMPS, 0), out_bytes(0), recording(false),
+		ramp_items(ramp), verify(check), mismatches(0){}
+
+	int segment_items;
+	std::vector<uint64_t> stamps; // By segment number modulo STAMPS
+
+	volatile uint64_t out_bytes;
+	volatile bool recording;
+	boost::mutex lock;
+	std::vector<uint64_t> latencies; // ns, while recording
+
+	int ramp_items; // The input repeats 0, 1, ... ramp_items - 1
+	bool verify; // Check the output against the ramp (it comes back unchanged and in order)
+	volatile uint64_t mismatches; // Output bytes that were not the ramp's
+};
+
+// Passes floats through, noting when each segment's first item goes by
+class stamp : public gr::sync_block{
+public:
+	stamp(timeline *t) : gr::sync_block("stamp", gr::io_signature::make(1, 1, sizeof(float)), gr::io_signature::make(1, 1, sizeof(float))), times(t){}
+
+	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items){
+		uint64_t first = nitems_read(0), now = now_ns();
+		uint64_t items = times->segment_items;
+		for(uint64_t n = (first + items - 1) / items * items; n < first + noutput_items; n += items)
+			times->stamps[(n / items) & (STAMPS - 1)] = now;
+
+		memcpy(output_items[0], input_items[0], noutput_items * sizeof(float));
+		return noutput_items;
+	}
+
+private:
+	timeline *times;
+};
+
+// Counts the bytes coming out, timing each segment's first one against its stamp
+class measure : public gr::sync_block{
+public:
+	measure(timeline *t) : gr::sync_block("measure", gr::io_signature::make(1, 1, sizeof(char)), gr::io_signature::make(1, 1, sizeof(char))), times(t){}
+
+	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items){
+		uint64_t first = nitems_read(0), now = now_ns();
+		uint64_t bytes = times->segment_items * sizeof(float);
+
+		if(times->recording){
+			boost::mutex::scoped_lock guard(times->lock);
+			for(uint64_t n = (first + bytes - 1) / bytes * bytes; n < first + noutput_items; n += bytes)
+				times->latencies.push_back(now - times->stamps[(n / bytes) & (STAMPS - 1)]);
+		}
+
+		if(times->verify){
+			const char *in = (const char *)input_items[0];
+			for(int i = 0; i < noutput_items; i++){
+				uint64_t n = first + i;
+				float expected = (float)((n / sizeof(float)) % times->ramp_items);
+				if(in[i] != ((const char *)&expected)[n % sizeof(float)])
+					times->mismatches++;
+			}
+		}
+
+		times->out_bytes = first + noutput_items;
+		memcpy(output_items[0], input_items[0], noutput_items);
+		return noutput_items;
+	}
+
+private:
+	timeline *times;
+};
+
+// The children's work: cost dependent multiply-adds per item, handed on as bytes for queue_sink_byte
+class kernel : public gr::sync_interpolator{
+public:
+	kernel(int cost) : gr::sync_interpolator("kernel", gr::io_signature::make(1, 1, sizeof(float)), gr::io_signature::make(1, 1, sizeof(char)), sizeof(float)), iterations(cost){}
+
+	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items){
+		const float *in = (const float *)input_items[0];
+		float *out = (float *)output_items[0];
+		int items = noutput_items / sizeof(float);
+
+		for(int i = 0; i < items; i++){
+			float y = in[i];
+			for(int k = 0; k < iterations; k++)
+				y = y * 0.999f + 0.001f;
+			out[i] = y;
+		}
+		return noutput_items;
+	}
+
+private:
+	int iterations;
+};
+
+struct run_config{
+	int segment_items;
+	int children;
+	bool order;
+	std::string transport;
+	int cost;
+	double rate; // Items per second in; 0 for as fast as it goes
+	double loss; // Fraction of UDP datagrams dropped on purpose
+	double warmup, duration;
+};
+
+struct run_result{
+	bool ok;
+	bool checked, intact; // Whether the output was checked against the input, and came through unchanged and in order
+	double mb_per_second, segments_per_second;
+	double p50_us, p90_us, p99_us, max_us;
+	double cpu_ns_per_byte, cores;
+};
+
+static double percentile(std::vector<uint64_t> &sorted, double q){
+	if(sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1, (size_t)(q * (sorted.size() - 1) + 0.5))] / 1000.0;
+}
+
+// Thread program: create the root, which returns once every child has connected
+static void make_root(gr::router::root::sptr *root, int children, float_queue *in, byte_queue *out){
+	*root = gr::router::root::make(children, *in, *out, 1e15);
+}
+
+/*!
+ *	Run one configuration in this process and measure it. The router cannot be shut down cleanly, so this is
+ *  only called in a process of its own.
+ *
+ *  @param config What to run.
+ *  @return The measurements; ok is False if nothing came through.
+ */
+
+static run_result run(const run_config &config){
+
+	run_result result;
+	memset(&result, 0, sizeof(result));
+
+	setenv("ROUTER_TRANSPORT", config.transport.c_str(), 1);
+	if(config.loss > 0){
+		std::ostringstream loss;
+		loss << config.loss;
+		setenv("ROUTER_UDP_LOSS", loss.str().c_str(), 1);
+	}
+
+	float_queue root_in(QUEUE_CAPACITY);
+	byte_queue root_out(QUEUE_CAPACITY);
+	std::vector<float_queue*> child_in;
+	std::vector<byte_queue*> child_out;
+	for(int i = 0; i < config.children; i++){
+		child_in.push_back(new float_queue(QUEUE_CAPACITY));
+		child_out.push_back(new byte_queue(QUEUE_CAPACITY));
+	}
+
+	// The root waits in its constructor for every child to connect, and the children retry until it listens
+	gr::router::root::sptr root;
+	boost::thread root_thread(boost::bind(make_root, &root, config.children, &root_in, &root_out));
+	boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+
+	char host[] = "127.0.0.1";
+	std::vector<gr::router::child::sptr> children;
+	for(int i = 0; i < config.children; i++)
+		children.push_back(gr::router::child::make(0, i, host, *child_in[i], *child_out[i], 1e15));
+	root_thread.join();
+
+	// The kernel leaves the data alone at cost 0, and in order it has to come back exactly as it went in
+	int ramp_items = config.segment_items * 16;
+	timeline times(config.segment_items, ramp_items, config.cost == 0 && config.order);
+	gr::top_block_sptr tb = gr::make_top_block("router_loopback");
+
+	// Root side
+	std::vector<float> ramp(ramp_items);
+	for(size_t i = 0; i < ramp.size(); i++)
+		ramp[i] = i;
+	gr::blocks::vector_source_f::sptr source = gr::blocks::vector_source_f::make(ramp, true);
+	boost::shared_ptr<stamp> stamper = gnuradio::get_initial_sptr(new stamp(&times));
+	gr::router::queue_sink::sptr sink = gr::router::queue_sink::make(sizeof(float), root_in, false, config.segment_items, 0, QUEUE_CAPACITY);
+
+	if(config.rate > 0){
+		gr::blocks::throttle::sptr throttle = gr::blocks::throttle::make(sizeof(float), config.rate);
+		tb->connect(source, 0, throttle, 0);
+		tb->connect(throttle, 0, stamper, 0);
+	}
+	else{
+		tb->connect(source, 0, stamper, 0);
+	}
+	tb->connect(stamper, 0, sink, 0);
+
+	gr::router::queue_source_byte::sptr results = gr::router::queue_source_byte::make(sizeof(char), root_out, false, config.order);
+	boost::shared_ptr<measure> meter = gnuradio::get_initial_sptr(new measure(&times));
+	tb->connect(results, 0, meter, 0);
+	tb->connect(meter, 0, gr::blocks::null_sink::make(sizeof(char)), 0);
+
+	// Children: the index tags carry each segment's index from their queue source to their queue sink
+	for(int i = 0; i < config.children; i++){
+		gr::router::queue_source::sptr in = gr::router::queue_source::make(sizeof(float), *child_in[i], true, false);
+		boost::shared_ptr<kernel> work = gnuradio::get_initial_sptr(new kernel(config.cost));
+		gr::router::queue_sink_byte::sptr out = gr::router::queue_sink_byte::make(sizeof(char), *child_out[i], true, config.segment_items * sizeof(float), 0, QUEUE_CAPACITY);
+		tb->connect(in, 0, work, 0);
+		tb->connect(work, 0, out, 0);
+	}
+
+	tb->start();
+
+	boost::this_thread::sleep(boost::posix_time::microseconds((long)(config.warmup * 1e6)));
+
+	uint64_t start_bytes = times.out_bytes, start_cpu = cpu_ns(), start_wall = now_ns();
+	times.recording = true;
+
+	boost::this_thread::sleep(boost::posix_time::microseconds((long)(config.duration * 1e6)));
+
+	times.recording = false;
+	uint64_t bytes = times.out_bytes - start_bytes, cpu = cpu_ns() - start_cpu, wall = now_ns() - start_wall;
+
+	std::vector<uint64_t> latencies;
+	{
+		boost::mutex::scoped_lock guard(times.lock);
+		latencies.swap(times.latencies);
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	result.checked = times.verify;
+	result.intact = times.mismatches == 0;
+	result.ok = bytes > 0 && result.intact;
+	result.mb_per_second = bytes / (wall / 1e9) / 1e6;
+	result.segments_per_second = bytes / (config.segment_items * sizeof(float)) / (wall / 1e9);
+	result.p50_us = percentile(latencies, 0.50);
+	result.p90_us = percentile(latencies, 0.90);
+	result.p99_us = percentile(latencies, 0.99);
+	result.max_us = latencies.empty() ? 0 : latencies.back() / 1000.0;
+	result.cpu_ns_per_byte = bytes ? (double)cpu / bytes : 0;
+	result.cores = (double)cpu / wall;
+
+	return result;
+}
+
+/*!
+ *	Run a configuration in a child process, so its router is gone when it is done.
+ *
+ *  @param config What to run.
+ *  @return The measurements; ok is False if the run failed, hung or produced nothing.
+ */
+
+static run_result run_isolated(const run_config &config){
+
+	run_result result;
+	memset(&result, 0, sizeof(result));
+
+	int fds[2];
+	if(pipe(fds) != 0)
+		return result;
+
+	std::cout << std::flush;
+	pid_t pid = fork();
+	if(pid < 0){
+		close(fds[0]);
+		close(fds[1]);
+		return result;
+	}
+
+	if(pid == 0){
+		close(fds[0]);
+		run_result measured = run(config);
+		if(write(fds[1], &measured, sizeof(measured)) != sizeof(measured)){}
+		_exit(0); // Without tearing down the flow graph or the router
+	}
+
+	close(fds[1]);
+
+	pollfd pfd;
+	pfd.fd = fds[0];
+	pfd.events = POLLIN;
+	int timeout_ms = (int)((config.warmup + config.duration + SPARE_SECONDS) * 1000);
+
+	if(poll(&pfd, 1, timeout_ms) <= 0 || read(fds[0], &result, sizeof(result)) != sizeof(result))
+		memset(&result, 0, sizeof(result));
+
+	close(fds[0]);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	return result;
+}
+
+// "1,2,4" -> {1, 2, 4}
+template <typename T>
+static std::vector<T> parse_list(const std::string &list){
+	std::vector<T> values;
+	std::stringstream in(list);
+	std::string item;
+	while(std::getline(in, item, ',')){
+		std::stringstream field(item);
+		T value;
+		if(field >> value)
+			values.push_back(value);
+	}
+	return values;
+}
+
+static void usage(const char *name){
+	std::cout << "Usage: " << name << " [--sizes=768,4096,65536] [--children=1,2,4] [--order=0,1] [--transport=tcp,udp,uring]" << std::endl
+	          << "       [--cost=0] [--rate=0] [--loss=0] [--warmup=1] [--duration=3] [--json=FILE]" << std::endl;
+}
+
+int main(int argc, char **argv){
+
+	std::vector<int> sizes = parse_list<int>("768,4096,65536");
+	std::vector<int> child_counts = parse_list<int>("1,2,4");
+	std::vector<int> orders = parse_list<int>("0,1");
+	std::vector<std::string> transports = parse_list<std::string>("tcp");
+	int cost = 0;
+	double rate = 0, loss = 0, warmup = 1, duration = 3;
+	std::string json;
+
+	for(int i = 1; i < argc; i++){
+		std::string arg = argv[i];
+		size_t equals = arg.find('=');
+		std::string key = arg.substr(0, equals), value = (equals == std::string::npos) ? "" : arg.substr(equals + 1);
+
+		if(key == "--sizes") sizes = parse_list<int>(value);
+		else if(key == "--children") child_counts = parse_list<int>(value);
+		else if(key == "--order") orders = parse_list<int>(value);
+		else if(key == "--transport") transports = parse_list<std::string>(value);
+		else if(key == "--cost") cost = atoi(value.c_str());
+		else if(key == "--rate") rate = atof(value.c_str());
+		else if(key == "--loss") loss = atof(value.c_str());
+		else if(key == "--warmup") warmup = atof(value.c_str());
+		else if(key == "--duration") duration = atof(value.c_str());
+		else if(key == "--json") json = value;
+		else{
+			usage(argv[0]);
+			return (key == "--help") ? 0 : 1;
+		}
+	}
+
+	std::ostringstream runs;
+	bool first = true, all_ok = true;
+
+	printf("%-9s %8s %5s %6s %10s %10s %9s %9s %9s %9s %9s %6s\n", "transport", "items", "kids", "order",
+	       "MB/s", "segs/s", "p50 us", "p90 us", "p99 us", "max us", "CPU ns/B", "cores");
+
+	for(size_t t = 0; t < transports.size(); t++)
+	for(size_t s = 0; s < sizes.size(); s++)
+	for(size_t c = 0; c < child_counts.size(); c++)
+	for(size_t o = 0; o < orders.size(); o++){
+		run_config config;
+		config.segment_items = sizes[s];
+		config.children = child_counts[c];
+		config.order = orders[o];
+		config.transport = transports[t];
+		config.cost = cost;
+		config.rate = rate;
+		config.loss = loss;
+		config.warmup = warmup;
+		config.duration = duration;
+
+		run_result r = run_isolated(config);
+		all_ok = all_ok && r.ok;
+
+		if(r.ok)
+			printf("%-9s %8d %5d %6d %10.1f %10.0f %9.1f %9.1f %9.1f %9.1f %9.3f %6.2f\n", config.transport.c_str(), config.segment_items,
+			       config.children, (int)config.order, r.mb_per_second, r.segments_per_second, r.p50_us, r.p90_us, r.p99_us, r.max_us,
+			       r.cpu_ns_per_byte, r.cores);
+		else if(r.mb_per_second > 0)
+			printf("%-9s %8d %5d %6d  FAILED (data came through changed or out of order)\n", config.transport.c_str(), config.segment_items, config.children, (int)config.order);
+		else
+			printf("%-9s %8d %5d %6d  FAILED (no data came through)\n", config.transport.c_str(), config.segment_items, config.children, (int)config.order);
+		fflush(stdout);
+
+		runs << (first ? "" : ",") << "\n  {\"transport\":\"" << config.transport << "\",\"segment_items\":" << config.segment_items
+		     << ",\"children\":" << config.children << ",\"order\":" << (config.order ? "true" : "false") << ",\"cost\":" << cost
+		     << ",\"rate\":" << rate << ",\"loss\":" << loss << ",\"ok\":" << (r.ok ? "true" : "false")
+		     << ",\"checked\":" << (r.checked ? "true" : "false") << ",\"intact\":" << (r.intact ? "true" : "false") << ",\"mb_per_second\":" << r.mb_per_second
+		     << ",\"segments_per_second\":" << r.segments_per_second << ",\"latency_us\":{\"p50\":" << r.p50_us << ",\"p90\":" << r.p90_us
+		     << ",\"p99\":" << r.p99_us << ",\"max\":" << r.max_us << "},\"cpu_ns_per_byte\":" << r.cpu_ns_per_byte << ",\"cores\":" << r.cores << "}";
+		first = false;
+	}
+
+	if(!json.empty()){
+		std::ofstream out(json.c_str());
+		out << "{\"runs\":[" << runs.str() << "\n]}\n";
+		if(!out){
+			std::cout << "ERROR: Cannot write " << json << std::endl;
+			return 1;
+		}
+	}
+
+	return all_ok ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+#!/usr/bin/env python
+#
+# Read bench-router's JSON output and report where zero-copy sends start to pay off:
+#
+#	bench-router --benchmark_filter=NetworkStream --benchmark_out=net.json --benchmark_out_format=json
+#	bin/bench_crossover.py net.json
+#
+# Prints copy and zero-copy throughput for each segment size, and the smallest size from which zero-copy is at
+# least as fast (to within 5%, about the run-to-run noise) at every larger size: a candidate for
+# TransportOptions::zerocopy_threshold. The benchmark runs over loopback, where the kernel copies anyway, so it
+# shows what pinning costs; the real crossover needs a NIC underneath.
+
+import json
+import sys
+
+NOISE = 0.05
+
+def crossover(filename):
+
+	rates = {} # size -> {zerocopy: bytes per second}
+	for bench in json.load(open(filename))['benchmarks']:
+		if not bench['name'].startswith('BM_NetworkStream/') or bench.get('run_type') == 'aggregate':
+			continue
+		size = int(bench['name'].split('/')[1])
+		rates.setdefault(size, {})[int(bench['zerocopy'])] = bench['bytes_per_second']
+
+	sizes = sorted(size for size in rates if len(rates[size]) == 2)
+	if not sizes:
+		print('No BM_NetworkStream results with both copy and zero-copy runs in %s' % filename)
+		return 1
+
+	print('%10s %12s %12s %8s' % ('size', 'copy MB/s', 'zc MB/s', 'zc/copy'))
+	for size in sizes:
+		copy, zc = rates[size][0], rates[size][1]
+		print('%10d %12.1f %12.1f %8.2f' % (size, copy / 1e6, zc / 1e6, zc / copy))
+
+	# Smallest size with zero-copy no slower (within NOISE) there and at every size above it
+	threshold = None
+	for size in reversed(sizes):
+		if rates[size][1] < rates[size][0] * (1 - NOISE):
+			break
+		threshold = size
+
+	if threshold is None:
+		print('Zero-copy never caught up with copying')
+	else:
+		print('Zero-copy pays off from %d bytes' % threshold)
+	return 0
+
+if __name__ == '__main__':
+	if len(sys.argv) != 2:
+		print('Usage: %s <bench-router JSON output>' % sys.argv[0])
+		sys.exit(2)
+	sys.exit(crossover(sys.argv[1]))
@@ -28,6 +28,7 @@
 #include <memory>
 #include <boost/lockfree/queue.hpp>
 #include <boost/thread.hpp>
+#include <string>
 
 namespace gr {
   namespace router {
@@ -49,8 +50,11 @@ namespace gr {
        * constructor is in a private implementation
        * class. router::child::make is the public interface for
        * creating new instances.
+       *
+       * \param transport The data path to the parent: "tcp", "udp" or "uring"; it must match the
+       * root's. Left empty, ROUTER_TRANSPORT in the environment decides (tcp if unset).
        */
-      static sptr make(int n, int child_index, char* hostname, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &out_queue, double throughput);
+      static sptr make(int n, int child_index, char* hostname, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &out_queue, double throughput, const std::string &transport = "");
     };
 
   } // namespace router
@@ -0,0 +1,56 @@
+/* -*- c++ -*- */
+/* 
+ * Copyright 2013 <+YOU OR YOUR COMPANY+>.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ROUTER_LOGGING_H
+#define INCLUDED_ROUTER_LOGGING_H
+
+#include <router/api.h>
+#include <string>
+
+namespace gr {
+  namespace router {
+
+    /*!
+     * \brief Controls the router blocks' debug log
+     *
+     * The blocks log through a per-thread ring that a background thread formats and writes out, so logging
+     * never blocks the data path. ROUTER_LOG_LEVEL and ROUTER_LOG_FILE in the environment set the starting
+     * level and destination (warn, to stderr, by default).
+     */
+    class ROUTER_API logging
+    {
+    public:
+      // debug, info, warn, error or off; False for an unknown level
+      static bool set_level(const std::string &level);
+
+      // Append the log to a file, or send it back to stderr with an empty path; False if it cannot be opened
+      static bool set_file(const std::string &path);
+
+      // Write out everything logged so far
+      static void flush();
+
+      // Records lost because a thread logged faster than they were written out
+      static unsigned long dropped();
+    };
+
+  } // namespace router
+} // namespace gr
+
+#endif /* INCLUDED_ROUTER_LOGGING_H */
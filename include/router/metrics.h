@@ -0,0 +1,51 @@
+/* -*- c++ -*- */
+/* 
+ * Copyright 2013 <+YOU OR YOUR COMPANY+>.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef INCLUDED_ROUTER_METRICS_H
+#define INCLUDED_ROUTER_METRICS_H
+
+#include <router/api.h>
+#include <string>
+
+namespace gr {
+  namespace router {
+
+    /*!
+     * \brief Router metrics (segments and bytes per child, queue depths, throughput, ...)
+     *
+     * The blocks keep their counters in a process-wide registry; this reads it out in the Prometheus text
+     * format, or serves it over HTTP on localhost for a Prometheus scraper. Setting ROUTER_METRICS_PORT in the
+     * environment starts the server without any code.
+     */
+    class ROUTER_API metrics
+    {
+    public:
+      // Every metric, in the Prometheus text exposition format
+      static std::string text();
+
+      // Answer HTTP requests on localhost:port with text(); False if the port cannot be bound
+      static bool serve(int port);
+    };
+
+  } // namespace router
+} // namespace gr
+
+#endif /* INCLUDED_ROUTER_METRICS_H */
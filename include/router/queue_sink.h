@@ -50,7 +50,22 @@ namespace gr {
         * class. router::queue_sink::make is the public interface for
         * creating new instances.
         */
-        static sptr make(int item_size, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &shared_queue, bool preserve_index);
+        // window_size > 0 cuts the stream into segments of exactly that many items, however the scheduler batches them
+        // overlap > 0 repeats that many of the previous segment's items at the start of each segment (history for
+        // overlap-save filters); a queue source with set_trim_overlap(true) drops them again
+        static sptr make(int item_size, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &shared_queue, bool preserve_index, int window_size = 0, int overlap = 0, int queue_capacity = 0);
+
+        // Backpressure: with the queue full, work() sleeps until the consumer makes room, for up to timeout_us
+        // (default 100 ms) before handing its thread back to the scheduler
+        virtual void set_push_timeout(long timeout_us) = 0;
+        // Capacity of the shared queue as given to make() (without it, the depth the queue was found full at; 0
+        // until it has filled), microseconds spent blocked on it, and pushes that found it full
+        virtual long queue_capacity() = 0;
+        virtual long blocked_time() = 0;
+        virtual unsigned long blocked_count() = 0;
+        // Bytes of data sent as overlap, and bytes of data sent in all (overlap included)
+        virtual unsigned long overlap_bytes() = 0;
+        virtual unsigned long segment_bytes() = 0;
    };
 
   } // namespace router
@@ -52,6 +52,30 @@ namespace gr {
         */
        //static sptr make(int item_size, boost::shared_ptr< boost::lockfree::queue< std::vector<float>* > > shared_queue, bool preserve_index, bool order);
         static sptr make(int item_size, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &shared_queue, bool preserve_index, bool order);
+
+        // Reorder window statistics (order=true): windows that arrived too far ahead, indexes given up on, most windows held at once
+        virtual unsigned long reorder_overflows() = 0;
+        virtual unsigned long reorder_skipped() = 0;
+        virtual int reorder_high_water() = 0;
+
+        // Real-time ordering (order=true): give up on a missing index once the segment behind it has waited deadline_us
+        // (0, the default, waits for it), streaming zeros or a repeat of the last segment in its place, tagged "gap"
+        virtual void set_gap_deadline(long deadline_us) = 0;
+        virtual void set_gap_repeat(bool repeat) = 0;
+        // Size of the zeros filling a gap that comes before any segment has streamed (later ones take the last segment's
+        // size); 768 by default
+        virtual void set_gap_size(int items) = 0;
+        // Indexes filled in, segments dropped for turning up after their index was written or given up on,
+        // and time segments spent in the reorder window (microseconds)
+        virtual unsigned long gaps_filled() = 0;
+        virtual unsigned long late_segments() = 0;
+        virtual double reorder_latency_avg() = 0;
+        virtual long reorder_latency_max() = 0;
+
+        // Drop the items a queue sink repeated as overlap (marked by its "overlap" tags); off by default, so a
+        // compute node's source keeps them for the filter that needs the history
+        virtual void set_trim_overlap(bool trim) = 0;
+        virtual unsigned long overlap_trimmed() = 0;
     };
 
   } // namespace router
@@ -0,0 +1,70 @@
+/* -*- c++ -*- */
+/* 
+ * Copyright 2013 <+YOU OR YOUR COMPANY+>.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ROUTER_REPLAY_H
+#define INCLUDED_ROUTER_REPLAY_H
+
+#include <router/api.h>
+#include <boost/lockfree/queue.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+namespace gr {
+  namespace router {
+
+    /*!
+     * \brief Feeds a captured segment stream (root::set_capture) back into a root's input queue
+     *
+     * Segments go onto the queue from a thread of their own, in their captured order and with their original
+     * indexes, at the captured pace (speed 1), scaled (speed 2 is twice as fast), or as fast as the root takes
+     * them (speed 0). Nothing else pushes onto the queue while a replay runs; a root fed this way behaves as it
+     * did under the captured traffic, so balancing and transport changes can be compared against it offline.
+     */
+    class ROUTER_API replay
+    {
+    public:
+      typedef boost::shared_ptr<replay> sptr;
+
+      static sptr make(const std::string &path, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue);
+
+      // False if the capture could not be read
+      virtual bool loaded() = 0;
+
+      // Start replaying from the first segment, at speed times the captured rate (0: no pacing); False if not loaded
+      virtual bool start(double speed) = 0;
+
+      // Stop early, or wait for the last segment to go onto the queue
+      virtual void stop() = 0;
+      virtual void wait() = 0;
+      virtual bool finished() = 0;
+
+      // Segments pushed so far, and how many of them went out more than a millisecond behind the captured pace
+      // (the root was not keeping up)
+      virtual unsigned long replayed() = 0;
+      virtual unsigned long behind() = 0;
+
+      virtual ~replay(){}
+    };
+
+  } // namespace router
+} // namespace gr
+
+#endif /* INCLUDED_ROUTER_REPLAY_H */
@@ -28,10 +28,31 @@
 #include <memory>
 #include <boost/lockfree/queue.hpp>
 #include <boost/thread.hpp>
+#include <string>
 
 namespace gr {
   namespace router {
 
+    /*!
+     * \brief One child's statistics, as seen by the root
+     *
+     * Round trips run from the root handing a segment to the connector to the child's result for it arriving
+     * back, so they include the child's processing time. The quantiles are accurate to their histogram bucket
+     * (12.5%).
+     */
+    struct child_stats
+    {
+      int child;
+      unsigned long segments_sent, bytes_sent;
+      unsigned long segments_received, bytes_received;
+      long in_flight; // Segments sent that have not come back yet
+      float weight; // Weight the child last reported
+      unsigned long rtt_count; // Round trips timed
+      double rtt_mean_us, rtt_p50_us, rtt_p90_us, rtt_p99_us, rtt_max_us;
+      unsigned long errors; // Failed sends, failed reads and malformed messages
+      bool connected; // False once the child's connection is lost (it is not reconnected)
+    };
+
     /*!
      * \brief <+description of block+>
      * \ingroup router
@@ -48,8 +69,24 @@ namespace gr {
        * constructor is in a private implementation
        * class. router::root::make is the public interface for
        * creating new instances.
+       *
+       * \param transport The data path to the children: "tcp", "udp" or "uring". Left empty,
+       * ROUTER_TRANSPORT in the environment decides (tcp if unset).
        */
-      static sptr make(int number_of_children, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &out_queue, double throughput);
+      static sptr make(int number_of_children, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &out_queue, double throughput, const std::string &transport = "");
+
+      // Statistics for each child (0 to children() - 1)
+      virtual int children() = 0;
+      virtual child_stats stats(int child) = 0;
+
+      // The same statistics go out on the "stats" message port, as a vector of one dict per child, every
+      // period seconds (default 1; 0 stops it) and whenever a message arrives on the "stats_request" port
+      virtual void set_stats_period(double seconds) = 0;
+
+      // Record every segment the root dequeues, with when it arrived, to a file for router::replay (replacing
+      // the file, and ending any capture already running); an empty path stops capturing. ROUTER_CAPTURE in
+      // the environment starts a capture when the block is created. False if the file cannot be created.
+      virtual bool set_capture(const std::string &path) = 0;
     };
 
   } // namespace router
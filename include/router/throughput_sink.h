@@ -46,7 +46,20 @@ namespace gr {
        * class. router::throughput_sink::make is the public interface for
        * creating new instances.
        */
+      // print_counter is the number of rate intervals (100 ms by default) between reports on the "rate" message
+      // port; each report is a dict of index, rate, ewma, window, average and items
       static sptr make(size_t itemsize, int print_counter, int index);
+
+      // Rates in items per second: over the last interval, its EWMA, over the sliding window, and since the start
+      virtual double rate() = 0;
+      virtual double rate_ewma() = 0;
+      virtual double rate_window() = 0;
+      virtual double rate_average() = 0;
+
+      // Interval length, intervals in the sliding window, and the EWMA's time constant (set before the flowgraph runs)
+      virtual void set_interval(double seconds) = 0;
+      virtual void set_window(int intervals) = 0;
+      virtual void set_ewma_time(double seconds) = 0;
     };
 
   } // namespace router
@@ -0,0 +1,55 @@
+/* -*- c++ -*- */
+/* 
+ * Copyright 2013 <+YOU OR YOUR COMPANY+>.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef INCLUDED_ROUTER_TRACE_H
+#define INCLUDED_ROUTER_TRACE_H
+
+#include <router/api.h>
+#include <string>
+
+namespace gr {
+  namespace router {
+
+    /*!
+     * \brief Per-segment lifecycle tracing
+     *
+     * The router blocks timestamp sampled segments at every hop (queue sink push, root dequeue and send, child
+     * receive, push, pop and send, root receive, queue source emit). Segments are sampled by index, so every
+     * node traces the same ones; the trace from each node loads in chrome://tracing or ui.perfetto.dev.
+     * Setting ROUTER_TRACE_SAMPLE in the environment turns sampling on from the start.
+     */
+    class ROUTER_API trace
+    {
+    public:
+      // Trace every Nth segment index; 0 (the default) turns tracing off
+      static void set_sampling(int every);
+
+      // Everything recorded in this process so far, as Chrome trace event JSON
+      static std::string json();
+
+      // Write json() to a file; False if it cannot be written
+      static bool write(const std::string &path);
+    };
+
+  } // namespace router
+} // namespace gr
+
+#endif /* INCLUDED_ROUTER_TRACE_H */
@@ -0,0 +1,362 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "AsyncLog.h"
+
+#include <boost/thread.hpp>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define RING_RECORDS	2048 // Records each thread can have waiting (a power of two)
+#define FLUSH_MS		20 // How often the flusher drains the rings
+
+// One thread's records; the thread writes at head, the flusher reads from tail
+struct log_ring{
+	log_ring(int id) : number(id), head(0), tail(0), in_use(true), records(RING_RECORDS){}
+
+	int number;
+	volatile unsigned long head;
+	volatile unsigned long tail;
+	volatile bool in_use; // False once the thread has exited; the ring goes to the next new thread
+	std::vector<log_record> records;
+};
+
+// Everything the flusher shares; allocated once and never freed, so logging during exit stays safe
+struct log_state{
+	log_state() : output(stderr), dropped(0), flusher(NULL){
+		// ROUTER_LOG_FILE is appended to; one that cannot be opened leaves the log on stderr
+		const char *path = getenv("ROUTER_LOG_FILE");
+		if(path != NULL && path[0] != '\0'){
+			output = fopen(path, "a");
+			if(output == NULL){
+				fprintf(stderr, "router: cannot open ROUTER_LOG_FILE %s; logging to stderr\n", path);
+				output = stderr;
+			}
+		}
+
+		timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		wall_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+		ticks = MonotonicClock::ticks();
+		tick_rate = MonotonicClock::ticks_per_second();
+	}
+
+	boost::mutex rings_lock; // Guards rings
+	std::vector<log_ring*> rings;
+
+	boost::mutex flush_lock; // One flush at a time; guards output
+	FILE *output;
+
+	volatile unsigned long dropped;
+	boost::thread *flusher;
+
+	// Wall-clock time at a known tick, to turn record ticks into times of day
+	int64_t wall_ns;
+	uint64_t ticks;
+	double tick_rate;
+};
+
+static log_state *state(){
+	static log_state *s = new log_state();
+	return s;
+}
+
+static void release_ring(log_ring *ring){
+	ring->in_use = false;
+}
+
+static boost::thread_specific_ptr<log_ring> thread_ring(release_ring);
+
+static const char *level_names[] = { "debug", "info", "warn", "error", "off" };
+
+static int level_from_env(){
+	const char *name = getenv("ROUTER_LOG_LEVEL");
+	if(name != NULL)
+		for(int i = 0; i <= LOG_OFF; i++)
+			if(strcasecmp(name, level_names[i]) == 0)
+				return i;
+	return LOG_WARN;
+}
+
+volatile int AsyncLog::level = level_from_env();
+
+static void flush_loop(){
+	while(true){
+		boost::this_thread::sleep(boost::posix_time::milliseconds(FLUSH_MS));
+		AsyncLog::flush();
+	}
+}
+
+static void flush_at_exit(){
+	AsyncLog::flush();
+}
+
+/*!
+ *	Get this thread's ring: a free one left by a thread that has exited (and been drained), or a new one.
+ *  The first ring also starts the flusher.
+ *
+ *  @return The ring.
+ */
+
+static log_ring *get_ring(){
+
+	log_ring *ring = thread_ring.get();
+	if(ring != NULL)
+		return ring;
+
+	log_state *s = state();
+	boost::mutex::scoped_lock guard(s->rings_lock);
+
+	for(size_t i = 0; i < s->rings.size() && ring == NULL; i++){
+		log_ring *r = s->rings[i];
+		if(!r->in_use && r->head == r->tail){
+			r->in_use = true;
+			ring = r;
+		}
+	}
+
+	if(ring == NULL){
+		ring = new log_ring(s->rings.size());
+		s->rings.push_back(ring);
+	}
+
+	if(s->flusher == NULL){
+		s->flusher = new boost::thread(flush_loop);
+		atexit(flush_at_exit);
+	}
+
+	thread_ring.reset(ring);
+	return ring;
+}
+
+/*!
+ *	Queue a record. Call through ROUTER_LOG, which checks the level first.
+ *
+ *  @param at The record's level.
+ *  @param format printf-style format; a string literal.
+ *  @param a, b, c, d Arguments for the format.
+ */
+
+void AsyncLog::write(int at, const char *format, log_arg a, log_arg b, log_arg c, log_arg d){
+
+	log_ring *ring = get_ring();
+
+	unsigned long head = ring->head;
+	if(head - ring->tail >= RING_RECORDS){
+		__sync_fetch_and_add(&state()->dropped, 1);
+		return;
+	}
+
+	log_record &record = ring->records[head & (RING_RECORDS - 1)];
+	record.ticks = MonotonicClock::ticks();
+	record.level = at;
+	record.format = format;
+	record.args[0] = a;
+	record.args[1] = b;
+	record.args[2] = c;
+	record.args[3] = d;
+
+	__sync_synchronize(); // The record is complete before the flusher can see it
+	ring->head = head + 1;
+}
+
+void AsyncLog::set_level(int at){
+	level = std::max((int)LOG_DEBUG, std::min((int)LOG_OFF, at));
+}
+
+bool AsyncLog::set_level(const std::string &name){
+	for(int i = 0; i <= LOG_OFF; i++){
+		if(strcasecmp(name.c_str(), level_names[i]) == 0){
+			level = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool AsyncLog::set_file(const std::string &path){
+
+	FILE *file = stderr;
+	if(!path.empty()){
+		file = fopen(path.c_str(), "a");
+		if(file == NULL)
+			return false;
+	}
+
+	flush();
+
+	log_state *s = state();
+	boost::mutex::scoped_lock guard(s->flush_lock);
+	if(s->output != stderr)
+		fclose(s->output);
+	s->output = file;
+	return true;
+}
+
+unsigned long AsyncLog::dropped(){
+	return state()->dropped;
+}
+
+struct pending{
+	log_record record;
+	int thread;
+};
+
+static bool by_time(const pending &a, const pending &b){
+	return a.record.ticks < b.record.ticks;
+}
+
+/*!
+ *	Format one record's message, printf-style, converting each argument to what its conversion expects.
+ *
+ *  @param record The record.
+ *  @param out Where the message is appended.
+ */
+
+static void format_record(const log_record &record, std::string &out){
+
+	const char *f = record.format;
+	int next = 0;
+	char buffer[256];
+
+	while(*f){
+		if(*f != '%'){
+			const char *literal = f;
+			while(*f && *f != '%')
+				f++;
+			out.append(literal, f - literal);
+			continue;
+		}
+
+		if(f[1] == '%'){
+			out += '%';
+			f += 2;
+			continue;
+		}
+
+		// Copy the conversion spec without its length modifiers, then find the conversion
+		std::string spec = "%";
+		const char *p = f + 1;
+		while(*p && strchr("-+ #0123456789.*", *p))
+			spec += *p++;
+		while(*p && strchr("hlLqjzt", *p))
+			p++;
+		char conversion = *p;
+		if(conversion == '\0'){
+			out.append(f);
+			break;
+		}
+		f = p + 1;
+
+		if(next >= LOG_ARGS || record.args[next].type == log_arg::NONE){
+			out += "<?>";
+			continue;
+		}
+
+		const log_arg &arg = record.args[next++];
+		long long i = (arg.type == log_arg::FLOAT) ? (long long)arg.value.d : arg.value.i;
+		double d = (arg.type == log_arg::FLOAT) ? arg.value.d : (double)arg.value.i;
+
+		if(strchr("diouxXc", conversion)){
+			spec += (conversion == 'c') ? "" : "ll";
+			spec += conversion;
+			snprintf(buffer, sizeof(buffer), spec.c_str(), i);
+		}
+		else if(strchr("fFeEgGaA", conversion)){
+			spec += conversion;
+			snprintf(buffer, sizeof(buffer), spec.c_str(), d);
+		}
+		else if(conversion == 's'){
+			spec += 's';
+			snprintf(buffer, sizeof(buffer), spec.c_str(), (arg.type == log_arg::STRING && arg.value.s) ? arg.value.s : "<?>");
+		}
+		else{
+			snprintf(buffer, sizeof(buffer), "<%%%c?>", conversion);
+		}
+		out += buffer;
+	}
+}
+
+/*!
+ *	Drain every ring, order the records by time and write them out.
+ */
+
+void AsyncLog::flush(){
+
+	static const char *names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+	log_state *s = state();
+	boost::mutex::scoped_lock guard(s->flush_lock);
+
+	std::vector<log_ring*> rings;
+	{
+		boost::mutex::scoped_lock rings_guard(s->rings_lock);
+		rings = s->rings;
+	}
+
+	std::vector<pending> batch;
+	for(size_t r = 0; r < rings.size(); r++){
+		log_ring *ring = rings[r];
+		unsigned long head = ring->head;
+		__sync_synchronize(); // Read the records only after their head
+
+		for(unsigned long i = ring->tail; i < head; i++){
+			pending p;
+			p.record = ring->records[i & (RING_RECORDS - 1)];
+			p.thread = ring->number;
+			batch.push_back(p);
+		}
+
+		__sync_synchronize(); // Done reading before the slots are handed back
+		ring->tail = head;
+	}
+
+	if(batch.empty())
+		return;
+
+	std::stable_sort(batch.begin(), batch.end(), by_time);
+
+	std::string text;
+	for(size_t i = 0; i < batch.size(); i++){
+		const log_record &record = batch[i].record;
+
+		int64_t wall = s->wall_ns + (int64_t)(((double)record.ticks - (double)s->ticks) * 1e9 / s->tick_rate);
+		time_t seconds = wall / 1000000000;
+		struct tm local;
+		localtime_r(&seconds, &local);
+
+		char prefix[96];
+		size_t n = strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &local);
+		snprintf(prefix + n, sizeof(prefix) - n, ".%06ld %-5s [%d] ", (long)(wall % 1000000000) / 1000,
+		         names[std::min(std::max(record.level, 0), 3)], batch[i].thread);
+
+		text += prefix;
+		format_record(record, text);
+		text += '\n';
+	}
+
+	fwrite(text.data(), 1, text.size(), s->output);
+	fflush(s->output);
+}
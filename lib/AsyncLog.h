@@ -0,0 +1,98 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include <string>
+#include <stdint.h>
+#include "RateMeter.h"
+
+/*
+ Debug logging that is cheap enough to leave on.
+
+ ROUTER_LOG(level, format, args...) checks the level (a load and a compare) and, if it is enabled, copies the
+ format pointer and up to 4 arguments into a binary record on the calling thread's ring; nothing is formatted
+ and nothing is locked. A background thread drains every ring a few times a second, orders the records by
+ time, formats them printf-style and writes them out. A full ring drops records (and counts them) rather than
+ ever blocking the caller.
+
+ The format must be a string literal, and so must any %s argument: only the pointers are kept until the
+ flusher formats the record. Integer conversions (%d, %ld, %lu, %x, ...) take any integer argument and
+ floating conversions (%f, %g, %e) any floating one.
+
+ The level is set with set_level() or ROUTER_LOG_LEVEL (debug, info, warn, error or off; default warn), and
+ the output with set_file() or ROUTER_LOG_FILE (default stderr).
+ */
+
+enum log_level{ LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_OFF };
+
+// One argument of a record
+struct log_arg{
+	log_arg() : type(NONE){ value.i = 0; }
+	log_arg(int v) : type(INT){ value.i = v; }
+	log_arg(long v) : type(INT){ value.i = v; }
+	log_arg(long long v) : type(INT){ value.i = v; }
+	log_arg(unsigned v) : type(INT){ value.i = v; }
+	log_arg(unsigned long v) : type(INT){ value.i = (long long)v; }
+	log_arg(unsigned long long v) : type(INT){ value.i = (long long)v; }
+	log_arg(double v) : type(FLOAT){ value.d = v; }
+	log_arg(const char *v) : type(STRING){ value.s = v; }
+
+	enum{ NONE, INT, FLOAT, STRING } type;
+	union{ long long i; double d; const char *s; } value;
+};
+
+#define LOG_ARGS 4
+
+struct log_record{
+	uint64_t ticks; // MonotonicClock time
+	int level;
+	const char *format;
+	log_arg args[LOG_ARGS];
+};
+
+class AsyncLog{
+public:
+
+	static inline bool enabled(int at){ return at >= level; }
+
+	// Queue a record on this thread's ring
+	static void write(int at, const char *format, log_arg a = log_arg(), log_arg b = log_arg(), log_arg c = log_arg(), log_arg d = log_arg());
+
+	static void set_level(int at);
+	static bool set_level(const std::string &name); // False for an unknown name
+	static int get_level(){ return level; }
+
+	// Send the output to a file (appending), or back to stderr with an empty path; False if it cannot be opened
+	static bool set_file(const std::string &path);
+
+	// Format and write everything queued so far
+	static void flush();
+
+	static unsigned long dropped(); // Records lost to full rings
+
+private:
+	static volatile int level;
+};
+
+#define ROUTER_LOG(at, ...) do{ if(AsyncLog::enabled(at)) AsyncLog::write(at, __VA_ARGS__); }while(0)
+
+#endif
@@ -0,0 +1,55 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef CHILDSELECTION_H
+#define CHILDSELECTION_H
+
+/*
+ How the root picks the child for the next segment: the one with the least outstanding work, counting both the
+ windows it has been sent and not yet answered for (its weight) and the bytes still queued for it on this side.
+ A child whose outbound queue is full is passed over unless every child's is, so one slow link never holds up
+ dispatch while another child has room. Children marked down (their connection is gone) are never picked; with
+ every child down the result is -1.
+
+ Connector is anything with queue_full(child) and queued_bytes(child) (NetworkInterface in the root).
+ */
+
+template <typename Connector>
+int least_loaded(const float *weights, int children, Connector &connector, float window_bytes, const volatile bool *down = 0){
+	float min = 0;
+	int index = -1;
+	for(int pass = 0; pass < 2 && index == -1; pass++){
+		for(int i = 0; i < children; i++){
+			if(down && down[i])
+				continue;
+			if(pass == 0 && connector.queue_full(i))
+				continue;
+
+			float load = weights[i] + connector.queued_bytes(i) / window_bytes;
+			if(index == -1 || load < min){
+				min = load;
+				index = i;
+			}
+		}
+	}
+	return index;
+}
+
+#endif
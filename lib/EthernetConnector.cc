@@ -20,17 +20,33 @@
 
 #include "EthernetConnector.h"
 
+#include <iostream>
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+
 /*!
  *	This is the public constuctor for the Ethernet Connector.
  *
  *  @param count The number of children that the router will connect to.
  *  @param port The port on which the router will communicate.
+ *  @param transport_options Socket tuning applied to every connection.
  */
 
-EthernetConnector::EthernetConnector(int count, int port){
+EthernetConnector::EthernetConnector(int count, int port, const TransportOptions &transport_options){
+    
+	options = transport_options;
     
 	// Number of child nodes
 	numChildren = count;
+	numConnected = 0;
+	children = NULL;
+	connected = NULL;
+	zc_senders = NULL;
+	read_child_mutex = NULL;
+	write_child_mutex = NULL;
+	parent.socket_fd = -1;
     
 	// If node has > 0 children, create array of children
 	if(V)
@@ -41,6 +57,14 @@ EthernetConnector::EthernetConnector(int count, int port){
         
 		// Create array of Children Nodes
 		children = new Node[numChildren];
+		connected = new bool[numChildren];
+		read_child_mutex = new boost::mutex[numChildren];
+		write_child_mutex = new boost::mutex[numChildren];
+		for(int i = 0; i < numChildren; i++){
+			connected[i] = false;
+			children[i].socket_fd = -1;
+			children[i].capabilities = 0;
+		}
         
 		// Create a local node and set port, then set FD
 		local.port = port;
@@ -58,7 +82,11 @@ EthernetConnector::~EthernetConnector(){
 	if(V)
 		std::cout <<"\tEthernetConnector: Calling EthernetConnector Destructor" << std::endl;
 	stop();
+	delete[] zc_senders;
 	delete[] children;
+	delete[] connected;
+	delete[] read_child_mutex;
+	delete[] write_child_mutex;
 	exit(0);
 }
 
@@ -73,6 +101,13 @@ bool EthernetConnector::set_local_fd(){
     	std::cout << "\tEthernetConnector: Serious Error: Could not create a local socket!" << std::endl;
         return false;
     }
+    
+    // Allow the router to be restarted without waiting for TIME_WAIT to expire
+    int reuse = 1;
+    setsockopt(local.socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    
+    // Buffer sizes must be set before listen() so accepted sockets negotiate a matching window scale
+    apply_options(local.socket_fd);
 	
 	local.length = sizeof(local.address);
     bzero((char *) &(local.address), (local.length));
@@ -94,46 +129,180 @@ bool EthernetConnector::set_local_fd(){
 
 
 /*!
- *	This function will connect the router to it's child
+ *	This function accepts connections from all children. Every connection is handed to its own handshake
+ *  thread, which reads the child's hello frame and files the socket under the index the child declared,
+ *  so children may connect in any order and a slow child does not hold up the others. Failing poll() or
+ *  accept() calls are retried with a growing pause, and with options.accept_timeout set the bring-up gives up
+ *  once that many seconds pass without every child connected.
  *
- *  @param index The index of the child to connect to.
- *  @param port The port on which the router will communicate with its child on.
+ *  @return bool True once every child has connected; False if the local socket cannot listen or the timeout passes.
  */
 
-bool EthernetConnector::connect_to_child(int index, int port){
+bool EthernetConnector::accept_children(){
+    
+	// Listen once, with a backlog large enough for every child to connect at the same time
+	if(listen(local.socket_fd, numChildren) < 0){
+		perror("\tEthernetConnector: Serious Error: Could not listen on local socket");
+		return false;
+	}
     
 	if(V)
-		std::cout << "\tEthernetConnector: Attempting to connect to child at index: " << index << " on port " << port << std::endl;
+		printf("\tEthernetConnector: Waiting for %d children to connect...\n", numChildren);
+    
+	std::vector<boost::shared_ptr<boost::thread> > handshakes;
     
-	if(index > (numChildren - 1)){
-		if(V)
-			std::cout << "Number of Children=" << numChildren << " index of child accessed=" << index << std::endl;
+	boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(options.accept_timeout);
+	int backoff = ACCEPT_BACKOFF_MIN;
+    
+	while(options.accept_timeout <= 0 || boost::get_system_time() < deadline){
+		{
+			boost::mutex::scoped_lock lock(accept_mutex);
+			if(numConnected == numChildren)
+				break;
+		}
         
-        printf("index > number of children - 1\n");
-		return false;
+		// Poll so we notice when the last handshake completes without another connection arriving
+		pollfd pfd;
+		pfd.fd = local.socket_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+        
+		int ready = poll(&pfd, 1, 100);
+		if(ready == 0)
+			continue; // Timed out; check the count and the deadline again
+        
+		if(ready < 0){
+			if(errno != EINTR){
+				perror("\tEthernetConnector: poll on local socket");
+				boost::this_thread::sleep(boost::posix_time::milliseconds(backoff));
+				backoff = std::min(backoff * 2, ACCEPT_BACKOFF_MAX);
+			}
+			continue;
+		}
+        
+		sockaddr_in address;
+		socklen_t length = sizeof(address);
+		int fd = accept(local.socket_fd, (sockaddr *) &address, &length);
+        
+		if(fd < 0){
+			// The connection went away between poll() and accept(); nothing to wait out
+			if(errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+				continue;
+            
+			// Out of descriptors or memory: give the handshakes in flight time to finish or close theirs
+			perror("\tEthernetConnector: accept");
+			boost::this_thread::sleep(boost::posix_time::milliseconds(backoff));
+			backoff = std::min(backoff * 2, ACCEPT_BACKOFF_MAX);
+			continue;
+		}
+		backoff = ACCEPT_BACKOFF_MIN;
+        
+		handshakes.push_back(boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&EthernetConnector::handshake_child, this, fd, address, length))));
 	}
     
-	//unsigned char buffer[256];
-	listen(local.socket_fd,3);
+	for(size_t i = 0; i < handshakes.size(); i++)
+		handshakes[i]->join();
     
-	(children[index]).length = sizeof((children[index].address));
+	{
+		boost::mutex::scoped_lock lock(accept_mutex);
+		if(numConnected < numChildren){
+			printf("\tEthernetConnector: Serious Error: Only %d of %d children connected within %d seconds\n", numConnected, numChildren, options.accept_timeout);
+			return false;
+		}
+	}
     
 	if(V)
-		printf("Waiting for Child %d to connect...\n", index);
+		printf("\tEthernetConnector: All %d children connected\n", numChildren);
     
-	(children[index]).socket_fd = accept(local.socket_fd,
-                                         (sockaddr *) &(children[index].address),
-                                         &(children[index].length));
+	return true;
+}
+
+/*!
+ *	Read the hello frame from a freshly accepted connection and register it as the child it names.
+ *  Connections with a bad frame, an out-of-range index or an index already taken are closed.
+ *
+ *  @param socket_fd The accepted socket.
+ *  @param address The address of the remote end.
+ *  @param length The length of address.
+ */
+
+void EthernetConnector::handshake_child(int socket_fd, sockaddr_in address, socklen_t length){
     
-	// Could not connect to the child
-	if((children[index].socket_fd) < 0){
-		printf("Serious Error: Could not connect to child\n");
-		return false;
+	// Bound the handshake so a half-open connection cannot hold its thread forever
+	timeval timeout;
+	timeout.tv_sec = HELLO_TIMEOUT;
+	timeout.tv_usec = 0;
+	setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+	HelloFrame hello;
+	char *buffer = (char *) &hello;
+	int received = 0;
+    
+	while(received < (int)sizeof(hello)){
+		ssize_t r = read(socket_fd, buffer + received, sizeof(hello) - received);
+		if(r <= 0){
+			if(r < 0 && errno == EINTR)
+				continue;
+			printf("\tEthernetConnector: Connection closed before hello frame was received\n");
+			close(socket_fd);
+			return;
+		}
+		received += r;
 	}
-	
-	// Child is now connected
-	if(V)printf("Connected to Child!\n");
-	return true;
+    
+	// Back to fully blocking reads for the data path
+	timeout.tv_sec = 0;
+	setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+	int index = (int32_t)ntohl(hello.child_index);
+    
+	if(ntohl(hello.magic) != HELLO_MAGIC || ntohl(hello.version) != HELLO_VERSION){
+		printf("\tEthernetConnector: Serious Error: Rejecting connection with a malformed hello frame\n");
+		close(socket_fd);
+		return;
+	}
+    
+	// Only a real child gets its socket tuned
+	apply_options(socket_fd);
+    
+	boost::mutex::scoped_lock lock(accept_mutex);
+    
+	if(index < 0 || index > (numChildren - 1)){
+		printf("\tEthernetConnector: Serious Error: Child declared index %d, but there are %d children\n", index, numChildren);
+		close(socket_fd);
+		return;
+	}
+    
+	if(connected[index]){
+		printf("\tEthernetConnector: Serious Error: A second child declared index %d\n", index);
+		close(socket_fd);
+		return;
+	}
+    
+	children[index].socket_fd = socket_fd;
+	children[index].address = address;
+	children[index].length = length;
+	children[index].capabilities = ntohl(hello.capabilities);
+	connected[index] = true;
+	numConnected++;
+    
+	if(V)
+		printf("\tEthernetConnector: Connected to child %d (capabilities=0x%x)\n", index, children[index].capabilities);
+}
+
+/*!
+ *	Return the capabilities child index advertised in its hello frame.
+ *
+ *  @param index The index of the child.
+ *  @return The CAP_* bits of the child; 0 if it has not connected.
+ */
+
+uint32_t EthernetConnector::child_capabilities(int index){
+	if(index < 0 || index > (numChildren - 1))
+		return 0;
+    
+	boost::mutex::scoped_lock lock(accept_mutex);
+	return connected[index] ? children[index].capabilities : 0;
 }
 
 // Write to the child at index Children[index] the msg of size size
@@ -154,12 +323,51 @@ int EthernetConnector::write_child(int index, char * inbuf, unsigned long size){
 		return false;
 	}
     
-	// Write to child file descriptor
-	ssize_t r = write((children[index]).socket_fd, inbuf, size);
+	// Critical section; one writer per child socket at a time, but children never wait on each other
+	boost::mutex::scoped_lock lock(write_child_mutex[index]);
+	ssize_t r = send((children[index]).socket_fd, inbuf, size, MSG_NOSIGNAL); // A child that went away is an error, not SIGPIPE
     
 	return r;
 }
 
+/*!
+ *	Write the whole buffer to a node and release it. The plain socket backend has nothing to overlap the write
+ *  with, so this blocks until the data is on the socket.
+ *
+ *  @param index The index of the child; -1 for the parent.
+ *  @param buf Buffer to send; ownership passes to the connector.
+ *  @param size The number of bytes in buf.
+ *  @return True if every byte was written; False on error.
+ */
+
+bool EthernetConnector::write_async(int index, char * buf, unsigned long size){
+    
+	// Large segments go out without a kernel copy; the sender frees buf once the kernel releases its pages
+	if(zc_senders != NULL && size >= (unsigned long)options.zerocopy_threshold){
+		int conn = (index == -1) ? numChildren : index;
+		if(zc_senders[conn].enabled()){
+			boost::mutex::scoped_lock lock((index == -1) ? write_parent_mutex : write_child_mutex[index]);
+			return zc_senders[conn].send(buf, size);
+		}
+	}
+    
+	unsigned long sent = 0;
+	while(sent < size){
+		ssize_t r = (index == -1) ? write_parent(buf + sent, size - sent) : write_child(index, buf + sent, size - sent);
+		if(r <= 0){
+			if(r < 0 && errno == EINTR)
+				continue;
+			perror("\tEthernetConnector::write_async");
+			delete[] buf;
+			return false;
+		}
+		sent += r;
+	}
+    
+	delete[] buf;
+	return true;
+}
+
 /*!
  *	Read from the child at index Children[index]
  *
@@ -171,8 +379,12 @@ int EthernetConnector::write_child(int index, char * inbuf, unsigned long size){
 int EthernetConnector::read_child(int index, char * outbuf, int size){
     
     // Read from the child file descriptor
+	boost::mutex::scoped_lock lock(read_child_mutex[index]);
 	ssize_t r = read((children[index]).socket_fd, outbuf, size);
     
+	if(options.quickack)
+		rearm_quickack(children[index].socket_fd);
+    
 	return r;
 }
 
@@ -181,10 +393,12 @@ int EthernetConnector::read_child(int index, char * outbuf, int size){
  *
  *  @param hostname The hostname / ip address of the parent node to connect to.
  *  @param port The port for the child to connect to the parent on.
+ *  @param child_index The index this node declares to its parent in the hello frame.
+ *  @param capabilities The CAP_* bits this node advertises in the hello frame.
  *  @return bool Return True if the node could connect to it's parent; False if not.
  */
 
-bool EthernetConnector::connect_to_parent(char* hostname, int port){
+bool EthernetConnector::connect_to_parent(char* hostname, int port, int child_index, uint32_t capabilities){
     
     // Create parent object
     parent.port = port;
@@ -199,9 +413,33 @@ bool EthernetConnector::connect_to_parent(char* hostname, int port){
     // Attempt to connect to parent
     if(connect(parent.socket_fd, (sockaddr *)&parent.address, sizeof(parent.address))){
         printf("\tEthernetConnector: Serious Error: Failed connecting to Parent\n");
+        close(parent.socket_fd);
+        parent.socket_fd = -1; // Nothing (a retry, stop()) may touch the closed descriptor
         return false;
     }
     
+    // Introduce ourselves so the parent can map this connection to our index
+    HelloFrame hello;
+    hello.magic = htonl(HELLO_MAGIC);
+    hello.version = htonl(HELLO_VERSION);
+    hello.child_index = htonl(child_index);
+    hello.capabilities = htonl(capabilities);
+    
+    char *buffer = (char *) &hello;
+    int sent = 0;
+    while(sent < (int)sizeof(hello)){
+        ssize_t r = write(parent.socket_fd, buffer + sent, sizeof(hello) - sent);
+        if(r < 0){
+            if(errno == EINTR)
+                continue;
+            printf("\tEthernetConnector: Serious Error: Could not send hello frame to Parent\n");
+            close(parent.socket_fd);
+            parent.socket_fd = -1;
+            return false;
+        }
+        sent += r;
+    }
+    
     return true;
 }
 
@@ -210,7 +448,10 @@ bool EthernetConnector::set_parent_fd(){
 	
 	if(parent.host == NULL){
         printf("\tEthernetConnector: Serious Error: No such host (%s)\n", (char *)parent.host);
-        close(parent.socket_fd);
+        if(parent.socket_fd >= 0){
+            close(parent.socket_fd);
+            parent.socket_fd = -1;
+        }
         return false;
 	}
     
@@ -220,6 +461,8 @@ bool EthernetConnector::set_parent_fd(){
 		return false;
 	}
     
+	apply_options(parent.socket_fd);
+    
 	parent.length = sizeof(parent.address);
 	bzero((char *) &parent.address, parent.length);
 	parent.address.sin_family = AF_INET;
@@ -243,7 +486,7 @@ int EthernetConnector::write_parent(char * msg, int size){
     
 	// Critical section, we dont want threads writing to the same FD at the same time
 	write_parent_mutex.lock();
-	ssize_t r = write(parent.socket_fd,msg,size);
+	ssize_t r = send(parent.socket_fd, msg, size, MSG_NOSIGNAL);
 	write_parent_mutex.unlock();
 	return r;
 }
@@ -261,23 +504,140 @@ int EthernetConnector::read_parent(char * outbuf, int size){
     // Critical section; we don't want to have multiple threads read from the same FD at the same time
 	read_parent_mutex.lock();
 	int r = read((parent.socket_fd), outbuf, size);
+	if(options.quickack)
+		rearm_quickack(parent.socket_fd);
 	read_parent_mutex.unlock();
 	return r;
 }
 
+/*!
+ *	Apply the transport options to a socket. Failures are reported but not fatal; the socket still works untuned.
+ *
+ *  @param socket_fd The socket to tune.
+ */
+
+void EthernetConnector::apply_options(int socket_fd){
+    
+	int value;
+    
+	if(options.nodelay){
+		value = 1;
+		if(setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) < 0)
+			perror("\tEthernetConnector: TCP_NODELAY");
+	}
+    
+	if(options.send_buffer > 0){
+		value = options.send_buffer;
+		if(setsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value)) < 0)
+			perror("\tEthernetConnector: SO_SNDBUF");
+	}
+    
+	if(options.receive_buffer > 0){
+		value = options.receive_buffer;
+		if(setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value)) < 0)
+			perror("\tEthernetConnector: SO_RCVBUF");
+	}
+    
+#ifdef SO_BUSY_POLL
+	if(options.busy_poll > 0){
+		value = options.busy_poll;
+		if(setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) < 0)
+			perror("\tEthernetConnector: SO_BUSY_POLL");
+	}
+#endif
+    
+	if(options.quickack)
+		rearm_quickack(socket_fd);
+}
+
+/*!
+ *	Linux drops out of quick-ack mode on its own, so it has to be re-armed after every read.
+ *
+ *  @param socket_fd The socket to re-arm.
+ */
+
+inline void EthernetConnector::rearm_quickack(int socket_fd){
+#ifdef TCP_QUICKACK
+	int value = 1;
+	setsockopt(socket_fd, IPPROTO_TCP, TCP_QUICKACK, &value, sizeof(value));
+#endif
+}
+
+/*!
+ *	Set up zero-copy sends on every connection, if the options ask for them. Connections the kernel
+ *  cannot do zero-copy on simply keep using write().
+ *
+ *  @return True; the plain socket path always works.
+ */
+
+bool EthernetConnector::start(){
+    
+	if(!options.zerocopy_send)
+		return true;
+    
+	int senders = 0;
+    
+	// One slot per child, plus the parent at numChildren
+	zc_senders = new ZeroCopySender[numChildren + 1];
+    
+	for(int i = 0; i <= numChildren; i++){
+		int socket_fd = (i == numChildren) ? parent.socket_fd : children[i].socket_fd;
+		if(socket_fd < 0)
+			continue;
+        
+		if(zc_senders[i].enable(socket_fd))
+			senders++;
+	}
+    
+	if(V)
+		printf("\tEthernetConnector: Zero-copy send on %d connections\n", senders);
+    
+	return true;
+}
+
+/*!
+ *	Cork or uncork the connection to a node. While corked, partial frames are held back so a batch of
+ *  segments leaves in full-sized packets; uncorking flushes whatever is pending. No-op unless the cork option is set.
+ *
+ *  @param index The index of the child; -1 for the parent.
+ *  @param on True to cork; False to flush.
+ */
+
+void EthernetConnector::cork(int index, bool on){
+    
+	if(!options.cork)
+		return;
+    
+#ifdef TCP_CORK
+	int socket_fd = (index == -1) ? parent.socket_fd : children[index].socket_fd;
+	int value = on ? 1 : 0;
+	setsockopt(socket_fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+#endif
+}
+
 /*!
  *	Close the file descriptors between this node and its parent and children.
  */
 
 void EthernetConnector::stop()
 {
+	// Give zero-copy sends a chance to complete before their sockets go away
+	if(zc_senders != NULL){
+		for(int i = 0; i <= numChildren; i++)
+			zc_senders[i].drain(1000);
+	}
+    
 	// Close all open file descriptors (local, parent, children)
-	if(numChildren > 0){
+	if(numChildren > 0)
 		close(local.socket_fd);
+    
+	if(parent.socket_fd >= 0){
 		close(parent.socket_fd);
+		parent.socket_fd = -1;
 	}
     
 	for(int i = 0; i < numChildren; i++){
-		close((children[i].socket_fd));
+		if(children[i].socket_fd >= 0)
+			close((children[i].socket_fd));
 	}
 }
\ No newline at end of file
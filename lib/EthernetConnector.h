@@ -15,11 +15,39 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <stdint.h>
+#include <arpa/inet.h>
+
 #include <boost/thread.hpp>// used for lock
 
+#include "TransportOptions.h"
+#include "ZeroCopy.h"
+
 // Verbose Flag
 #define V	false
 
+// Hello frame: the first bytes a child sends on a fresh connection so the parent can map the socket to the child's declared index
+#define HELLO_MAGIC		0x47525254 // "GRRT"
+#define HELLO_VERSION	1
+
+// Capability bits advertised in the hello frame
+#define CAP_STREAM		(1 << 0) // Child speaks the TCP stream segment format
+#define CAP_DATAGRAM	(1 << 1) // Child can move its data path onto UDP datagrams (UdpConnector)
+
+// Seconds a newly accepted connection has to deliver its hello frame
+#define HELLO_TIMEOUT	5
+
+// Milliseconds accept_children() pauses after a failed poll() or accept(), doubling up to the maximum
+#define ACCEPT_BACKOFF_MIN	10
+#define ACCEPT_BACKOFF_MAX	1000
+
+struct HelloFrame{
+	uint32_t magic; // HELLO_MAGIC
+	uint32_t version; // HELLO_VERSION
+	int32_t child_index; // Index the child was configured with
+	uint32_t capabilities; // CAP_* bits
+};
+
 // Class for children nodes; encapsulates child-specific data
 class Node{
 public:
@@ -28,47 +56,79 @@ public:
 	sockaddr_in address; // IP address
 	hostent *host; // hostname
 	socklen_t length; // socket 'length'
+	uint32_t capabilities; // Capabilities advertised in the hello frame
 };
 
-// Class for Ethernet-specific connector
+// Class for Ethernet-specific connector; the data-path functions are virtual so other backends can take over the sockets
 class EthernetConnector{
 public:
     
 	// Default Constructor / Destructor
-	EthernetConnector(int number_of_children, int port);
-	~EthernetConnector();
+	EthernetConnector(int number_of_children, int port, const TransportOptions &options = TransportOptions());
+	virtual ~EthernetConnector();
 	
 	// Parent functions
-	bool connect_to_parent(char* hostname, int port);
-	int write_parent(char * msg, int size); // Return number of bytes written
-	int read_parent(char * outbuf, int size); // Return number of bytes read
+	bool connect_to_parent(char* hostname, int port, int child_index, uint32_t capabilities);
+	virtual int write_parent(char * msg, int size); // Return number of bytes written
+	virtual int read_parent(char * outbuf, int size); // Return number of bytes read
     
 	// Child functions
-	bool connect_to_child(int index, int port);
-	int write_child(int index, char * inbuf, unsigned long size); // Return number of bytes written
-	int read_child(int index, char * outbuf, int size); // Return number of bytes read
+	bool accept_children(); // Accept every child and map it by the index in its hello frame
+	uint32_t child_capabilities(int index);
+	virtual int write_child(int index, char * inbuf, unsigned long size); // Return number of bytes written
+	virtual int read_child(int index, char * outbuf, int size); // Return number of bytes read
+    
+	// Called once all connections are up, before any data moves; sets up zero-copy sends if asked for
+	virtual bool start();
+    
+	// Queue size bytes of buf for a node (-1 is the parent) and take ownership of buf; it is delete[]'d once sent
+	virtual bool write_async(int index, char * buf, unsigned long size);
+    
+	// Push every queued write out to the network
+	virtual void flush(){}
+    
+	// True if write_async() can block on a slow node; callers then give each node its own writer thread
+	virtual bool async_writes_block(){ return true; }
+    
+	// Hold back (true) or flush (false) partial frames to a node; -1 is the parent
+	void cork(int index, bool on);
     
 	// Close all file descriptors
-	void stop();
+	virtual void stop();
     
-private:
+protected:
     
-	// Private Variables
+	// Protected Variables
 	Node local;
 	Node parent;
 	Node *children; // Pointer to array of children nodes
 	
+	TransportOptions options; // Socket tuning applied to every connection
+	
+	// Zero-copy senders per connection (children, then the parent at numChildren); NULL unless enabled by start()
+	ZeroCopySender *zc_senders;
+    
 	int numChildren;
+	int numConnected; // Children that have completed the hello handshake
+	bool *connected; // connected[i] is true once child i has said hello
+    
+	// Guards children[], connected[] and numConnected while handshakes run in parallel
+	boost::mutex accept_mutex;
     
 	// Locks for File Descriptor access
 	boost::mutex read_parent_mutex;
 	boost::mutex write_parent_mutex;
-	boost::mutex read_child_mutex;
-	boost::mutex write_child_mutex;
+	boost::mutex *read_child_mutex; // One per child, so a slow child never holds up the others
+	boost::mutex *write_child_mutex;
+    
+private:
     
 	// Private Functions
 	bool set_local_fd();
 	bool set_parent_fd();
+	void apply_options(int socket_fd);
+	void rearm_quickack(int socket_fd);
+	void handshake_child(int socket_fd, sockaddr_in address, socklen_t length);
 };
 
 #endif
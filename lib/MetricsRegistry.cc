@@ -0,0 +1,315 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "MetricsRegistry.h"
+
+#include <sstream>
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+MetricHistogram::MetricHistogram() : total(0){
+	reset();
+}
+
+void MetricHistogram::reset(){
+	for(int i = 0; i < BUCKETS; i++)
+		counts[i] = 0;
+	total = 0;
+}
+
+void MetricHistogram::read(std::vector<unsigned long> &bucket_counts, uint64_t &sum){
+	bucket_counts.resize(BUCKETS);
+	for(int i = 0; i < BUCKETS; i++)
+		bucket_counts[i] = counts[i];
+	sum = total;
+}
+
+uint64_t MetricHistogram::upper_bound(int index){
+	if(index < 8)
+		return index;
+
+	int msb = index / 8 + 2;
+	uint64_t step = (uint64_t)1 << (msb - 3);
+	return (8 + (uint64_t)(index % 8)) * step + step - 1;
+}
+
+uint64_t MetricHistogram::quantile(double q){
+	std::vector<unsigned long> snapshot;
+	uint64_t sum;
+	read(snapshot, sum);
+
+	unsigned long count = 0;
+	for(int i = 0; i < BUCKETS; i++)
+		count += snapshot[i];
+	if(count == 0)
+		return 0;
+
+	unsigned long rank = (unsigned long)(q * (count - 1)) + 1;
+	unsigned long seen = 0;
+	for(int i = 0; i < BUCKETS; i++){
+		seen += snapshot[i];
+		if(seen >= rank)
+			return upper_bound(i);
+	}
+	return upper_bound(BUCKETS - 1);
+}
+
+static boost::mutex registry_mutex;
+static MetricsRegistry *registry = NULL;
+
+/*!
+ *	Get the registry, creating it (and starting the HTTP server, if ROUTER_METRICS_PORT is set) on first use.
+ *
+ *  @return The registry.
+ */
+
+MetricsRegistry *MetricsRegistry::get(){
+
+	boost::mutex::scoped_lock guard(registry_mutex);
+
+	if(registry == NULL){
+		registry = new MetricsRegistry();
+
+		const char *port = getenv("ROUTER_METRICS_PORT");
+		if(port != NULL && atoi(port) > 0 && !registry->serve(atoi(port)))
+			std::cout << "ERROR: Cannot serve metrics on port " << port << std::endl;
+	}
+
+	return registry;
+}
+
+MetricsRegistry::MetricsRegistry(){
+}
+
+/*!
+ *	Find a metric, creating it (and its family) if it is new.
+ *
+ *  @param name Metric family name.
+ *  @param help Description for the family's HELP line (the first one registered is kept).
+ *  @param type What kind of metric it is; a family keeps the type it was created with.
+ *  @param labels The metric's labels.
+ *  @return The metric, or NULL if the family already exists with another type.
+ */
+
+MetricsRegistry::metric *MetricsRegistry::find(const std::string &name, const std::string &help, metric_type type, const std::string &labels){
+
+	std::map<std::string, family>::iterator it = families.find(name);
+	if(it == families.end()){
+		family f;
+		f.help = help;
+		f.type = type;
+		it = families.insert(std::make_pair(name, f)).first;
+	}
+
+	if(it->second.type != type){
+		std::cout << "ERROR: Metric " << name << " registered again with another type" << std::endl;
+		return NULL;
+	}
+
+	std::map<std::string, metric>::iterator m = it->second.by_labels.find(labels);
+	if(m != it->second.by_labels.end())
+		return &m->second;
+
+	metric created;
+	created.type = type;
+	created.value = NULL;
+
+	switch(type){
+		case COUNTER: created.value = new MetricCounter(); break;
+		case GAUGE: created.value = new MetricGauge(); break;
+		case HISTOGRAM: created.value = new MetricHistogram(); break;
+		default: break;
+	}
+
+	return &(it->second.by_labels[labels] = created);
+}
+
+MetricCounter *MetricsRegistry::counter(const std::string &name, const std::string &help, const std::string &labels){
+	boost::mutex::scoped_lock guard(lock);
+	metric *m = find(name, help, COUNTER, labels);
+	return m ? (MetricCounter *)m->value : new MetricCounter(); // A clash still gets a (detached) metric to update
+}
+
+MetricGauge *MetricsRegistry::gauge(const std::string &name, const std::string &help, const std::string &labels){
+	boost::mutex::scoped_lock guard(lock);
+	metric *m = find(name, help, GAUGE, labels);
+	return m ? (MetricGauge *)m->value : new MetricGauge();
+}
+
+MetricHistogram *MetricsRegistry::histogram(const std::string &name, const std::string &help, const std::string &labels){
+	boost::mutex::scoped_lock guard(lock);
+	metric *m = find(name, help, HISTOGRAM, labels);
+	return m ? (MetricHistogram *)m->value : new MetricHistogram();
+}
+
+void MetricsRegistry::callback(const std::string &name, const std::string &help, bool is_counter, const std::string &labels, boost::function<double ()> read){
+	boost::mutex::scoped_lock guard(lock);
+	metric *m = find(name, help, is_counter ? COUNTER_CALLBACK : GAUGE_CALLBACK, labels);
+	if(m)
+		m->read = read;
+}
+
+// "name{labels}", or just "name" without labels
+static std::string series(const std::string &name, const std::string &labels){
+	return labels.empty() ? name : name + "{" + labels + "}";
+}
+
+/*!
+ *	Render every metric in the Prometheus text exposition format (version 0.0.4).
+ *
+ *  @return The exposition.
+ */
+
+std::string MetricsRegistry::render(){
+
+	boost::mutex::scoped_lock guard(lock);
+	std::ostringstream out;
+
+	for(std::map<std::string, family>::iterator f = families.begin(); f != families.end(); f++){
+		const std::string &name = f->first;
+		metric_type type = f->second.type;
+
+		const char *type_name = (type == COUNTER || type == COUNTER_CALLBACK) ? "counter" : (type == HISTOGRAM) ? "histogram" : "gauge";
+		out << "# HELP " << name << " " << f->second.help << "\n";
+		out << "# TYPE " << name << " " << type_name << "\n";
+
+		for(std::map<std::string, metric>::iterator m = f->second.by_labels.begin(); m != f->second.by_labels.end(); m++){
+			const std::string &labels = m->first;
+
+			switch(type){
+				case COUNTER:
+					out << series(name, labels) << " " << ((MetricCounter *)m->second.value)->get() << "\n";
+					break;
+				case GAUGE:
+					out << series(name, labels) << " " << ((MetricGauge *)m->second.value)->get() << "\n";
+					break;
+				case COUNTER_CALLBACK:
+				case GAUGE_CALLBACK:
+					out << series(name, labels) << " " << m->second.read() << "\n";
+					break;
+				case HISTOGRAM:
+				{
+					std::vector<unsigned long> counts;
+					uint64_t sum;
+					((MetricHistogram *)m->second.value)->read(counts, sum);
+
+					// Cumulative buckets up to the highest one in use, then +Inf
+					int last = 0;
+					for(int i = 0; i < MetricHistogram::BUCKETS; i++)
+						if(counts[i] > 0)
+							last = i;
+
+					std::string prefix = labels.empty() ? "" : labels + ",";
+					unsigned long cumulative = 0;
+					for(int i = 0; i <= last; i++){
+						cumulative += counts[i];
+						out << name << "_bucket{" << prefix << "le=\"" << MetricHistogram::upper_bound(i) << "\"} " << cumulative << "\n";
+					}
+					for(int i = last + 1; i < MetricHistogram::BUCKETS; i++)
+						cumulative += counts[i];
+
+					out << name << "_bucket{" << prefix << "le=\"+Inf\"} " << cumulative << "\n";
+					out << series(name + "_sum", labels) << " " << sum << "\n";
+					out << series(name + "_count", labels) << " " << cumulative << "\n";
+					break;
+				}
+			}
+		}
+	}
+
+	return out.str();
+}
+
+/*!
+ *	Serve the metrics over HTTP on localhost. Every request, whatever its path, gets render().
+ *
+ *  @param port TCP port to listen on.
+ *  @return True if listening; False if the socket cannot be set up.
+ */
+
+bool MetricsRegistry::serve(int port){
+
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	if(server < 0)
+		return false;
+
+	int yes = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+
+	if(bind(server, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(server, 8) < 0){
+		close(server);
+		return false;
+	}
+
+	server_thread = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&MetricsRegistry::serve_loop, this, server)));
+	return true;
+}
+
+void MetricsRegistry::serve_loop(int server){
+
+	while(true){
+		int client = accept(server, NULL, NULL);
+		if(client < 0)
+			continue;
+
+		// Read the request head; its contents do not matter
+		char request[2048];
+		int length = 0;
+		while(length < (int)sizeof(request) - 1){
+			int n = recv(client, request + length, sizeof(request) - 1 - length, 0);
+			if(n <= 0)
+				break;
+			length += n;
+			request[length] = '\0';
+			if(strstr(request, "\r\n\r\n") != NULL)
+				break;
+		}
+
+		std::string body = render();
+		std::ostringstream response;
+		response << "HTTP/1.0 200 OK\r\n"
+		         << "Content-Type: text/plain; version=0.0.4\r\n"
+		         << "Content-Length: " << body.size() << "\r\n"
+		         << "Connection: close\r\n\r\n"
+		         << body;
+
+		std::string bytes = response.str();
+		size_t sent = 0;
+		while(sent < bytes.size()){
+			int n = send(client, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+			if(n <= 0)
+				break;
+			sent += n;
+		}
+
+		close(client);
+	}
+}
@@ -0,0 +1,154 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef METRICSREGISTRY_H
+#define METRICSREGISTRY_H
+
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+/*
+ Process-wide metrics for the router blocks.
+
+ Blocks ask the registry for a counter, gauge or histogram by name (plus an optional Prometheus label set such
+ as child="2") once, when they are constructed, and keep the pointer; the same name and labels always give back
+ the same metric, and metrics live as long as the process. Updating one is a single atomic add or store, so
+ they can sit on the hot paths. Values that already exist elsewhere (a queue's depth, say) can be registered as
+ callbacks instead, read only when the metrics are rendered.
+
+ render() writes everything out in the Prometheus text format; serve() answers HTTP requests for it on
+ localhost. Setting ROUTER_METRICS_PORT in the environment starts the server when the registry is first used.
+ */
+
+// Monotonic count
+class MetricCounter{
+public:
+	MetricCounter() : value(0){}
+
+	void add(unsigned long n = 1){ __sync_fetch_and_add(&value, n); }
+	unsigned long get(){ return value; }
+
+private:
+	volatile unsigned long value;
+};
+
+// Value that goes up and down
+class MetricGauge{
+public:
+	MetricGauge() : value(0){}
+
+	void set(double v){ value = v; }
+	double get(){ return value; }
+
+private:
+	volatile double value;
+};
+
+/*
+ Distribution of non-negative integer values (microseconds, bytes, ...) in log-linear buckets: values below 8 get
+ a bucket each, and every power of two above that is split into 8, so a bucket is never more than 12.5% wide.
+ */
+class MetricHistogram{
+public:
+	MetricHistogram();
+
+	void observe(uint64_t v){
+		__sync_fetch_and_add(&counts[bucket(v)], 1);
+		__sync_fetch_and_add(&total, v);
+	}
+
+	// Snapshot: count per bucket, and the sum of the values seen
+	void read(std::vector<unsigned long> &bucket_counts, uint64_t &sum);
+
+	// Start over empty (not atomic with observe(); for owners that know nobody is observing)
+	void reset();
+
+	// Largest value that lands in a bucket
+	static uint64_t upper_bound(int index);
+
+	// The value at quantile q (0 to 1), to within its bucket
+	uint64_t quantile(double q);
+
+	static const int BUCKETS = 8 + 61 * 8;
+
+private:
+	static int bucket(uint64_t v){
+		if(v < 8)
+			return (int)v;
+		int msb = 63 - __builtin_clzll(v);
+		return (msb - 2) * 8 + (int)((v >> (msb - 3)) & 7);
+	}
+
+	volatile unsigned long counts[BUCKETS];
+	volatile uint64_t total;
+};
+
+class MetricsRegistry{
+public:
+
+	// The registry (created on first use)
+	static MetricsRegistry *get();
+
+	// Find or create a metric; labels is a Prometheus label list without the braces, e.g. child="2"
+	MetricCounter *counter(const std::string &name, const std::string &help, const std::string &labels = "");
+	MetricGauge *gauge(const std::string &name, const std::string &help, const std::string &labels = "");
+	MetricHistogram *histogram(const std::string &name, const std::string &help, const std::string &labels = "");
+
+	// A counter or gauge whose value is read from a function when the metrics are rendered
+	void callback(const std::string &name, const std::string &help, bool is_counter, const std::string &labels, boost::function<double ()> read);
+
+	// Every metric in the Prometheus text exposition format
+	std::string render();
+
+	// Answer HTTP requests on localhost:port with render() from a background thread; False if the port cannot be bound
+	bool serve(int port);
+
+private:
+
+	MetricsRegistry();
+
+	enum metric_type{ COUNTER, GAUGE, HISTOGRAM, COUNTER_CALLBACK, GAUGE_CALLBACK };
+
+	struct metric{
+		metric_type type;
+		void *value; // MetricCounter, MetricGauge or MetricHistogram
+		boost::function<double ()> read;
+	};
+
+	struct family{
+		std::string help;
+		metric_type type;
+		std::map<std::string, metric> by_labels;
+	};
+
+	metric *find(const std::string &name, const std::string &help, metric_type type, const std::string &labels);
+	void serve_loop(int server);
+
+	boost::mutex lock;
+	std::map<std::string, family> families;
+
+	boost::shared_ptr<boost::thread> server_thread;
+};
+
+#endif
@@ -19,6 +19,8 @@
  */
 
 #include "NetworkInterface.h"
+#include "UringConnector.h"
+#include "UdpConnector.h"
 
 #include <cstdio>
 #include <errno.h>
@@ -37,9 +39,10 @@
  *  @param children_count The number of children that this node has.
  *  @param port_arg The port on which this node will communicate on.
  *  @param root_arg True if this node is the root; else, False.
+ *  @param options Socket tuning applied to every connection.
  */
 
-NetworkInterface::NetworkInterface(int itemsize, int children_count, int port_arg, bool root_arg){
+NetworkInterface::NetworkInterface(int itemsize, int children_count, int port_arg, bool root_arg, const TransportOptions &options){
     
 	d_itemsize = itemsize; // The size of each element in the packet; going to be using bytes = 1
 	children = children_count;  // Number of children
@@ -47,13 +50,45 @@ NetworkInterface::NetworkInterface(int itemsize, int children_count, int port_ar
 	root = root_arg;  // Is this node the Root node?
 	d_residue  = new unsigned char[itemsize];
 	d_residue_len = 0;
+	queues = NULL;
+	queue_capacity = options.outbound_queue_depth;
     
-	// Create Ethernet Connector
-	connector = new EthernetConnector(children, port);
+	// Capabilities this node advertises to its parent
+	capabilities = CAP_STREAM;
+    
+	// Create Ethernet Connector: over UDP datagrams, on an io_uring if asked for and available, or on plain sockets
+	if(options.udp){
+		connector = new UdpConnector(children, port, options);
+		capabilities |= CAP_DATAGRAM;
+	}
+	else if(options.io_uring){
+#ifdef HAVE_LIBURING
+		connector = new UringConnector(children, port, options);
+#else
+		printf("NetworkInterface: io_uring requested, but this build has no liburing; using plain sockets\n");
+		connector = new EthernetConnector(children, port, options);
+#endif
+	}
+	else{
+		connector = new EthernetConnector(children, port, options);
+	}
 }
 
-/// Destructor
+/// Destructor; the writers send whatever is still queued before the connector goes away
 NetworkInterface::~NetworkInterface(){
+    
+	if(queues != NULL){
+		for(int i = 0; i < children; i++){
+			{
+				boost::mutex::scoped_lock lock(queues[i].lock);
+				queues[i].closing = true;
+				queues[i].not_empty.notify_all();
+			}
+			queues[i].writer->join();
+		}
+		delete[] queues;
+	}
+    
 	delete [] d_residue;
 	delete connector;
 }
@@ -61,52 +96,64 @@ NetworkInterface::~NetworkInterface(){
 /*!
  *	Connect function: The current node connects to it's parent and children.
  *
+ *  Children identify themselves with a hello frame, so they are accepted in whatever order they arrive and
+ *  filed under the index they declare rather than the order in which they connected.
+ *
  *  @param parent_hostname The hostname or ip address of this node's parent.
+ *  @param index The index this node declares to its parent (ignored by the root).
  *  @return bool True if the node had connected to its neighbors; else if False.
  */
 
-bool NetworkInterface::connect(char* parent_hostname){
+bool NetworkInterface::connect(char* parent_hostname, int index){
     
-	// If ROOT, connect down to children
-	if(root){
-		for(int i = 0; i < children; i++){
-            
-			if(V)printf("Attempting to connect to child %d...\n", i);
-            
-			// Keep attempting to connect to children
-			while(!connector->connect_to_child(i, port)){
-				if(V)
-					printf("Failed to connect to child %d...\n", i);
-				sleep(1);
-			}
-		}
-		return true;
-	}
-    
-	// If not ROOT, connect up to parent, then down to children
-	else{
+	// If not ROOT, connect up to parent first
+	if(!root){
         
-		if(V)printf("Attempting to connect to Parent...\n");
+		if(V)printf("Attempting to connect to Parent as child %d...\n", index);
         
         // Keep attempting to connect to parent
-		while(!connector->connect_to_parent(parent_hostname, port)){
+		while(!connector->connect_to_parent(parent_hostname, port, index, capabilities)){
 			if(V)printf("Failed to connect to Parent...\n");
 			sleep(1);
 		}
+	}
+    
+	// Then accept all children at once
+	if(children > 0){
         
-		// Connect down to all children
+		if(V)printf("Waiting for %d children to connect...\n", children);
+        
+		if(!connector->accept_children())
+			return false;
+	}
+    
+	// Everything is connected; let the backend take over the data path
+	if(!connector->start())
+		printf("NetworkInterface: Transport backend failed to start; using plain sockets\n");
+    
+	// Give every child its own writer, so one child with a full window never stalls the rest
+	if(children > 0 && connector->async_writes_block()){
+		queues = new OutboundQueue[children];
 		for(int i = 0; i < children; i++){
-            
-			if(V)printf("Attempting to connect to child %d...\n", i);
-            
-            // Keep attempting to connect to children
-			while(!connector->connect_to_child(i, port)){
-				if(V)printf("Failed to connect to child %d...\n", i);
-				sleep(1);
-			}
+			queues[i].bytes = 0;
+			queues[i].closing = false;
+			queues[i].failed = false;
+			queues[i].writer = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&NetworkInterface::writer, this, i)));
 		}
-		return true;
 	}
+    
+	return true;
+}
+
+/*!
+ *	Return the capabilities a child advertised in its hello frame.
+ *
+ *  @param child_index Index of the child.
+ *  @return The CAP_* bits of the child.
+ */
+
+uint32_t NetworkInterface::child_capabilities(int child_index){
+	return connector->child_capabilities(child_index);
 }
 
 /// Code copied from file_descriptor_source_impl from GNURADIO code
@@ -252,3 +299,134 @@ int NetworkInterface::send(int child_index, char* msg, int packet_size){
     
  	return packet_size;
 }
+
+/*!
+ *	Asynchronous send function: Queue data for node with index child_index and return without waiting for it
+ *  to reach the socket. On backends whose writes can block, each child has a bounded queue drained by its
+ *  own writer thread; otherwise the backend queues the send itself and it goes out on the next flush().
+ *  Do not mix send() and send_async() to the same child; send() would jump the queue.
+ *
+ *  @param child_index Index of the node to send to; -1 for parent; >= 0 for child
+ *  @param msg Pointer to byte array allocated with new[]; the interface deletes it once sent.
+ *  @param packet_size The size in items of the data to be sent.
+ *  @return True if the data was queued (or sent); False on error, including an earlier write to the child
+ *  having failed on its writer thread.
+ */
+
+bool NetworkInterface::send_async(int child_index, char* msg, int packet_size){
+    
+	unsigned long size = (unsigned long)packet_size * d_itemsize;
+    
+	if(queues == NULL || child_index < 0)
+		return connector->write_async(child_index, msg, size);
+    
+	OutboundQueue &q = queues[child_index];
+	boost::mutex::scoped_lock lock(q.lock);
+    
+	while((int)q.segments.size() >= queue_capacity && !q.closing && !q.failed)
+		q.not_full.wait(lock);
+    
+	if(q.closing || q.failed){
+		delete[] msg;
+		return false;
+	}
+    
+	q.segments.push_back(std::make_pair(msg, size));
+	q.bytes += size;
+	q.not_empty.notify_one();
+    
+	return true;
+}
+
+/*!
+ *	Writer thread: one per child. Sends that child's queued segments in order until the interface closes,
+ *  then drains whatever is left.
+ *
+ *  @param child_index Index of the child this writer serves.
+ */
+
+void NetworkInterface::writer(int child_index){
+    
+	OutboundQueue &q = queues[child_index];
+    
+	while(true){
+		std::pair<char*, unsigned long> segment;
+        
+		{
+			boost::mutex::scoped_lock lock(q.lock);
+			while(q.segments.empty() && !q.closing)
+				q.not_empty.wait(lock);
+            
+			if(q.segments.empty())
+				return;
+            
+			segment = q.segments.front();
+		}
+        
+		// The segment stays counted in the queue until it is on the wire, so depth reflects what this child still owes.
+		// Once a write has failed the rest are dropped; the failure reaches the caller through send_async().
+		bool written = false;
+		if(!q.failed)
+			written = connector->write_async(child_index, segment.first, segment.second);
+		else
+			delete[] segment.first;
+        
+		bool drained;
+		{
+			boost::mutex::scoped_lock lock(q.lock);
+			if(!written && !q.failed){
+				q.failed = true;
+				printf("NetworkInterface: Write to child %d failed; refusing further sends to it\n", child_index);
+			}
+			q.segments.pop_front();
+			q.bytes -= segment.second;
+			drained = q.segments.empty();
+			q.not_full.notify_all();
+		}
+        
+		if(drained)
+			connector->flush();
+	}
+}
+
+/*!
+ *	Number of segments waiting in a child's outbound queue (including the one being written).
+ *
+ *  @param child_index Index of the child.
+ *  @return Queued segments; 0 if the backend does not queue.
+ */
+
+int NetworkInterface::queue_depth(int child_index){
+	if(queues == NULL || child_index < 0 || child_index >= children)
+		return 0;
+	boost::mutex::scoped_lock lock(queues[child_index].lock);
+	return queues[child_index].segments.size();
+}
+
+/*!
+ *	Number of bytes waiting in a child's outbound queue (including the segment being written).
+ *
+ *  @param child_index Index of the child.
+ *  @return Queued bytes; 0 if the backend does not queue.
+ */
+
+unsigned long NetworkInterface::queued_bytes(int child_index){
+	if(queues == NULL || child_index < 0 || child_index >= children)
+		return 0;
+	boost::mutex::scoped_lock lock(queues[child_index].lock);
+	return queues[child_index].bytes;
+}
+
+/*!
+ *	Whether send_async() to a child would block right now.
+ *
+ *  @param child_index Index of the child.
+ *  @return True if the child's outbound queue is at capacity.
+ */
+
+bool NetworkInterface::queue_full(int child_index){
+	if(queues == NULL || child_index < 0 || child_index >= children)
+		return false;
+	boost::mutex::scoped_lock lock(queues[child_index].lock);
+	return (int)queues[child_index].segments.size() >= queue_capacity;
+}
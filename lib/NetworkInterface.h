@@ -30,6 +30,8 @@
 #include <stdexcept>
 #include <stdio.h>
 #include <string.h>
+#include <deque>
+#include <utility>
 #include "EthernetConnector.h"
 
 #ifdef HAVE_IO_H
@@ -38,15 +40,40 @@
 
 #define V   false
 
+// Largest segment body (data and side-band) accepted off the wire; anything bigger means the stream is corrupt or out
+// of step, and is not worth an allocation to find out
+#define MAX_SEGMENT_BYTES	(64 * 1024 * 1024)
+
+// True if a size read off the wire (a count of unit-byte items, sent as a float) is usable: not NaN, not negative,
+// and within MAX_SEGMENT_BYTES
+static inline bool wire_size_ok(float count, int unit){
+	return count >= 0 && count <= (float)(MAX_SEGMENT_BYTES / unit); // NaN fails both comparisons
+}
+
+// One child's outbound segments, drained in order by that child's writer thread
+struct OutboundQueue{
+	boost::mutex lock;
+	boost::condition_variable not_empty; // Signalled when a segment is queued or the queue is closing
+	boost::condition_variable not_full; // Signalled when the writer takes a segment
+	std::deque<std::pair<char*, unsigned long> > segments; // Buffers (owned) and their sizes in bytes
+	unsigned long bytes; // Bytes queued
+	bool closing; // Writer drains what is left and exits
+	bool failed; // A write failed, so the connection is broken: send_async() refuses and the writer discards
+	boost::shared_ptr<boost::thread> writer;
+};
+
 class NetworkInterface{
 public:
     
 	// Default Constructor/Destructor
-	NetworkInterface(int itemsize, int children, int port, bool root);
+	NetworkInterface(int itemsize, int children, int port, bool root, const TransportOptions &options = TransportOptions());
 	~NetworkInterface();
     
     // Build connection graph
-    bool connect(char* parent_hostname);
+    bool connect(char* parent_hostname, int index = 0);
+    
+    // Capabilities child_index advertised when it connected
+    uint32_t child_capabilities(int child_index);
     
     // Receive
     int receive(int child_index, char * outbuf, int noutput_items);
@@ -54,18 +81,40 @@ public:
     // Send msg to child at index child_index
     int send(int child_index, char* msg, int num);
     
+    // Queue msg for child_index without waiting; the interface takes ownership of msg (allocated with new[])
+    // Only blocks if child_index's outbound queue is full
+    bool send_async(int child_index, char* msg, int num);
+    
+    // Segments and bytes waiting in child_index's outbound queue, and whether send_async() would block
+    int queue_depth(int child_index);
+    unsigned long queued_bytes(int child_index);
+    bool queue_full(int child_index);
+    
+    // Push all queued sends out to the network
+    void flush(){ connector->flush(); }
+    
+    // Bracket a run of sends to one node so they leave in full-sized packets
+    void begin_batch(int child_index){ connector->cork(child_index, true); }
+    void end_batch(int child_index){ connector->cork(child_index, false); }
+    
 private:
     
     // Private functions
     int read_items(int child_index, char *buf, int nitems);
     int handle_residue(char *buf, int nbytes_read);
     void flush_residue(){d_residue_len = 0; }
+    void writer(int child_index);
     
     
     EthernetConnector *connector;
+    
+    // Per-child outbound queues; NULL when the backend's write_async() never blocks
+    OutboundQueue *queues;
+    int queue_capacity;
     int children;
     int port;
     bool root;
+    uint32_t capabilities; // CAP_* bits advertised to the parent
     size_t d_itemsize; //# Size of the items to be sent/received
     
     // For receiving
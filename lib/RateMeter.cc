@@ -0,0 +1,177 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "RateMeter.h"
+
+#include <math.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// The TSC is only usable as a clock if it is invariant (CPUID 0x80000007, EDX bit 8)
+static bool invariant_tsc(){
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned a, b, c, d;
+	if(__get_cpuid(0x80000000, &a, &b, &c, &d) && a >= 0x80000007 && __get_cpuid(0x80000007, &a, &b, &c, &d))
+		return (d >> 8) & 1;
+#endif
+	return false;
+}
+
+bool MonotonicClock::use_tsc = invariant_tsc();
+
+uint64_t MonotonicClock::monotonic_ns(){
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*!
+ *	The clock's rate. For the TSC this is measured against CLOCK_MONOTONIC over 20 ms the first time it is asked for.
+ *
+ *  @return Ticks per second.
+ */
+
+double MonotonicClock::ticks_per_second(){
+
+	if(!use_tsc)
+		return 1e9;
+
+	static double rate = 0;
+	if(rate == 0){
+		uint64_t ns0 = monotonic_ns();
+		uint64_t tsc0 = ticks();
+
+		timespec pause = {0, 20000000};
+		nanosleep(&pause, NULL);
+
+		uint64_t ns1 = monotonic_ns();
+		uint64_t tsc1 = ticks();
+		rate = (double)(tsc1 - tsc0) * 1e9 / (double)(ns1 - ns0);
+	}
+	return rate;
+}
+
+/*!
+ *	Make a meter.
+ *
+ *  @param interval_seconds Length of an interval.
+ *  @param window_intervals Intervals in the sliding window.
+ *  @param ewma_seconds Time constant of the EWMA.
+ */
+
+RateMeter::RateMeter(double interval_seconds, int window_intervals, double ewma) : tick_rate(MonotonicClock::ticks_per_second()),
+	ewma_seconds(ewma), first(0), interval_start(0), count(0), total(0), window_next(0), closed_intervals(0), last_rate(0), ewma_rate(0), window_rate(0){
+	set_interval(interval_seconds);
+	set_window(window_intervals);
+}
+
+void RateMeter::set_interval(double seconds){
+	interval_ticks = (uint64_t)(seconds * tick_rate);
+	if(interval_ticks == 0)
+		interval_ticks = 1;
+}
+
+void RateMeter::set_window(int intervals){
+	if(intervals < 1)
+		intervals = 1;
+	window_items.assign(intervals, 0);
+	window_starts.assign(intervals, 0);
+	window_ends.assign(intervals, 0);
+	window_next = 0;
+}
+
+void RateMeter::set_ewma_time(double seconds){
+	ewma_seconds = seconds;
+}
+
+/*!
+ *	Close the open interval and work out the new rates.
+ *
+ *  @param now When the interval ends, in ticks.
+ */
+
+void RateMeter::close(uint64_t now){
+
+	double seconds = (now - interval_start) / tick_rate;
+	double rate = count / seconds;
+
+	double alpha = 1 - exp(-seconds / ewma_seconds);
+	ewma_rate = (closed_intervals == 0) ? rate : ewma_rate + alpha * (rate - ewma_rate);
+	last_rate = rate;
+	closed_intervals++;
+
+	window_items[window_next] = count;
+	window_starts[window_next] = interval_start;
+	window_ends[window_next] = now;
+	window_next = (window_next + 1) % window_items.size();
+
+	count = 0;
+	interval_start = now;
+	window_rate = window_at();
+}
+
+double RateMeter::instantaneous_at(){
+	uint64_t now = MonotonicClock::ticks();
+	double open = (now - interval_start) / tick_rate;
+
+	// Past a full interval without an update, the open interval says more than the last closed one
+	if(first != 0 && now - interval_start >= 2 * interval_ticks)
+		return count / open;
+	return last_rate;
+}
+
+/*!
+ *	The window rate as of now: the open interval plus the closed ones that end within window_intervals intervals
+ *  of now, over the time from the first of those to now.
+ *
+ *  @return Items per second.
+ */
+
+double RateMeter::window_at(){
+
+	if(first == 0)
+		return 0;
+
+	uint64_t now = MonotonicClock::ticks();
+	uint64_t span = interval_ticks * window_items.size();
+
+	unsigned long items = count;
+	uint64_t start = interval_start;
+	for(size_t i = 0; i < window_items.size(); i++){
+		if(window_ends[i] != 0 && now - window_ends[i] < span){
+			items += window_items[i];
+			if(window_starts[i] < start)
+				start = window_starts[i];
+		}
+	}
+
+	if(now <= start)
+		return 0;
+	return items / ((now - start) / tick_rate);
+}
+
+double RateMeter::average(){
+	if(first == 0)
+		return 0;
+	return total / ((MonotonicClock::ticks() - first) / tick_rate);
+}
@@ -0,0 +1,125 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef RATEMETER_H
+#define RATEMETER_H
+
+#include <vector>
+#include <stdint.h>
+
+/*
+ Cheap monotonic timestamps for hot paths. On x86 with an invariant TSC (one that ticks at a constant rate
+ whatever the core's frequency or sleep state), ticks() is a bare rdtsc; elsewhere it falls back to
+ CLOCK_MONOTONIC in nanoseconds. The tick rate is calibrated against CLOCK_MONOTONIC on first use.
+ */
+class MonotonicClock{
+public:
+	static inline uint64_t ticks(){
+#if defined(__x86_64__) || defined(__i386__)
+		if(use_tsc)
+			return __builtin_ia32_rdtsc();
+#endif
+		return monotonic_ns();
+	}
+
+	static double ticks_per_second();
+
+	static uint64_t monotonic_ns();
+
+private:
+	static bool use_tsc;
+};
+
+/*
+ Item rates over a stream, measured in intervals. update() is called with each batch of items; once an interval
+ has passed it closes it, giving:
+ 	- the instantaneous rate: items over the interval just closed
+ 	- the EWMA rate: instantaneous rates blended with weight 1 - exp(-interval / time constant), so a long
+ 	  interval (a stall) counts for more
+ 	- the window rate: items over the last window_intervals intervals
+ A stall shows on the next update(), which closes one long, slow interval; the *_at() readers also account
+ for the time since the last update, so a stream that stops completely reads as slowing down.
+
+ One thread updates; others may read (the values are plain doubles, so a reader can at worst see a rate from
+ the interval before).
+ */
+class RateMeter{
+public:
+	RateMeter(double interval_seconds = 0.1, int window_intervals = 10, double ewma_seconds = 1.0);
+
+	// Count items; True if this closed an interval (the rates changed)
+	inline bool update(unsigned long items){
+		uint64_t now = MonotonicClock::ticks();
+		bool closed = false;
+		if(first == 0)
+			first = interval_start = now;
+		else if(now - interval_start >= interval_ticks){
+			close(now);
+			closed = true;
+		}
+		count += items;
+		total += items;
+		return closed;
+	}
+
+	void set_interval(double seconds);
+	void set_window(int intervals);
+	void set_ewma_time(double seconds);
+
+	// Rates (items per second) as of the last closed interval
+	double instantaneous(){ return last_rate; }
+	double ewma(){ return ewma_rate; }
+	double window(){ return window_rate; }
+
+	// Rates as of now, counting the time since the last update
+	double instantaneous_at();
+	double window_at();
+
+	// Items per second since the first update
+	double average();
+
+	unsigned long items(){ return total; }
+	unsigned long intervals(){ return closed_intervals; }
+
+private:
+	void close(uint64_t now);
+
+	double tick_rate; // Ticks per second
+	uint64_t interval_ticks;
+	double ewma_seconds;
+
+	uint64_t first; // When the first interval started; 0 before the first update
+	uint64_t interval_start;
+	volatile unsigned long count; // Items in the open interval
+	volatile unsigned long total;
+
+	// Closed intervals, oldest overwritten first
+	std::vector<unsigned long> window_items;
+	std::vector<uint64_t> window_starts;
+	std::vector<uint64_t> window_ends;
+	int window_next;
+	unsigned long closed_intervals;
+
+	volatile double last_rate;
+	volatile double ewma_rate;
+	volatile double window_rate;
+};
+
+#endif
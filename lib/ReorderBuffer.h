@@ -0,0 +1,162 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef REORDERBUFFER_H
+#define REORDERBUFFER_H
+
+#include <vector>
+
+/*
+ Fixed-size reordering window for segments that arrive out of index order.
+
+ Slot (index - next) of a ring holds the segment with that index, so inserting and taking the next
+ in-order segment are both O(1), however large the backlog. The window covers indexes
+ [next, next + capacity); a segment beyond it does not fit, and the caller decides whether to wait for
+ the window to drain or to give up on the index it is waiting for (skip()).
+ */
+
+template <typename T>
+class ReorderBuffer{
+public:
+
+	enum InsertResult{
+		REORDER_INSERTED, // Stored in its slot
+		REORDER_STALE, // Index already emitted or skipped (or a duplicate); not stored
+		REORDER_OVERFLOW // Index beyond the window; not stored
+	};
+
+	/*!
+	 *	@param window_capacity The number of indexes the window spans; rounded up to a power of two.
+	 *  @param first_index The index expected first.
+	 */
+
+	ReorderBuffer(int window_capacity, long first_index = 0) :
+		next(first_index), count(0), high_water(0), overflows(0), skipped(0), stale(0)
+	{
+		size = 1;
+		while(size < window_capacity)
+			size <<= 1;
+		mask = size - 1;
+
+		slots.assign(size, T());
+		filled.assign(size, false);
+	}
+
+	/*!
+	 *	File a segment under its index.
+	 *
+	 *  @param index The segment's index.
+	 *  @param item The segment.
+	 *  @return REORDER_INSERTED, REORDER_STALE or REORDER_OVERFLOW; the caller keeps ownership of item unless it was REORDER_INSERTED.
+	 */
+
+	InsertResult insert(long index, T item){
+
+		long offset = index - next;
+
+		if(offset < 0 || (offset < size && filled[index & mask])){
+			stale++;
+			return REORDER_STALE;
+		}
+
+		if(offset >= size){
+			overflows++;
+			return REORDER_OVERFLOW;
+		}
+
+		slots[index & mask] = item;
+		filled[index & mask] = true;
+		count++;
+		if(count > high_water)
+			high_water = count;
+
+		return REORDER_INSERTED;
+	}
+
+	/// True if the segment with the next index is waiting
+	bool ready(){ return filled[next & mask]; }
+
+	/// True if the segment with this index is waiting
+	bool holds(long index){ return index >= next && index - next < size && filled[index & mask]; }
+
+	/// The segment with the next index, left in place. Only valid when ready().
+	T front(){ return slots[next & mask]; }
+
+	/*!
+	 *	Take the next in-order segment. Only valid when ready().
+	 *
+	 *  @return The segment with index next_index(); the window then moves on by one.
+	 */
+
+	T pop(){
+		T item = slots[next & mask];
+		slots[next & mask] = T();
+		filled[next & mask] = false;
+		count--;
+		next++;
+		return item;
+	}
+
+	/// Give up on the next index (it is not waiting) and move the window on by one
+	void skip(){
+		next++;
+		skipped++;
+	}
+
+	/*!
+	 *	Give up on every index before index in one step, however far off it is. Only valid if none of them is
+	 *  waiting (with the window empty, say).
+	 *
+	 *  @param index The index to expect next; nothing happens if it is not ahead of next_index().
+	 */
+
+	void skip_to(long index){
+		if(index <= next)
+			return;
+		skipped += index - next;
+		next = index;
+	}
+
+	long next_index(){ return next; }
+	int occupancy(){ return count; }
+	int capacity(){ return size; }
+
+	// Metrics
+	int high_water_mark(){ return high_water; } // Most segments held at once
+	unsigned long overflow_count(){ return overflows; } // Inserts beyond the window
+	unsigned long skipped_count(){ return skipped; } // Indexes given up on
+	unsigned long stale_count(){ return stale; } // Inserts of indexes already emitted, skipped or held
+
+private:
+
+	std::vector<T> slots;
+	std::vector<bool> filled;
+	long size;
+	long mask;
+	long next; // Index expected next
+	int count; // Segments held
+
+	int high_water;
+	unsigned long overflows;
+	unsigned long skipped;
+	unsigned long stale;
+};
+
+#endif
@@ -0,0 +1,55 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef ROUTERPROBES_H
+#define ROUTERPROBES_H
+
+/*
+ Static tracepoints (USDT) in the router's hot paths, for perf, bpftrace and SystemTap.
+
+ With sys/sdt.h available (HAVE_SYS_SDT_H), each ROUTER_PROBEn() compiles to a single nop plus a note in the
+ ELF file; a tracer attached to the probe turns the nop into a breakpoint. Without it they compile to
+ nothing. Arguments are plain integers (segment index, queue or child number, sizes), so computing them
+ costs nothing worth guarding.
+
+ Provider "router"; the probes and their arguments:
+ 	segment_create	index, items			queue sink built a segment
+ 	queue_push		queue, index, depth		segment pushed onto a shared queue (depth after the push)
+ 	queue_pop		queue, index, depth		segment popped off a shared queue (depth after the pop)
+ 	dispatch		index, child, weight	root picked the child for a segment
+ 	send			index, child, bytes		segment handed to the connector (child -1: the parent)
+ 	receive			index, child, bytes		segment fully read off the wire (child -1: from the parent)
+ 	reorder_emit	index, gap, held		queue source started streaming a segment in order (gap: a filled hole;
+ 											held: segments waiting behind it)
+
+ bin/probes/ has bpftrace scripts that turn these into per-hop latency histograms.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define ROUTER_PROBE2(name, a, b)		DTRACE_PROBE2(router, name, a, b)
+#define ROUTER_PROBE3(name, a, b, c)	DTRACE_PROBE3(router, name, a, b, c)
+#else
+#define ROUTER_PROBE2(name, a, b)		do{}while(0)
+#define ROUTER_PROBE3(name, a, b, c)	do{}while(0)
+#endif
+
+#endif
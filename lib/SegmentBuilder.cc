@@ -0,0 +1,147 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "SegmentBuilder.h"
+#include "TagSideband.h"
+
+#include <string.h>
+
+/*!
+ *  Pack the side-band for a segment: the tags on its items, after an overlap tag on the first history item if
+ *  there is history in front of the data.
+ *
+ *  @param tags The tags on the data items.
+ *  @param first Absolute offset of the first data item.
+ *  @param history_items Items repeated from the stream before, in front of the data.
+ *  @param sideband Where the side-band goes (cleared first; left empty if there is nothing to carry).
+ */
+
+static void pack_sideband(const std::vector<gr::tag_t> &tags, uint64_t first, int history_items, std::vector<char> &sideband){
+
+	// Every other tag rides along in the segment's side-band
+	sideband.clear();
+
+	if(history_items == 0){
+		TagSideband::pack(tags, first, sideband);
+	}
+	else{
+		// The segment starts with the previous window's last items; an overlap tag on the first says how many
+		gr::tag_t overlap_tag;
+		overlap_tag.key = pmt::string_to_symbol("overlap");
+		overlap_tag.value = pmt::from_long(history_items);
+		overlap_tag.offset = first - history_items;
+		overlap_tag.srcid = pmt::PMT_F;
+
+		std::vector<gr::tag_t> segment_tags(1, overlap_tag);
+		segment_tags.insert(segment_tags.end(), tags.begin(), tags.end());
+		TagSideband::pack(segment_tags, first - history_items, sideband);
+	}
+}
+
+/*!
+ *  Build a segment: type 1, or type 4 if there are tags (other than the index) or history to carry.
+ *
+ *  @param index The segment's index.
+ *  @param data The items.
+ *  @param items Number of items.
+ *  @param first Absolute offset of the first item.
+ *  @param tags The tags on those items.
+ *  @param history Items repeated from the stream before, put in front of data.
+ *  @param sideband Scratch space for the side-band.
+ *  @return The segment, allocated with new.
+ */
+
+std::vector<float> *build_segment(float index, const float *data, int items, uint64_t first, const std::vector<gr::tag_t> &tags,
+	const std::vector<float> &history, std::vector<char> &sideband){
+
+	int history_items = history.size();
+	pack_sideband(tags, first, history_items, sideband);
+
+	std::vector<float> *segment = new std::vector<float>();
+
+	if(sideband.empty()){
+
+		// Build type-1 segment
+		segment->reserve(items + 3);
+		segment->push_back(1); // Push back the type (message type 1)
+		segment->push_back(index); // Push the index of this window
+		segment->push_back(items); // Push the number of floats we're packing into this message
+		segment->insert(segment->end(), &data[0], &data[items]);
+	}
+	else{
+
+		// Build type-4 segment: a type-1 segment with a tag side-band behind the data
+		int tag_floats = (sideband.size() + sizeof(float) - 1) / sizeof(float);
+
+		segment->reserve(history_items + items + 4 + tag_floats);
+		segment->push_back(4); // Push back the type (message type 4)
+		segment->push_back(index); // Push the index of this window
+		segment->push_back(history_items + items); // Push the number of floats we're packing into this message
+		segment->push_back(tag_floats); // Push the number of floats the side-band takes
+		segment->insert(segment->end(), history.begin(), history.end());
+		segment->insert(segment->end(), &data[0], &data[items]);
+		segment->resize(segment->size() + tag_floats, 0);
+		memcpy(&(*segment)[4 + history_items + items], &sideband[0], sideband.size());
+	}
+
+	return segment;
+}
+
+/*!
+ *  Build a byte segment: type 2, or type 5 if there are tags (other than the index) or history to carry. The
+ *  header fields are floats copied in byte by byte.
+ *
+ *  @param index The segment's index.
+ *  @param data The bytes.
+ *  @param items Number of bytes.
+ *  @param first Absolute offset of the first byte.
+ *  @param tags The tags on those bytes.
+ *  @param history Bytes repeated from the stream before, put in front of data.
+ *  @param sideband Scratch space for the side-band.
+ *  @return The segment, allocated with new.
+ */
+
+std::vector<char> *build_segment(float index, const char *data, int items, uint64_t first, const std::vector<gr::tag_t> &tags,
+	const std::vector<char> &history, std::vector<char> &sideband){
+
+	int history_items = history.size();
+	pack_sideband(tags, first, history_items, sideband);
+
+	int header = sideband.empty() ? 9 : 13;
+	float size = history_items + items;
+
+	std::vector<char> *segment = new std::vector<char>(header);
+	segment->reserve(header + history_items + items + sideband.size());
+	(*segment)[0] = sideband.empty() ? '2' : '5'; // The type (message type 2, or 5 with a side-band)
+	memcpy(&(*segment)[1], &index, 4); // The index of this window
+	memcpy(&(*segment)[5], &size, 4); // The number of bytes we're packing into this message
+
+	if(!sideband.empty()){
+		float tag_bytes = sideband.size();
+		memcpy(&(*segment)[9], &tag_bytes, 4); // The number of side-band bytes behind the data
+	}
+
+	segment->insert(segment->end(), history.begin(), history.end());
+	segment->insert(segment->end(), &data[0], &data[items]);
+	segment->insert(segment->end(), sideband.begin(), sideband.end());
+
+	return segment;
+}
@@ -0,0 +1,124 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef SEGMENTBUILDER_H
+#define SEGMENTBUILDER_H
+
+#include <gnuradio/tags.h>
+#include <stdint.h>
+#include <vector>
+#include <cstring>
+
+namespace gr {
+    namespace router {
+
+        /*
+         Where the header fields and the data sit in each kind of segment.
+
+         Type-1 Segments (float)
+         |
+         float < type :: [0] > -- contains the message type (1; 3 is the kill message)
+         float < index :: [1] > -- contains the index of the data segment
+         float < size :: [2] > -- contains the size of the data in the data field to come next
+         float < data :: [3, size + 3 - 1] > -- contains data
+         |
+
+         Type-4 Segments (float; type-1 with stream tags)
+         |
+         float < type :: [0] > -- contains the message type (4)
+         float < index :: [1] > -- contains the index of the data segment
+         float < size :: [2] > -- contains the size of the data in the data field to come next
+         float < tag size :: [3] > -- contains the number of floats the tag side-band takes
+         float < data :: [4, size + 4 - 1] > -- contains data
+         float < tags :: [size + 4, ...] > -- contains the tag side-band (TagSideband.h)
+         |
+
+         Type-2 Segments (byte)
+         |
+         byte < type :: [0] > -- contains the message type ('2'; '3' is the kill message)
+         byte * 4 (float) < index :: [1,2,3,4] > -- contains the index of the window
+         byte * 4 (float) < size :: [5,6,7,8] > -- contains the size of the data in the data field to come next
+         byte < data :: [9, size + 9 - 1] > -- contains data
+         |
+
+         Type-5 Segments (byte; type-2 with stream tags)
+         |
+         byte < type :: [0] > -- contains the message type ('5')
+         byte * 4 (float) < index :: [1,2,3,4] > -- contains the index of the window
+         byte * 4 (float) < size :: [5,6,7,8] > -- contains the size of the data in the data field to come next
+         byte * 4 (float) < tag size :: [9,10,11,12] > -- contains the size of the tag side-band in bytes
+         byte < data :: [13, size + 13 - 1] > -- contains data
+         byte < tags :: [size + 13, ...] > -- contains the tag side-band (TagSideband.h)
+         |
+         */
+
+        template <typename T> struct segment_format;
+
+        // is_data() also checks the header is all there; the other accessors need a segment that passed it
+        template <> struct segment_format<float>{
+            static bool is_data(const std::vector<float> &s){ return (s.size() >= 3 && (int)s[0] == 1) || (s.size() >= 4 && (int)s[0] == 4); }
+            static bool is_kill(const std::vector<float> &s){ return (int)s[0] == 3; }
+            static long index(const std::vector<float> &s){ return (long)s[1]; }
+            static int size(const std::vector<float> &s){ return (int)s[2]; }
+            static int data_offset(const std::vector<float> &s){ return ((int)s[0] == 4) ? 4 : 3; }
+            static int sideband_bytes(const std::vector<float> &s){ return ((int)s[0] == 4) ? (int)s[3] * sizeof(float) : 0; }
+            static std::vector<float> *make(long index, int size){
+                std::vector<float> *s = new std::vector<float>(3 + size, 0);
+                (*s)[0] = 1; (*s)[1] = index; (*s)[2] = size;
+                return s;
+            }
+        };
+
+        template <> struct segment_format<char>{
+            static bool is_data(const std::vector<char> &s){ return (s.size() >= 9 && s[0] == '2') || (s.size() >= 13 && s[0] == '5'); }
+            static bool is_kill(const std::vector<char> &s){ return s[0] == '3'; }
+            static long index(const std::vector<char> &s){ float f; memcpy(&f, &s[1], 4); return (long)f; }
+            static int size(const std::vector<char> &s){ float f; memcpy(&f, &s[5], 4); return (int)f; }
+            static int data_offset(const std::vector<char> &s){ return (s[0] == '5') ? 13 : 9; }
+            static int sideband_bytes(const std::vector<char> &s){ float f = 0; if(s[0] == '5') memcpy(&f, &s[9], 4); return (int)f; }
+            static std::vector<char> *make(long index, int size){
+                std::vector<char> *s = new std::vector<char>(9 + size, 0);
+                float f_index = index, f_size = size;
+                (*s)[0] = '2'; memcpy(&(*s)[1], &f_index, 4); memcpy(&(*s)[5], &f_size, 4);
+                return s;
+            }
+        };
+
+    } // namespace router
+} // namespace gr
+
+/*
+ How a queue sink turns a window of items into a segment: type 1 (floats) or type 2 (bytes) when there is nothing
+ to carry in a side-band, type 4 or type 5 otherwise. With overlap, the segment starts with the history items (the
+ end of the stream before the window) and an "overlap" tag on the first of them says how many there are.
+
+ The queue sink keeps the history and the index count; this is only the construction, so the benchmarks can
+ time exactly what the sink does.
+ */
+
+// Build the segment for items items of data starting at absolute offset first, preceded by history; tags are
+// the ones on those items. sideband is scratch space for the packed tags (kept by the caller to reuse its memory).
+std::vector<float> *build_segment(float index, const float *data, int items, uint64_t first, const std::vector<gr::tag_t> &tags,
+	const std::vector<float> &history, std::vector<char> &sideband);
+std::vector<char> *build_segment(float index, const char *data, int items, uint64_t first, const std::vector<gr::tag_t> &tags,
+	const std::vector<char> &history, std::vector<char> &sideband);
+
+#endif
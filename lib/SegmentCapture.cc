@@ -0,0 +1,224 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "SegmentCapture.h"
+#include "RateMeter.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define GROW_BYTES (64 << 20) // The file grows (and is remapped) 64 MB at a time
+
+// Bytes a record of this many floats takes, padding included
+static size_t record_bytes(size_t floats){
+	return (CaptureReader::RECORD_BYTES + floats * sizeof(float) + 7) & ~(size_t)7;
+}
+
+SegmentCapture::SegmentCapture() : fd(-1), map(NULL), mapped(0), used(0), first_ns(0), count(0){
+}
+
+SegmentCapture::~SegmentCapture(){
+	close();
+}
+
+/*!
+ *	Start capturing segments to a file.
+ *
+ *  @param path File to write; replaced if it exists.
+ *  @return True if capturing; False if the file cannot be created or mapped.
+ */
+
+bool SegmentCapture::open(const std::string &path){
+
+	close();
+
+	boost::mutex::scoped_lock guard(lock);
+
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		return false;
+
+	used = CaptureReader::HEADER_BYTES;
+	count = 0;
+	first_ns = 0;
+
+	if(!grow(GROW_BYTES)){
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	memcpy(map, CAPTURE_MAGIC, 8);
+	return true;
+}
+
+/*!
+ *	Map (at least) the first needed bytes of the file, growing it to fit.
+ *
+ *  @param needed Bytes that must be mapped.
+ *  @return True if mapped; False (with the capture closed) if the file cannot grow.
+ */
+
+bool SegmentCapture::grow(size_t needed){
+
+	size_t size = mapped;
+	while(size < needed)
+		size += GROW_BYTES;
+
+	if(map != NULL)
+		munmap(map, mapped);
+	map = NULL;
+
+	if(ftruncate(fd, size) != 0)
+		return false;
+
+	void *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(m == MAP_FAILED)
+		return false;
+
+	map = (char *)m;
+	mapped = size;
+	return true;
+}
+
+void SegmentCapture::record_segment(const float *data, size_t floats){
+
+	uint64_t now = MonotonicClock::monotonic_ns();
+
+	boost::mutex::scoped_lock guard(lock);
+	if(map == NULL)
+		return; // Closed while we waited
+
+	size_t bytes = record_bytes(floats);
+	if(used + bytes + CaptureReader::RECORD_BYTES > mapped && !grow(used + bytes + CaptureReader::RECORD_BYTES)){
+		::close(fd);
+		fd = -1;
+		mapped = 0;
+		return;
+	}
+
+	if(count == 0)
+		first_ns = now;
+
+	uint64_t arrival = now - first_ns;
+	uint32_t length = floats, zero = 0;
+
+	char *record = map + used;
+	memcpy(record, &arrival, 8);
+	memcpy(record + 8, &length, 4);
+	memcpy(record + 12, &zero, 4);
+	memcpy(record + CaptureReader::RECORD_BYTES, data, floats * sizeof(float));
+
+	used += bytes;
+	count++;
+}
+
+void SegmentCapture::close(){
+
+	boost::mutex::scoped_lock guard(lock);
+
+	if(map != NULL){
+		uint64_t segments = count, record_total = used - CaptureReader::HEADER_BYTES;
+		memcpy(map + 8, &segments, 8);
+		memcpy(map + 16, &record_total, 8);
+		munmap(map, mapped);
+		map = NULL;
+	}
+
+	if(fd >= 0){
+		// Keep a zeroed record header after the last record, marking the end
+		if(ftruncate(fd, used + CaptureReader::RECORD_BYTES) != 0){}
+		::close(fd);
+		fd = -1;
+	}
+
+	mapped = 0;
+}
+
+CaptureReader::CaptureReader() : fd(-1), map(NULL), length(0), position(0){
+}
+
+CaptureReader::~CaptureReader(){
+	close();
+}
+
+bool CaptureReader::open(const std::string &path){
+
+	close();
+
+	fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < HEADER_BYTES){
+		close();
+		return false;
+	}
+
+	void *m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(m == MAP_FAILED){
+		close();
+		return false;
+	}
+
+	map = (const char *)m;
+	length = st.st_size;
+	if(memcmp(map, CAPTURE_MAGIC, 8) != 0){
+		close();
+		return false;
+	}
+
+	madvise((void *)map, length, MADV_SEQUENTIAL);
+	position = HEADER_BYTES;
+	return true;
+}
+
+void CaptureReader::close(){
+	if(map != NULL)
+		munmap((void *)map, length);
+	if(fd >= 0)
+		::close(fd);
+
+	map = NULL;
+	fd = -1;
+	length = 0;
+}
+
+bool CaptureReader::next(uint64_t &arrival_ns, const float *&data, uint32_t &floats){
+
+	if(map == NULL || position + RECORD_BYTES > length)
+		return false;
+
+	uint32_t n;
+	memcpy(&n, map + position + 8, 4);
+	if(n == 0 || position + record_bytes(n) > length)
+		return false;
+
+	memcpy(&arrival_ns, map + position, 8);
+	data = (const float *)(map + position + RECORD_BYTES);
+	floats = n;
+
+	position += record_bytes(n);
+	return true;
+}
@@ -0,0 +1,105 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SEGMENTCAPTURE_H
+#define SEGMENTCAPTURE_H
+
+#include <boost/thread.hpp>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+ A recording of a float segment stream, with when each segment arrived, for replaying it offline.
+
+ The file is a header followed by one record per segment:
+
+ 	header: "GRRCAP01", then the segment count and the bytes of records (both uint64; written on close)
+ 	record: arrival (uint64 ns since the first segment), length (uint32 floats), 0 (uint32),
+ 	        the segment as the root dequeued it (header and data, floats), padded to 8 bytes
+
+ A zero length ends the records, so a capture the process never closed still reads back up to the last
+ record it wrote. The writer maps the file and grows it in large steps, so recording a segment is a memcpy
+ (the kernel writes the pages back on its own time); the reader maps it read-only.
+ */
+
+#define CAPTURE_MAGIC "GRRCAP01"
+
+class SegmentCapture{
+public:
+	SegmentCapture();
+	~SegmentCapture();
+
+	// Start capturing to a file (replacing it), stopping any capture already open; False if it cannot be created
+	bool open(const std::string &path);
+
+	// Finish the capture: write the header and trim the file to what was recorded
+	void close();
+
+	bool active(){ return map != NULL; }
+
+	// Record a segment arriving now (a no-op unless a capture is open)
+	inline void record(const std::vector<float> &segment){
+		if(map != NULL)
+			record_segment(segment.data(), segment.size());
+	}
+
+	unsigned long segments(){ return count; }
+
+private:
+	void record_segment(const float *data, size_t floats);
+	bool grow(size_t needed);
+
+	boost::mutex lock; // open() and close() may come from another thread than record()
+	int fd;
+	char * volatile map;
+	size_t mapped; // Bytes of the file mapped
+	size_t used; // Bytes written, header included
+	uint64_t first_ns;
+	unsigned long count;
+};
+
+// Reads a capture back, a segment at a time
+class CaptureReader{
+public:
+	CaptureReader();
+	~CaptureReader();
+
+	// Map a capture; False if it cannot be read or is not a capture
+	bool open(const std::string &path);
+	void close();
+
+	// The next segment and when it arrived (ns after the first); False at the end
+	bool next(uint64_t &arrival_ns, const float *&data, uint32_t &floats);
+
+	// Back to the first segment
+	void rewind(){ position = HEADER_BYTES; }
+
+	static const size_t HEADER_BYTES = 24;
+	static const size_t RECORD_BYTES = 16; // Record header, before the floats
+
+private:
+	int fd;
+	const char *map;
+	size_t length;
+	size_t position;
+};
+
+#endif
@@ -0,0 +1,288 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "SegmentChannel.h"
+#include "MetricsRegistry.h"
+
+#include <map>
+#include <sstream>
+#include <errno.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+// Bounds on the adaptive spin (iterations of a pause loop; one is a few tens of nanoseconds)
+#define SPIN_MIN	64
+#define SPIN_MAX	16384
+
+static inline void cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+// Registry of channels, keyed by the address of the queue they belong to
+static boost::mutex registry_mutex;
+static std::map<const void*, SegmentChannel*> registry;
+
+/*!
+ *	Look up the channel for a queue.
+ *
+ *  @param queue Address of the shared queue.
+ *  @return The channel every user of that queue shares.
+ */
+
+SegmentChannel *SegmentChannel::get(const void *queue){
+
+	boost::mutex::scoped_lock guard(registry_mutex);
+
+	std::map<const void*, SegmentChannel*>::iterator it = registry.find(queue);
+	if(it != registry.end()){
+		SegmentChannel *channel = it->second;
+		if(channel->users++ == 0)
+			channel->reset(); // Everyone on the old queue is gone; this is a new queue at the same address
+		return channel;
+	}
+
+	SegmentChannel *channel = new SegmentChannel(registry.size());
+	channel->users = 1;
+	registry[queue] = channel;
+
+	// Channels live as long as the process, so their metrics can read them directly
+	std::ostringstream labels;
+	labels << "queue=\"" << channel->id() << "\"";
+
+	MetricsRegistry *metrics = MetricsRegistry::get();
+	metrics->callback("router_queue_depth", "Segments in the queue", false, labels.str(), boost::bind(&SegmentChannel::occupancy, channel));
+	metrics->callback("router_queue_capacity", "Segments the queue holds", false, labels.str(), boost::bind(&SegmentChannel::capacity, channel));
+	metrics->callback("router_queue_pushes_total", "Segments pushed onto the queue", true, labels.str(), boost::bind(&SegmentChannel::pushed, channel));
+	metrics->callback("router_queue_pops_total", "Segments popped off the queue", true, labels.str(), boost::bind(&SegmentChannel::popped, channel));
+	metrics->callback("router_queue_spin_wakeups_total", "Waits on the queue that ended while spinning", true, labels.str(), boost::bind(&SegmentChannel::spin_wakeups, channel));
+	metrics->callback("router_queue_parked_waits_total", "Waits on the queue that had to sleep", true, labels.str(), boost::bind(&SegmentChannel::parked_waits, channel));
+	metrics->callback("router_queue_push_failures_total", "Pushes that found the queue full", true, labels.str(), boost::bind(&SegmentChannel::push_failures, channel));
+	metrics->callback("router_queue_push_retries_total", "Pushes that found the queue full and were tried again", true, labels.str(), boost::bind(&SegmentChannel::push_retries, channel));
+	metrics->callback("router_queue_push_timeouts_total", "Blocking pushes that gave up waiting for room", true, labels.str(), boost::bind(&SegmentChannel::push_gave_up, channel));
+	metrics->callback("router_queue_full_seconds_total", "Time the queue has spent full", true, labels.str(), boost::bind(&SegmentChannel::time_full, channel));
+	metrics->callback("router_queue_empty_seconds_total", "Time the queue has spent empty", true, labels.str(), boost::bind(&SegmentChannel::time_empty, channel));
+	channel->depths = metrics->histogram("router_queue_occupancy", "Segments in the queue after each push", labels.str());
+
+	return channel;
+}
+
+/*!
+ *	Give back a channel from get(), once its holder will not touch it again.
+ *
+ *  @param channel The channel, or NULL.
+ */
+
+void SegmentChannel::release(SegmentChannel *channel){
+
+	if(channel == NULL)
+		return;
+
+	boost::mutex::scoped_lock guard(registry_mutex);
+	if(channel->users > 0)
+		channel->users--;
+}
+
+void SegmentChannel::reset(){
+	pushes = 0;
+	pops = 0;
+	full_depth = 0;
+	slots = 0; // The new queue's blocks say its size after get()
+	failures = 0;
+	push_timeouts = 0;
+	full_since = 0;
+	full_ns = 0;
+	empty_since = now_ns();
+	empty_ns = 0;
+	spin_wakes = 0;
+	parks = 0;
+	spin_limit = spin_floor * 4; // The new queue's traffic has to teach the spin again
+	depths->reset();
+	__sync_synchronize();
+}
+
+SegmentChannel::SegmentChannel(int id) : sequence(0), waiters(0), number(id), users(0), spin_wakes(0), parks(0), pushes(0), pops(0), full_depth(0), slots(0),
+	depths(NULL), failures(0), push_timeouts(0), full_since(0), full_ns(0), empty_ns(0){
+	spin_floor = (boost::thread::hardware_concurrency() > 1) ? SPIN_MIN : 0;
+	spin_limit = spin_floor * 4;
+	empty_since = now_ns(); // Queues start out empty
+}
+
+int64_t SegmentChannel::now_ns(){
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void SegmentChannel::end_period(volatile int64_t &since, volatile int64_t &total){
+	int64_t start = since;
+	if(start != 0 && __sync_bool_compare_and_swap(&since, start, 0)) // Only one thread closes a period
+		__sync_fetch_and_add(&total, now_ns() - start);
+}
+
+double SegmentChannel::period_seconds(volatile int64_t &since, volatile int64_t &total){
+	int64_t start = since;
+	int64_t elapsed = total + ((start != 0) ? now_ns() - start : 0); // Count the open period so far
+	return elapsed / 1e9;
+}
+
+/*!
+ *	Count pushed segments, note the depth they left the queue at, and wake the consumer.
+ *
+ *  @param count Segments pushed.
+ */
+
+void SegmentChannel::notify_push(long count){
+
+	long depth = __sync_add_and_fetch(&pushes, count) - pops;
+
+	if(empty_since != 0)
+		end_period(empty_since, empty_ns);
+
+	depths->observe(depth > 0 ? depth : 0);
+	notify();
+}
+
+/*!
+ *	Count a popped segment and wake a pusher waiting for room.
+ */
+
+void SegmentChannel::notify_pop(){
+
+	long depth = pushes - __sync_add_and_fetch(&pops, 1);
+
+	if(full_since != 0)
+		end_period(full_since, full_ns);
+
+	if(depth <= 0 && empty_since == 0)
+		__sync_bool_compare_and_swap(&empty_since, 0, now_ns());
+
+	notify();
+}
+
+/*!
+ *	Record a push that found the queue full; the first one starts a full period.
+ */
+
+void SegmentChannel::push_failed(){
+
+	__sync_fetch_and_add(&failures, 1);
+	full_depth = occupancy();
+
+	if(full_since == 0)
+		__sync_bool_compare_and_swap(&full_since, 0, now_ns());
+}
+
+double SegmentChannel::time_full(){
+	return period_seconds(full_since, full_ns);
+}
+
+double SegmentChannel::time_empty(){
+	return period_seconds(empty_since, empty_ns);
+}
+
+/*!
+ *	Take a ticket. Anything notified after this call ends a wait() on it, so the queue has to be checked
+ *  between prepare() and wait().
+ *
+ *  @return The ticket.
+ */
+
+unsigned SegmentChannel::prepare(){
+	return (unsigned)__sync_fetch_and_add(&sequence, 0);
+}
+
+/*!
+ *	Wait for a notify() after the ticket was taken.
+ *
+ *  @param ticket From prepare().
+ *  @param timeout_us The longest to wait, in microseconds.
+ *  @return True if notified; False on timeout.
+ */
+
+bool SegmentChannel::wait(unsigned ticket, long timeout_us){
+
+	__sync_fetch_and_add(&waiters, 1);
+
+	// The other side is usually close behind: spin before paying for a sleep and a wakeup
+	int limit = spin_limit;
+	for(int i = 0; i < limit; i++){
+		if((unsigned)sequence != ticket){
+			__sync_fetch_and_sub(&waiters, 1);
+			__sync_fetch_and_add(&spin_wakes, 1);
+
+			if(limit < SPIN_MAX)
+				spin_limit = limit * 2;
+			return true;
+		}
+		cpu_relax();
+	}
+
+	if(limit > spin_floor)
+		spin_limit = limit / 2;
+
+	__sync_fetch_and_add(&parks, 1);
+
+#ifdef __linux__
+	timespec timeout;
+	timeout.tv_sec = timeout_us / 1000000;
+	timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+
+	// Returns at once (EAGAIN) if the sequence moved on since the ticket was taken
+	syscall(SYS_futex, &sequence, FUTEX_WAIT_PRIVATE, (int)ticket, &timeout, NULL, 0);
+#else
+	{
+		boost::mutex::scoped_lock guard(lock);
+		if((unsigned)sequence == ticket)
+			cond.timed_wait(guard, boost::posix_time::microseconds(timeout_us));
+	}
+#endif
+
+	__sync_fetch_and_sub(&waiters, 1);
+	return (unsigned)sequence != ticket;
+}
+
+/*!
+ *	Tell waiters the queue changed (pushed, or popped and so has room).
+ */
+
+void SegmentChannel::notify(){
+
+	__sync_fetch_and_add(&sequence, 1); // Full barrier: the push or pop is visible before the sequence moves
+
+	if(waiters == 0)
+		return;
+
+#ifdef __linux__
+	syscall(SYS_futex, &sequence, FUTEX_WAKE_PRIVATE, 0x7fffffff, NULL, NULL, 0);
+#else
+	boost::mutex::scoped_lock guard(lock);
+	cond.notify_all();
+#endif
+}
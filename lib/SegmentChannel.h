@@ -0,0 +1,186 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SEGMENTCHANNEL_H
+#define SEGMENTCHANNEL_H
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <stdint.h>
+
+class MetricHistogram;
+
+/*
+ Wakeups for the threads on either end of a shared segment queue.
+
+ The queues themselves stay plain boost::lockfree queues (they are handed to the blocks by the flow graph);
+ a SegmentChannel sits next to each one and lets a thread that finds the queue empty (or full) sleep until
+ the other side does something, instead of polling with a fixed sleep. Every block that touches the same
+ queue gets the same channel from get().
+
+ A waiter takes a ticket with prepare(), checks the queue once more, and then wait()s on the ticket; any
+ notify() after the ticket was taken ends the wait. A pusher notifies after each push and a popper after each
+ pop (room for a blocked pusher); notify() costs one atomic increment unless someone is actually waiting.
+ Pushers and poppers that use notify_push()/notify_pop() also keep a count of the segments in the queue,
+ which the queue itself cannot report, and with it the queue's statistics: the depth each push leaves the
+ queue at (a histogram), how often pushes find it full, and how long it spends full and empty. A queue is
+ full from the first push that finds it so until the next pop, and empty from the pop that drains it until
+ the next push; both are recorded only on those transitions, so the hot path pays a load and a branch.
+ wait() first spins for a while, since the other side is often only a few microseconds away, then parks on a
+ futex (a condition variable off Linux). The spin adapts: it grows while spinning pays off and shrinks while
+ the waiter ends up parking anyway.
+
+ Blocks hand their channel back with release() when they are destroyed. The channel itself stays (its
+ metrics point at it), but once nobody holds it the next get() for that address starts its counts over:
+ the queue there now is a new one (a flow graph built again), not the one the counts were kept for.
+ */
+
+class SegmentChannel{
+public:
+
+	// The channel for a queue (any object address), created on first use; channels live as long as the process
+	static SegmentChannel *get(const void *queue);
+
+	// Give back a channel from get(); the next get() after the last release() resets its counts
+	static void release(SegmentChannel *channel);
+
+	// Take a ticket before checking the queue
+	unsigned prepare();
+
+	// Wait until something is notified after the ticket was taken, or timeout_us passes; True if notified
+	bool wait(unsigned ticket, long timeout_us);
+
+	// Wake every waiter
+	void notify();
+
+	// Wake every waiter after a push or a pop, keeping count of the segments in the queue
+	void notify_push(long count = 1);
+	void notify_pop();
+
+	// Push onto this channel's queue without waiting; True once pushed (and the consumer woken), False if it is full
+	template <typename Queue, typename T>
+	bool try_push(Queue &queue, T item){
+		if(queue.push(item)){
+			notify_push();
+			return true;
+		}
+
+		push_failed();
+		return false;
+	}
+
+	// Push onto this channel's queue, waiting for room while it is full, and wake the consumer
+	template <typename Queue, typename T>
+	void push(Queue &queue, T item){
+		while(!push(queue, item, 1000000));
+	}
+
+	// Push onto this channel's queue, waiting up to timeout_us for room; True once pushed (and the consumer woken)
+	template <typename Queue, typename T>
+	bool push(Queue &queue, T item, long timeout_us){
+		boost::posix_time::ptime deadline;
+		while(true){
+			unsigned ticket = prepare();
+			if(try_push(queue, item))
+				return true;
+
+			boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+			if(deadline.is_not_a_date_time())
+				deadline = now + boost::posix_time::microseconds(timeout_us);
+			else if(now >= deadline){
+				__sync_fetch_and_add(&push_timeouts, 1);
+				return false;
+			}
+
+			wait(ticket, (deadline - now).total_microseconds());
+		}
+	}
+
+	// Note a push that found the queue full (for pushers that do not go through try_push())
+	void push_failed();
+
+	// Segments in the queue, as counted by notify_push() and notify_pop()
+	long occupancy(){ return pushes - pops; }
+
+	// Segments the queue holds: as set_capacity() was told, or else the occupancy it was last found full at; 0 until
+	// one of those is known
+	long capacity(){ return (slots > 0) ? slots : full_depth; }
+
+	// The size the queue was made with, which a lockfree queue cannot report (whoever builds a block on it can)
+	void set_capacity(long capacity){ slots = capacity; }
+
+	// Statistics
+	unsigned long spin_wakeups(){ return spin_wakes; } // Waits ended while spinning
+	unsigned long parked_waits(){ return parks; } // Waits that had to sleep
+	long pushed(){ return pushes; }
+	long popped(){ return pops; }
+	unsigned long push_failures(){ return failures; } // Pushes that found the queue full
+	unsigned long push_retries(){ return failures - push_timeouts; } // Failed pushes that were tried again
+	unsigned long push_gave_up(){ return push_timeouts; } // Blocking pushes that timed out
+	double time_full(); // Seconds the queue has spent full
+	double time_empty(); // Seconds the queue has spent empty
+
+	// Number of the channel, in order of creation; the queue label of its metrics
+	int id(){ return number; }
+
+private:
+
+	SegmentChannel(int id);
+
+	// Forget everything the previous queue left: counts, periods, statistics and the tuned spin (under the
+	// registry lock, with no users)
+	void reset();
+
+	static int64_t now_ns();
+
+	// Close an open full or empty period, adding it to the total
+	static void end_period(volatile int64_t &since, volatile int64_t &total);
+	static double period_seconds(volatile int64_t &since, volatile int64_t &total);
+
+	volatile int sequence; // Bumped by notify(); the futex word
+	volatile int waiters; // Threads inside wait()
+	volatile int spin_limit; // Spin iterations before parking
+	int spin_floor; // Least spin_limit can shrink to; 0 on a single CPU, where spinning cannot help
+	int number;
+	int users; // Holders from get() not yet released; guarded by the registry lock
+
+#ifndef __linux__
+	boost::mutex lock;
+	boost::condition_variable cond;
+#endif
+
+	unsigned long spin_wakes;
+	unsigned long parks;
+
+	volatile long pushes;
+	volatile long pops;
+	volatile long full_depth;
+	volatile long slots; // Capacity the queue was made with; 0 if nobody said
+
+	MetricHistogram *depths; // Occupancy left by each push
+	volatile unsigned long failures;
+	volatile unsigned long push_timeouts;
+	volatile int64_t full_since; // Start of the current full period (ns); 0 while not full
+	volatile int64_t full_ns;
+	volatile int64_t empty_since; // Start of the current empty period (ns); 0 while not empty
+	volatile int64_t empty_ns;
+};
+
+#endif
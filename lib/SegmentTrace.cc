@@ -0,0 +1,173 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "SegmentTrace.h"
+
+#include <boost/thread.hpp>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_EVENTS	65536 // Events each thread keeps (a power of two)
+
+static const char *stage_names[TRACE_STAGES] = {
+	"sink push", "root dequeue", "root send", "child receive", "child push",
+	"child pop", "child send", "root receive", "source emit"
+};
+
+struct trace_event{
+	int64_t time_ns;
+	long index;
+	int stage;
+};
+
+// One thread's events; only that thread writes it
+struct trace_ring{
+	trace_ring(int id) : thread(id), written(0), events(RING_EVENTS){}
+
+	int thread;
+	volatile unsigned long written; // Events recorded so far; the next goes in slot written % RING_EVENTS
+	std::vector<trace_event> events;
+};
+
+// Rings are never freed, so the events of threads that have finished can still be exported
+static void keep_ring(trace_ring *){}
+
+static boost::thread_specific_ptr<trace_ring> thread_ring(keep_ring);
+static boost::mutex rings_mutex;
+static std::vector<trace_ring*> rings;
+
+// Sampling period from ROUTER_TRACE_SAMPLE, if set
+static int initial_sampling(){
+	const char *every = getenv("ROUTER_TRACE_SAMPLE");
+	return every ? std::max(0, atoi(every)) : 0;
+}
+
+volatile int SegmentTrace::sample_every = initial_sampling();
+
+void SegmentTrace::set_sampling(int every){
+	sample_every = std::max(0, every);
+}
+
+void SegmentTrace::record_sampled(trace_stage stage, long index){
+
+	trace_ring *ring = thread_ring.get();
+	if(ring == NULL){
+		boost::mutex::scoped_lock guard(rings_mutex);
+		ring = new trace_ring(rings.size());
+		rings.push_back(ring);
+		thread_ring.reset(ring);
+	}
+
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	trace_event &event = ring->events[ring->written & (RING_EVENTS - 1)];
+	event.time_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	event.index = index;
+	event.stage = stage;
+
+	__sync_synchronize(); // The event is complete before it is counted
+	ring->written++;
+}
+
+struct traced{
+	trace_event event;
+	int thread;
+};
+
+static bool by_segment(const traced &a, const traced &b){
+	if(a.event.index != b.event.index)
+		return a.event.index < b.event.index;
+	return a.event.time_ns < b.event.time_ns;
+}
+
+/*!
+ *	Export every ring in the Chrome trace event format.
+ *
+ *  @return The JSON document.
+ */
+
+std::string SegmentTrace::chrome_json(){
+
+	// Copy out what each ring holds
+	std::vector<traced> all;
+	{
+		boost::mutex::scoped_lock guard(rings_mutex);
+		for(size_t r = 0; r < rings.size(); r++){
+			unsigned long written = rings[r]->written;
+			unsigned long first = (written > RING_EVENTS) ? written - RING_EVENTS : 0;
+			for(unsigned long i = first; i < written; i++){
+				traced t;
+				t.event = rings[r]->events[i & (RING_EVENTS - 1)];
+				t.thread = rings[r]->thread;
+				all.push_back(t);
+			}
+		}
+	}
+
+	std::sort(all.begin(), all.end(), by_segment);
+
+	int pid = getpid();
+	std::ostringstream out;
+	out.setf(std::ios::fixed);
+	out.precision(3);
+	out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+	bool first = true;
+	for(size_t i = 0; i < all.size(); i++){
+		const trace_event &e = all[i].event;
+		double ts = e.time_ns / 1000.0; // Microseconds
+
+		// The hop itself, on the thread that saw it
+		out << (first ? "" : ",") << "\n{\"name\":\"" << stage_names[e.stage] << "\",\"cat\":\"segment\",\"ph\":\"i\",\"s\":\"t\""
+		    << ",\"ts\":" << ts << ",\"pid\":" << pid << ",\"tid\":" << all[i].thread
+		    << ",\"args\":{\"index\":" << e.index << "}}";
+		first = false;
+
+		// The time from this hop to the segment's next one seen here
+		if(i + 1 < all.size() && all[i + 1].event.index == e.index){
+			const trace_event &next = all[i + 1].event;
+			std::string name = std::string(stage_names[e.stage]) + " -> " + stage_names[next.stage];
+
+			out << ",\n{\"name\":\"" << name << "\",\"cat\":\"segment\",\"ph\":\"b\",\"id\":" << e.index
+			    << ",\"ts\":" << ts << ",\"pid\":" << pid << ",\"tid\":0}";
+			out << ",\n{\"name\":\"" << name << "\",\"cat\":\"segment\",\"ph\":\"e\",\"id\":" << e.index
+			    << ",\"ts\":" << next.time_ns / 1000.0 << ",\"pid\":" << pid << ",\"tid\":0}";
+		}
+	}
+
+	out << "\n]}\n";
+	return out.str();
+}
+
+bool SegmentTrace::write(const std::string &path){
+	std::ofstream file(path.c_str());
+	if(!file)
+		return false;
+
+	file << chrome_json();
+	return !file.fail();
+}
@@ -0,0 +1,79 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SEGMENTTRACE_H
+#define SEGMENTTRACE_H
+
+#include <string>
+#include <stdint.h>
+
+/*
+ Timestamps for a segment at each hop of its trip through the cluster.
+
+ Each thread that records gets its own ring of events (no locking once the ring exists); when a ring wraps, the
+ oldest events go. Only sampled segments are recorded: those whose index is a multiple of the sampling period, so
+ every node picks the same segments without talking to each other. With sampling off (the default) record() is
+ a load and a branch.
+
+ chrome_json() exports the rings in the Chrome trace event format (chrome://tracing, ui.perfetto.dev): an instant
+ event per hop on the thread that recorded it, and an async slice per segment between consecutive hops.
+ Timestamps are wall-clock, so traces from the root and the children can be loaded together.
+ */
+
+enum trace_stage{
+	TRACE_SINK_PUSH, // queue sink pushed the segment
+	TRACE_ROOT_DEQUEUE, // root popped it off its input queue
+	TRACE_ROOT_SEND, // root handed it to the connector for a child
+	TRACE_CHILD_RECEIVE, // child read its header off the wire
+	TRACE_CHILD_PUSH, // child pushed it onto its input queue
+	TRACE_CHILD_POP, // child popped the result off its output queue
+	TRACE_CHILD_SEND, // child wrote the result to the root
+	TRACE_ROOT_RECEIVE, // root read the result's header off the wire
+	TRACE_SOURCE_EMIT, // queue source started streaming it
+	TRACE_STAGES
+};
+
+class SegmentTrace{
+public:
+
+	// Record a hop for a segment, if the segment is sampled
+	static inline void record(trace_stage stage, long index){
+		int every = sample_every;
+		if(every > 0 && index % every == 0)
+			record_sampled(stage, index);
+	}
+
+	// Trace every Nth index; 0 turns tracing off
+	static void set_sampling(int every);
+
+	// Everything recorded so far, in the Chrome trace event format
+	static std::string chrome_json();
+
+	// Write chrome_json() to a file; False if it cannot be written
+	static bool write(const std::string &path);
+
+private:
+
+	static volatile int sample_every;
+
+	static void record_sampled(trace_stage stage, long index);
+};
+
+#endif
@@ -0,0 +1,187 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "TagSideband.h"
+
+#include <string.h>
+#include <string>
+#include <map>
+#include <algorithm>
+
+// Append a fixed-size field
+template <typename F>
+static void put(std::vector<char> &out, F value){
+	const char *bytes = (const char *)&value;
+	out.insert(out.end(), bytes, bytes + sizeof(F));
+}
+
+// Append a length-prefixed string
+template <typename L>
+static void put_string(std::vector<char> &out, const std::string &s){
+	put<L>(out, (L)s.size());
+	out.insert(out.end(), s.begin(), s.end());
+}
+
+// Read a fixed-size field; False if it runs past the end
+template <typename F>
+static bool get(const char *buf, int length, int &at, F &value){
+	if(at + (int)sizeof(F) > length)
+		return false;
+	memcpy(&value, buf + at, sizeof(F));
+	at += sizeof(F);
+	return true;
+}
+
+// Read a length-prefixed string; False if it runs past the end (compared unsigned, so a huge size cannot wrap)
+template <typename L>
+static bool get_string(const char *buf, int length, int &at, std::string &s){
+	L size;
+	if(!get<L>(buf, length, at, size) || (uint32_t)size > (uint32_t)(length - at))
+		return false;
+	s.assign(buf + at, size);
+	at += size;
+	return true;
+}
+
+// Read a length-prefixed serialized pmt; False if it runs past the end or does not deserialize
+static bool get_pmt(const char *buf, int length, int &at, pmt::pmt_t &value){
+	std::string bytes;
+	if(!get_string<uint32_t>(buf, length, at, bytes))
+		return false;
+
+	// pmt::deserialize_str() throws on bytes that are not a pmt; a damaged side-band must not take the block down
+	try{
+		value = pmt::deserialize_str(bytes);
+	}
+	catch(...){
+		return false;
+	}
+	return true;
+}
+
+// Orders tags by offset
+static bool earlier(const gr::tag_t &a, const gr::tag_t &b){
+	return a.offset < b.offset;
+}
+
+int TagSideband::pack(const std::vector<gr::tag_t> &tags, uint64_t first, std::vector<char> &out){
+
+	if(tags.empty())
+		return 0;
+
+	pmt::pmt_t index_key = pmt::string_to_symbol("i");
+
+	size_t start = out.size();
+	put<uint32_t>(out, 0); // Count, filled in below
+
+	std::map<std::string, uint16_t> keys;
+	uint32_t count = 0;
+
+	for(size_t i = 0; i < tags.size(); i++){
+		const gr::tag_t &tag = tags[i];
+
+		// The index travels in the segment header
+		if(pmt::eqv(tag.key, index_key))
+			continue;
+
+		std::string name = pmt::symbol_to_string(tag.key);
+		bool has_srcid = tag.srcid && !pmt::eqv(tag.srcid, pmt::PMT_F);
+
+		std::map<std::string, uint16_t>::iterator known = keys.find(name);
+		uint16_t key = (known == keys.end()) ? (uint16_t)keys.size() : known->second;
+
+		put<uint32_t>(out, (uint32_t)(tag.offset - first));
+		put<uint16_t>(out, key);
+		put<uint16_t>(out, has_srcid ? SIDEBAND_SRCID : 0);
+
+		if(known == keys.end()){
+			keys[name] = key;
+			put_string<uint16_t>(out, name);
+		}
+
+		put_string<uint32_t>(out, pmt::serialize_str(tag.value));
+
+		if(has_srcid)
+			put_string<uint32_t>(out, pmt::serialize_str(tag.srcid));
+
+		count++;
+	}
+
+	// Only the index tag: leave no side-band at all
+	if(count == 0){
+		out.resize(start);
+		return 0;
+	}
+
+	memcpy(&out[start], &count, sizeof(count));
+	return count;
+}
+
+bool TagSideband::unpack(const char *buf, int length, std::vector<gr::tag_t> &tags){
+
+	size_t start = tags.size();
+	bool complete = unpack_tags(buf, length, tags);
+
+	std::stable_sort(tags.begin() + start, tags.end(), earlier);
+	return complete;
+}
+
+bool TagSideband::unpack_tags(const char *buf, int length, std::vector<gr::tag_t> &tags){
+
+	int at = 0;
+	uint32_t count;
+	if(!get<uint32_t>(buf, length, at, count))
+		return false;
+
+	std::vector<pmt::pmt_t> keys;
+
+	for(uint32_t i = 0; i < count; i++){
+		uint32_t offset;
+		uint16_t key, flags;
+
+		if(!get<uint32_t>(buf, length, at, offset) || !get<uint16_t>(buf, length, at, key) || !get<uint16_t>(buf, length, at, flags))
+			return false;
+
+		if(key == keys.size()){
+			std::string name;
+			if(!get_string<uint16_t>(buf, length, at, name))
+				return false;
+			keys.push_back(pmt::string_to_symbol(name));
+		}
+		else if(key > keys.size()){
+			return false;
+		}
+
+		gr::tag_t tag;
+		tag.offset = offset;
+		tag.key = keys[key];
+		tag.srcid = pmt::PMT_F;
+
+		if(!get_pmt(buf, length, at, tag.value))
+			return false;
+
+		if((flags & SIDEBAND_SRCID) && !get_pmt(buf, length, at, tag.srcid))
+			return false;
+
+		tags.push_back(tag);
+	}
+
+	return true;
+}
@@ -0,0 +1,78 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef TAGSIDEBAND_H
+#define TAGSIDEBAND_H
+
+#include <gnuradio/tags.h>
+#include <vector>
+
+/*
+ Stream tags carried inside a segment.
+
+ A queue sink packs the tags on a segment's items into a side-band behind the data, and the queue source that
+ streams the segment puts them back on the same items. Offsets are stored relative to the segment's first item.
+ The index tag ("i") is never packed; it travels in the segment's index field.
+
+ Side-band layout (host byte order, like the rest of the segment):
+ |
+ uint32 < count > -- number of tags
+ per tag:
+   uint32 < offset > -- item offset from the start of the segment
+   uint16 < key > -- index into the keys defined so far in this side-band; the next unused index defines a new key
+   uint16 < flags > -- SIDEBAND_SRCID if a srcid follows the value
+   [ uint16 < length >, bytes < key name > ] -- only when the key is new
+   uint32 < length >, bytes < value > -- pmt::serialize_str() of the value
+   [ uint32 < length >, bytes < srcid > ] -- only with SIDEBAND_SRCID
+ |
+ Repeated keys (rx_time on every burst, say) cost two bytes after the first time.
+ */
+
+#define SIDEBAND_SRCID	0x1
+
+class TagSideband{
+public:
+
+	/*!
+	 *	Pack tags into a side-band.
+	 *
+	 *  @param tags Tags on the segment's items (absolute offsets).
+	 *  @param first Absolute offset of the segment's first item.
+	 *  @param out Bytes are appended here; nothing is appended if there is no tag to carry.
+	 *  @return The number of tags packed.
+	 */
+	static int pack(const std::vector<gr::tag_t> &tags, uint64_t first, std::vector<char> &out);
+
+	/*!
+	 *	Unpack a side-band.
+	 *
+	 *  @param buf The side-band.
+	 *  @param length Bytes in buf.
+	 *  @param tags Unpacked tags are appended here, in offset order, with offsets relative to the segment's first item.
+	 *  @return False if the side-band is truncated or malformed (tags unpacked before the fault are kept).
+	 */
+	static bool unpack(const char *buf, int length, std::vector<gr::tag_t> &tags);
+
+private:
+
+	static bool unpack_tags(const char *buf, int length, std::vector<gr::tag_t> &tags);
+};
+
+#endif
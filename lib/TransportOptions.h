@@ -0,0 +1,170 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef TRANSPORTOPTIONS_H
+#define TRANSPORTOPTIONS_H
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ Socket tuning applied to every connection the router opens.
+
+ Why the defaults are what they are (reasoning, not measurements; nothing in the tree records a sweep of them):
+ - TCP_NODELAY is on. A segment leaves a node as a header write followed by a payload write, and with Nagle the
+   second write waits for the ACK of the first, which the peer may delay by tens of milliseconds.
+ - TCP_QUICKACK is off: with nodelay no write is left waiting on an ACK, so ACKing sooner buys nothing.
+ - TCP_CORK is off: it only pays when many small segments go out back to back (begin_batch()/end_batch() cork
+   such a batch when it is on), and it holds back the last partial packet of everything else until uncorked.
+ - Socket buffers are left to kernel autotuning, which grows them as a connection needs.
+ - SO_BUSY_POLL needs NIC support and burns a core while waiting; it is off.
+
+ Every one of them can be set from the environment (from_environment()), and router_loopback passes its
+ environment on to every run, so a sweep is e.g. ROUTER_NODELAY=0 router_loopback --json=nagle.json.
+ */
+
+class TransportOptions{
+public:
+
+	TransportOptions() :
+		nodelay(true),
+		send_buffer(0),
+		receive_buffer(0),
+		busy_poll(0),
+		quickack(false),
+		cork(false),
+		io_uring(false),
+		ring_entries(256),
+		ring_buffers(64),
+		ring_buffer_size(65536),
+		udp(false),
+		udp_datagram_size(1472),
+		udp_window(256),
+		udp_batch(32),
+		udp_pacing(0),
+		udp_nack_interval(500),
+		udp_retransmit_timeout(20000),
+		udp_loss(0.0),
+		udp_loss_seed(1),
+		zerocopy_send(false),
+		zerocopy_threshold(32768),
+		outbound_queue_depth(16),
+		accept_timeout(0)
+	{}
+
+	bool nodelay; // Disable Nagle's algorithm (TCP_NODELAY)
+	int send_buffer; // SO_SNDBUF in bytes; 0 leaves the kernel default
+	int receive_buffer; // SO_RCVBUF in bytes; 0 leaves the kernel default
+	int busy_poll; // SO_BUSY_POLL in microseconds; 0 disables busy polling
+	bool quickack; // Re-arm TCP_QUICKACK after every read so ACKs are never delayed
+	bool cork; // Hold back partial frames (TCP_CORK) while a batch of segments is being written
+
+	// io_uring backend (only honoured when the library was built with liburing)
+	bool io_uring; // Move sends and receives onto an io_uring instead of blocking write()/read()
+	int ring_entries; // Submission queue depth
+	int ring_buffers; // Receive buffers shared by all connections through a provided-buffer ring (power of two)
+	int ring_buffer_size; // Bytes per receive buffer
+
+	// UDP backend (connections are still made over TCP; data moves to datagrams once everyone is connected)
+	bool udp; // Carry segments in UDP datagrams with NACK-based retransmission instead of TCP
+	int udp_datagram_size; // Bytes per datagram including the 16 byte header; 1472 fills a 1500 byte Ethernet MTU
+	int udp_window; // Unacknowledged messages a sender may have outstanding per connection
+	int udp_batch; // Datagrams per sendmmsg()/recvmmsg() call
+	long udp_pacing; // Sending rate cap in bytes per second over all connections; 0 sends as fast as the window allows
+	int udp_nack_interval; // Microseconds between NACK/ACK rounds
+	int udp_retransmit_timeout; // Microseconds without an ACK before the sender probes
+	double udp_loss; // Fraction of outgoing datagrams to drop on purpose (loss testing)
+	unsigned int udp_loss_seed; // Seed for the simulated loss
+
+	// Kernel zero-copy sends (plain socket backend only; falls back to write() where unsupported). There is no
+	// zero-copy receive: every reader takes the data into its own buffer, so mapping pages would only add a copy.
+	bool zerocopy_send; // Send queued segments with MSG_ZEROCOPY and release them on the kernel's completion
+	int zerocopy_threshold; // Smallest write in bytes sent with MSG_ZEROCOPY; below it pinning costs more than copying
+
+	// Segments each child's outbound queue holds before send_async() blocks
+	int outbound_queue_depth;
+
+	// Seconds the root waits for every child to connect before giving up; 0 waits forever
+	int accept_timeout;
+
+	// Pick the backend by name: tcp (plain sockets), udp (UdpConnector) or uring (UringConnector, which falls
+	// back to plain sockets in a build without liburing). False, leaving tcp, for any other name.
+	bool set_transport(const char *name){
+		udp = (strcmp(name, "udp") == 0);
+		io_uring = (strcmp(name, "uring") == 0);
+		return udp || io_uring || strcmp(name, "tcp") == 0;
+	}
+
+	// The defaults, with the backend picked by ROUTER_TRANSPORT (tcp, udp or uring; tcp if unset) and zero-copy
+	// sends turned on by ROUTER_ZEROCOPY=send, and the bring-up bounded by ROUTER_ACCEPT_TIMEOUT
+	// (seconds). ROUTER_UDP_LOSS drops that fraction of outgoing datagrams (0 to 1) to exercise the UDP
+	// backend's retransmission, with ROUTER_UDP_LOSS_SEED seeding it. The socket options come from
+	// ROUTER_NODELAY, ROUTER_QUICKACK and ROUTER_CORK (0 or 1), ROUTER_SNDBUF and ROUTER_RCVBUF (bytes) and
+	// ROUTER_BUSY_POLL (microseconds). The root and child blocks are configured this way.
+	static TransportOptions from_environment(){
+		TransportOptions options;
+
+		env_flag("ROUTER_NODELAY", options.nodelay);
+		env_flag("ROUTER_QUICKACK", options.quickack);
+		env_flag("ROUTER_CORK", options.cork);
+		env_int("ROUTER_SNDBUF", options.send_buffer);
+		env_int("ROUTER_RCVBUF", options.receive_buffer);
+		env_int("ROUTER_BUSY_POLL", options.busy_poll);
+
+		const char *transport = getenv("ROUTER_TRANSPORT");
+		if(transport != NULL)
+			options.set_transport(transport);
+
+		const char *zerocopy = getenv("ROUTER_ZEROCOPY");
+		if(zerocopy != NULL)
+			options.zerocopy_send = (strcmp(zerocopy, "send") == 0);
+
+		const char *accept_timeout = getenv("ROUTER_ACCEPT_TIMEOUT");
+		if(accept_timeout != NULL)
+			options.accept_timeout = atoi(accept_timeout);
+
+		const char *loss = getenv("ROUTER_UDP_LOSS");
+		if(loss != NULL)
+			options.udp_loss = atof(loss);
+
+		const char *loss_seed = getenv("ROUTER_UDP_LOSS_SEED");
+		if(loss_seed != NULL)
+			options.udp_loss_seed = (unsigned int)strtoul(loss_seed, NULL, 10);
+
+		return options;
+	}
+
+private:
+
+	// Overwrite value with the variable, if it is set
+	static void env_flag(const char *name, bool &value){
+		const char *setting = getenv(name);
+		if(setting != NULL)
+			value = (atoi(setting) != 0);
+	}
+
+	static void env_int(const char *name, int &value){
+		const char *setting = getenv(name);
+		if(setting != NULL)
+			value = atoi(setting);
+	}
+};
+
+#endif
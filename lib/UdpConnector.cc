@@ -0,0 +1,1063 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sendmmsg(), recvmmsg(), ppoll()
+#endif
+
+#include "UdpConnector.h"
+
+#include <iostream>
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+// Socket buffer size for the UDP sockets when TransportOptions leaves it at 0; UDP drops what does not fit
+#define UDP_SOCKET_BUFFER	(4 * 1024 * 1024)
+
+// How long stop() waits for outstanding messages to be acknowledged
+#define UDP_LINGER_MS	1000
+
+// Largest retransmit timeout backoff (rto << UDP_MAX_BACKOFF)
+#define UDP_MAX_BACKOFF	6
+
+// Sequence comparisons that survive wrap-around
+static inline int32_t seq_diff(uint32_t a, uint32_t b){ return (int32_t)(a - b); }
+
+// Read or write exactly size bytes on a blocking socket; used for the port exchange on the TCP connection
+static bool read_all(int fd, void *buf, size_t size){
+	char *p = (char *)buf;
+	while(size > 0){
+		ssize_t r = read(fd, p, size);
+		if(r < 0 && errno == EINTR)
+			continue;
+		if(r <= 0)
+			return false;
+		p += r;
+		size -= r;
+	}
+	return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t size){
+	const char *p = (const char *)buf;
+	while(size > 0){
+		ssize_t r = write(fd, p, size);
+		if(r < 0 && errno == EINTR)
+			continue;
+		if(r <= 0)
+			return false;
+		p += r;
+		size -= r;
+	}
+	return true;
+}
+
+/*!
+ *	The constructor for the UDP connector. Sockets are created exactly as for the Ethernet Connector;
+ *  the datagram sockets are set up by start() once every connection is established.
+ *
+ *  @param count The number of children that the router will connect to.
+ *  @param port The port on which the router will communicate.
+ *  @param options Socket tuning, datagram size, window, pacing and simulated loss.
+ */
+
+UdpConnector::UdpConnector(int count, int port, const TransportOptions &options)
+: EthernetConnector(count, port, options), started(false), stopping(false), numConns(0), streams(NULL), tokens(0), loss_seed(options.udp_loss_seed), dropped(0), retransmitted(0)
+{
+	payload_size = options.udp_datagram_size - (int)sizeof(UdpHeader);
+}
+
+/*!
+ *	The destructor; stops the receiver before the sockets are closed.
+ */
+
+UdpConnector::~UdpConnector(){
+	shutdown_datagrams();
+	delete[] streams;
+}
+
+/*!
+ *	Trade UDP ports over every TCP connection and start the receiver.
+ *
+ *  The parent side speaks first: it sends its UDP port to each child that advertised CAP_DATAGRAM (0 to
+ *  every other child, which stays on TCP), then reads the child's port back.
+ *
+ *  @return True if the datagram path is running; False if it could not be set up.
+ */
+
+bool UdpConnector::start(){
+
+	numConns = numChildren + ((parent.socket_fd >= 0) ? 1 : 0);
+	streams = new UdpStream[numConns];
+
+	for(int c = 0; c < numConns; c++){
+		UdpStream &s = streams[c];
+		s.fd = -1;
+		s.control_fd = (c == numChildren) ? parent.socket_fd : children[c].socket_fd;
+		s.next_sequence = 0;
+		s.retransmit_probes = 0;
+		s.expected = 0;
+		s.highest = 0;
+		s.ready_offset = 0;
+		s.last_ack = 0;
+		s.ack_due = false;
+		s.closed = false;
+	}
+
+	// Children first: send our port to every child, then collect theirs
+	for(int c = 0; c < numChildren; c++){
+		uint32_t port = 0;
+		if(children[c].capabilities & CAP_DATAGRAM){
+			int local_port = open_datagram(c);
+			if(local_port < 0)
+				return false;
+			port = local_port;
+		}
+
+		uint32_t wire = htonl(port);
+		if(!write_all(streams[c].control_fd, &wire, sizeof(wire))){
+			printf("\tUdpConnector: Serious Error: Could not send UDP port to child %d\n", c);
+			return false;
+		}
+	}
+
+	for(int c = 0; c < numChildren; c++){
+		if(streams[c].fd < 0)
+			continue;
+
+		uint32_t wire;
+		if(!read_all(streams[c].control_fd, &wire, sizeof(wire)) || !connect_datagram(c, (uint16_t)ntohl(wire))){
+			printf("\tUdpConnector: Serious Error: Could not set up UDP with child %d\n", c);
+			return false;
+		}
+	}
+
+	// Then the parent: it tells us whether (and where) to switch
+	if(parent.socket_fd >= 0){
+		int c = numChildren;
+
+		uint32_t wire;
+		if(!read_all(parent.socket_fd, &wire, sizeof(wire))){
+			printf("\tUdpConnector: Serious Error: Could not read UDP port from parent\n");
+			return false;
+		}
+
+		uint32_t parent_port = ntohl(wire);
+		if(parent_port != 0){
+			int local_port = open_datagram(c);
+			if(local_port < 0)
+				return false;
+
+			wire = htonl((uint32_t)local_port);
+			if(!write_all(parent.socket_fd, &wire, sizeof(wire)) || !connect_datagram(c, (uint16_t)parent_port)){
+				printf("\tUdpConnector: Serious Error: Could not set up UDP with parent\n");
+				return false;
+			}
+		}
+	}
+
+	last_refill = boost::posix_time::microsec_clock::universal_time();
+	started = true;
+
+	receiver = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&UdpConnector::receive_loop, this)));
+
+	if(V)
+		printf("\tUdpConnector: Datagram path running for %d connections\n", numConns);
+
+	return true;
+}
+
+/*!
+ *	Create the UDP socket for a connection on an ephemeral port.
+ *
+ *  @param conn The connection.
+ *  @return The local port the socket is bound to; -1 on error.
+ */
+
+int UdpConnector::open_datagram(int conn){
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd < 0){
+		perror("\tUdpConnector: Serious Error: Could not create UDP socket");
+		return -1;
+	}
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = INADDR_ANY;
+	address.sin_port = 0;
+
+	if(bind(fd, (sockaddr *)&address, sizeof(address)) < 0){
+		perror("\tUdpConnector: Serious Error: Could not bind UDP socket");
+		close(fd);
+		return -1;
+	}
+
+	int send_buffer = (options.send_buffer > 0) ? options.send_buffer : UDP_SOCKET_BUFFER;
+	int receive_buffer = (options.receive_buffer > 0) ? options.receive_buffer : UDP_SOCKET_BUFFER;
+	if(setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer)) < 0)
+		perror("\tUdpConnector: Warning: Could not set SO_SNDBUF");
+	if(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer)) < 0)
+		perror("\tUdpConnector: Warning: Could not set SO_RCVBUF");
+
+	socklen_t length = sizeof(address);
+	getsockname(fd, (sockaddr *)&address, &length);
+
+	streams[conn].fd = fd;
+	return ntohs(address.sin_port);
+}
+
+/*!
+ *	Connect a connection's UDP socket to the peer's UDP port, at the address of its TCP connection.
+ *
+ *  @param conn The connection.
+ *  @param port The peer's UDP port.
+ *  @return True if connected.
+ */
+
+bool UdpConnector::connect_datagram(int conn, uint16_t port){
+
+	sockaddr_in address;
+	socklen_t length = sizeof(address);
+	if(port == 0 || getpeername(streams[conn].control_fd, (sockaddr *)&address, &length) < 0)
+		return false;
+
+	address.sin_port = htons(port);
+	if(connect(streams[conn].fd, (sockaddr *)&address, sizeof(address)) < 0){
+		perror("\tUdpConnector: Serious Error: Could not connect UDP socket");
+		return false;
+	}
+
+	return true;
+}
+
+/*!
+ *	Roll a die for simulated loss.
+ *
+ *  @return True if the datagram should be dropped.
+ */
+
+bool UdpConnector::drop(){
+
+	if(options.udp_loss <= 0)
+		return false;
+
+	boost::mutex::scoped_lock lock(stats_mutex);
+	if(rand_r(&loss_seed) < options.udp_loss * ((double)RAND_MAX + 1.0)){
+		dropped++;
+		return true;
+	}
+	return false;
+}
+
+/*!
+ *	Take bytes from the pacing bucket and, if it runs into debt, wait until the rate has paid it off. The bucket
+ *  is shared by every connection, since they all leave through the same link; bursts are capped at one batch of
+ *  datagrams. The bytes are reserved under the lock and the wait happens outside it, so senders queue up behind
+ *  each other's debt rather than behind each other's sleep.
+ *
+ *  @param bytes Bytes about to be sent.
+ *  @param wait False to charge the bytes without waiting (retransmissions and probes); the
+ *  debt is then paid by the next paced send.
+ */
+
+void UdpConnector::pace(unsigned long bytes, bool wait){
+
+	if(options.udp_pacing <= 0)
+		return;
+
+	long delay;
+	{
+		boost::mutex::scoped_lock lock(pace_mutex);
+
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		double burst = (double)options.udp_batch * options.udp_datagram_size;
+
+		tokens += (now - last_refill).total_microseconds() * (options.udp_pacing / 1e6);
+		if(tokens > burst)
+			tokens = burst;
+		last_refill = now;
+
+		tokens -= bytes;
+		delay = (tokens < 0) ? (long)(-tokens * 1e6 / options.udp_pacing) : 0;
+	}
+
+	if(wait && delay > 0)
+		boost::this_thread::sleep(boost::posix_time::microseconds(delay));
+}
+
+/*!
+ *	Describe one fragment of a message for send_datagrams(); the payload points into the message buffer.
+ *
+ *  @param out Datagrams to append to.
+ *  @param msg The message.
+ *  @param fragment The fragment number.
+ */
+
+void UdpConnector::add_fragment(std::vector<UdpDatagram> &out, const UdpOutgoing &msg, int fragment){
+
+	unsigned long offset = (unsigned long)fragment * payload_size;
+	int length = (int)std::min((unsigned long)payload_size, msg.size - offset);
+
+	UdpDatagram d;
+	memset(&d.header, 0, sizeof(d.header));
+	d.header.type = UDP_DATA;
+	d.header.fragment = htons(fragment);
+	d.header.fragments = htons(msg.fragments);
+	d.header.length = htons(length);
+	d.header.sequence = htonl(msg.sequence);
+	d.header.size = htonl(msg.size);
+	d.payload = msg.buf + offset;
+	d.length = length;
+
+	out.push_back(d);
+}
+
+/*!
+ *	Send datagrams on a connection with sendmmsg(), udp_batch at a time. Datagrams picked by the simulated
+ *  loss are skipped. Send errors are left to the retransmission machinery.
+ *
+ *  @param s The connection.
+ *  @param datagrams The datagrams; their headers must stay put until this returns.
+ *  @param pacing PACE_WAIT, PACE_CHARGE or PACE_NONE.
+ */
+
+void UdpConnector::send_datagrams(UdpStream &s, std::vector<UdpDatagram> &datagrams, int pacing){
+
+	int batch = options.udp_batch;
+	std::vector<mmsghdr> msgs(batch);
+	std::vector<iovec> iovs(2 * batch);
+
+	size_t next = 0;
+	while(next < datagrams.size()){
+
+		int count = 0;
+		unsigned long bytes = 0;
+
+		while(count < batch && next < datagrams.size()){
+			UdpDatagram &d = datagrams[next++];
+			if(drop())
+				continue;
+
+			iovs[2 * count].iov_base = &d.header;
+			iovs[2 * count].iov_len = sizeof(UdpHeader);
+			iovs[2 * count + 1].iov_base = (void *)d.payload;
+			iovs[2 * count + 1].iov_len = d.length;
+
+			memset(&msgs[count], 0, sizeof(mmsghdr));
+			msgs[count].msg_hdr.msg_iov = &iovs[2 * count];
+			msgs[count].msg_hdr.msg_iovlen = (d.length > 0) ? 2 : 1;
+
+			bytes += sizeof(UdpHeader) + d.length;
+			count++;
+		}
+
+		if(count == 0)
+			continue;
+
+		if(pacing != PACE_NONE)
+			pace(bytes, pacing == PACE_WAIT);
+
+		int sent = 0;
+		while(sent < count){
+			int r = sendmmsg(s.fd, &msgs[sent], count - sent, 0);
+			if(r < 0){
+				if(errno == EINTR)
+					continue;
+				if(V && !stopping)
+					perror("\tUdpConnector: sendmmsg");
+				break;
+			}
+			sent += r;
+		}
+	}
+}
+
+/*!
+ *	Tell the sender that every message below expected has been delivered.
+ *
+ *  @param s The connection.
+ *  @param expected The next sequence the receiver will deliver.
+ */
+
+void UdpConnector::send_ack(UdpStream &s, uint32_t expected){
+
+	std::vector<UdpDatagram> datagrams(1);
+	memset(&datagrams[0].header, 0, sizeof(UdpHeader));
+	datagrams[0].header.type = UDP_ACK;
+	datagrams[0].header.sequence = htonl(expected);
+	datagrams[0].payload = NULL;
+	datagrams[0].length = 0;
+
+	send_datagrams(s, datagrams, PACE_NONE);
+}
+
+/*!
+ *	Ask the sender for missing fragments, as many NACK datagrams as the entries need. Each NACK also
+ *  acknowledges every message below expected.
+ *
+ *  @param s The connection.
+ *  @param expected The next sequence the receiver will deliver.
+ *  @param entries Missing (sequence, fragment) pairs, already in network byte order.
+ */
+
+void UdpConnector::send_nacks(UdpStream &s, uint32_t expected, std::vector<UdpNackEntry> &entries){
+
+	size_t per_datagram = payload_size / sizeof(UdpNackEntry);
+	std::vector<UdpDatagram> datagrams;
+
+	for(size_t first = 0; first < entries.size(); first += per_datagram){
+		size_t count = std::min(per_datagram, entries.size() - first);
+
+		UdpDatagram d;
+		memset(&d.header, 0, sizeof(UdpHeader));
+		d.header.type = UDP_NACK;
+		d.header.sequence = htonl(expected);
+		d.header.length = htons(count * sizeof(UdpNackEntry));
+		d.payload = (const char *)&entries[first];
+		d.length = count * sizeof(UdpNackEntry);
+		datagrams.push_back(d);
+	}
+
+	send_datagrams(s, datagrams, PACE_NONE);
+}
+
+/*!
+ *	Send one message: wait for room in the window, keep the message for retransmission and send every fragment.
+ *
+ *  @param conn The connection.
+ *  @param buf The message.
+ *  @param size Bytes in the message.
+ *  @param owned True if buf was allocated with new[] and the connector may keep it; otherwise it is copied.
+ *  @return size; -1 if the connection closed or the connector is stopping.
+ */
+
+int UdpConnector::write_conn(int conn, char *buf, unsigned long size, bool owned){
+
+	if((size + payload_size - 1) / payload_size >= UDP_WHOLE_MESSAGE){
+		printf("\tUdpConnector: Serious Error: A %lu byte message needs more fragments than a datagram header can number\n", size);
+		if(owned)
+			delete[] buf;
+		return -1;
+	}
+
+	UdpStream &s = streams[conn];
+	boost::mutex::scoped_lock lock(s.send_lock);
+
+	while((int)s.unacked.size() >= options.udp_window && !s.closed && !stopping)
+		s.send_cond.wait(lock);
+
+	if(s.closed || stopping){
+		if(owned)
+			delete[] buf;
+		return -1;
+	}
+
+	UdpOutgoing msg;
+	msg.sequence = s.next_sequence++;
+	msg.size = size;
+	msg.fragments = (size == 0) ? 1 : (int)((size + payload_size - 1) / payload_size);
+	msg.sent = boost::posix_time::microsec_clock::universal_time();
+	if(owned){
+		msg.buf = buf;
+	}
+	else{
+		msg.buf = new char[size];
+		memcpy(msg.buf, buf, size);
+	}
+	s.unacked.push_back(msg);
+
+	std::vector<UdpDatagram> datagrams;
+	datagrams.reserve(msg.fragments);
+	for(int f = 0; f < msg.fragments; f++)
+		add_fragment(datagrams, msg, f);
+
+	send_datagrams(s, datagrams, PACE_WAIT);
+
+	return size;
+}
+
+/*!
+ *	Read up to size bytes of delivered messages from a connection, blocking until at least one byte (or the
+ *  end of the stream) is available. Messages are read back to back, so readers see the same byte stream TCP gave them.
+ *
+ *  @param conn The connection to read from.
+ *  @param outbuf Where to copy the bytes.
+ *  @param size The maximum number of bytes to copy.
+ *  @return The number of bytes read; 0 at end of stream.
+ */
+
+int UdpConnector::read_conn(int conn, char *outbuf, int size){
+
+	UdpStream &s = streams[conn];
+	boost::mutex::scoped_lock lock(s.recv_lock);
+
+	while(s.ready.empty() && !s.closed)
+		s.recv_cond.wait(lock);
+
+	int copied = 0;
+	while(copied < size && !s.ready.empty()){
+		std::vector<char> *msg = s.ready.front();
+		int n = std::min((int)msg->size() - s.ready_offset, size - copied);
+
+		if(n > 0)
+			memcpy(outbuf + copied, &(*msg)[s.ready_offset], n);
+		s.ready_offset += n;
+		copied += n;
+
+		if(s.ready_offset == (int)msg->size()){
+			s.ready.pop_front();
+			s.ready_offset = 0;
+			delete msg;
+		}
+	}
+
+	return copied;
+}
+
+/*!
+ *	Receiver thread: drain every UDP socket with recvmmsg(), watch the TCP connections for the peer closing,
+ *  and run the NACK/ACK/retransmit timer every udp_nack_interval microseconds.
+ */
+
+void UdpConnector::receive_loop(){
+
+	int batch = options.udp_batch;
+	int datagram_size = options.udp_datagram_size;
+
+	std::vector<char> buffers((size_t)batch * datagram_size);
+	std::vector<mmsghdr> msgs(batch);
+	std::vector<iovec> iovs(batch);
+
+	for(int i = 0; i < batch; i++){
+		iovs[i].iov_base = &buffers[(size_t)i * datagram_size];
+		iovs[i].iov_len = datagram_size;
+	}
+
+	std::vector<pollfd> fds;
+	std::vector<int> owner; // Connection of each pollfd
+	std::vector<bool> control_open(numConns, true);
+
+	boost::posix_time::ptime last_tick = boost::posix_time::microsec_clock::universal_time();
+	boost::posix_time::time_duration interval = boost::posix_time::microseconds(options.udp_nack_interval);
+
+	timespec timeout;
+	timeout.tv_sec = options.udp_nack_interval / 1000000;
+	timeout.tv_nsec = (options.udp_nack_interval % 1000000) * 1000;
+
+	while(!stopping){
+
+		fds.clear();
+		owner.clear();
+		for(int c = 0; c < numConns; c++){
+			if(streams[c].fd < 0)
+				continue;
+
+			pollfd p;
+			p.fd = streams[c].fd;
+			p.events = POLLIN;
+			p.revents = 0;
+			fds.push_back(p);
+			owner.push_back(c);
+
+			if(control_open[c]){
+				p.fd = streams[c].control_fd;
+				fds.push_back(p);
+				owner.push_back(c);
+			}
+		}
+
+		if(fds.empty())
+			break;
+
+		int ready = ppoll(&fds[0], fds.size(), &timeout, NULL);
+		if(ready < 0 && errno != EINTR){
+			perror("\tUdpConnector: Serious Error: ppoll");
+			break;
+		}
+
+		for(size_t i = 0; ready > 0 && i < fds.size(); i++){
+			if(fds[i].revents == 0)
+				continue;
+
+			int c = owner[i];
+			UdpStream &s = streams[c];
+
+			if(fds[i].fd == s.fd){
+				while(true){
+					for(int m = 0; m < batch; m++){
+						memset(&msgs[m], 0, sizeof(mmsghdr));
+						msgs[m].msg_hdr.msg_iov = &iovs[m];
+						msgs[m].msg_hdr.msg_iovlen = 1;
+					}
+
+					int r = recvmmsg(s.fd, &msgs[0], batch, MSG_DONTWAIT, NULL);
+					if(r <= 0)
+						break;
+
+					for(int m = 0; m < r; m++)
+						handle_datagram(c, &buffers[(size_t)m * datagram_size], msgs[m].msg_len);
+
+					if(r < batch)
+						break;
+				}
+			}
+			else{
+				// Nothing is sent on the TCP connection once the datagram path is up, so readable means closed
+				char byte;
+				ssize_t r = recv(s.control_fd, &byte, 1, MSG_DONTWAIT);
+				if(r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)){
+					control_open[c] = false;
+
+					{
+						boost::mutex::scoped_lock lock(s.recv_lock);
+						s.closed = true;
+						s.recv_cond.notify_all();
+					}
+
+					boost::mutex::scoped_lock lock(s.send_lock);
+					s.send_cond.notify_all();
+				}
+			}
+		}
+
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		if(now - last_tick >= interval){
+			last_tick = now;
+			for(int c = 0; c < numConns; c++){
+				if(streams[c].fd >= 0)
+					tick(streams[c]);
+			}
+		}
+	}
+}
+
+/*!
+ *	Check a datagram's header and hand it to the data, ACK or NACK handler.
+ *
+ *  @param conn The connection it arrived on.
+ *  @param datagram The datagram.
+ *  @param length Its length in bytes.
+ */
+
+void UdpConnector::handle_datagram(int conn, const char *datagram, int length){
+
+	if(length < (int)sizeof(UdpHeader))
+		return;
+
+	UdpHeader header;
+	memcpy(&header, datagram, sizeof(header));
+	header.fragment = ntohs(header.fragment);
+	header.fragments = ntohs(header.fragments);
+	header.length = ntohs(header.length);
+	header.sequence = ntohl(header.sequence);
+	header.size = ntohl(header.size);
+
+	if(header.length > length - (int)sizeof(UdpHeader))
+		return;
+
+	const char *payload = datagram + sizeof(UdpHeader);
+
+	switch(header.type){
+		case UDP_DATA:
+			handle_data(streams[conn], header, payload);
+			break;
+		case UDP_ACK:
+			handle_ack(streams[conn], header.sequence);
+			break;
+		case UDP_NACK:
+			handle_ack(streams[conn], header.sequence);
+			handle_nack(streams[conn], payload, header.length);
+			break;
+		default:
+			if(V)
+				printf("\tUdpConnector: Dropping datagram of unknown type %d\n", header.type);
+			break;
+	}
+}
+
+/*!
+ *	File a fragment, deliver every message that is now complete and in order, and ACK if enough has been
+ *  delivered since the last ACK.
+ *
+ *  @param s The connection.
+ *  @param header The fragment's header (host byte order).
+ *  @param payload The fragment's payload.
+ */
+
+void UdpConnector::handle_data(UdpStream &s, const UdpHeader &header, const char *payload){
+
+	uint32_t ack = 0;
+	bool send_now = false;
+
+	{
+		boost::mutex::scoped_lock lock(s.recv_lock);
+
+		int32_t ahead = seq_diff(header.sequence, s.expected);
+
+		// Already delivered: the sender missed our ACK
+		if(ahead < 0){
+			s.ack_due = true;
+			return;
+		}
+
+		// Beyond anything the sender's window allows, or inconsistent
+		unsigned long offset = (unsigned long)header.fragment * payload_size;
+		if(ahead >= 4 * options.udp_window || header.fragments == 0 || header.fragment >= header.fragments ||
+		   header.size > (unsigned long)header.fragments * payload_size || offset + header.length > header.size)
+			return;
+
+		if(seq_diff(header.sequence + 1, s.highest) > 0)
+			s.highest = header.sequence + 1;
+
+		UdpIncoming *in;
+		std::map<uint32_t, UdpIncoming*>::iterator it = s.partial.find(header.sequence);
+		if(it == s.partial.end()){
+			in = new UdpIncoming();
+			in->data.resize(header.size);
+			in->have.assign(header.fragments, false);
+			in->missing = header.fragments;
+			in->age = 0;
+			s.partial[header.sequence] = in;
+		}
+		else{
+			in = it->second;
+			if(in->data.size() != header.size || (int)in->have.size() != header.fragments)
+				return;
+		}
+
+		if(!in->have[header.fragment]){
+			if(header.length > 0)
+				memcpy(&in->data[offset], payload, header.length);
+			in->have[header.fragment] = true;
+			in->missing--;
+		}
+
+		// Deliver whatever is now complete at the front
+		bool delivered = false;
+		while(true){
+			it = s.partial.find(s.expected);
+			if(it == s.partial.end() || it->second->missing > 0)
+				break;
+
+			std::vector<char> *msg = new std::vector<char>();
+			msg->swap(it->second->data);
+			s.ready.push_back(msg);
+
+			delete it->second;
+			s.partial.erase(it);
+			s.expected++;
+			delivered = true;
+		}
+
+		if(delivered){
+			s.ack_due = true;
+			s.recv_cond.notify_all();
+
+			// ACK early enough that the sender's window never closes waiting for the timer
+			if(seq_diff(s.expected, s.last_ack) >= std::max(1, options.udp_window / 4)){
+				ack = s.expected;
+				s.last_ack = ack;
+				s.ack_due = false;
+				send_now = true;
+			}
+		}
+	}
+
+	if(send_now)
+		send_ack(s, ack);
+}
+
+/*!
+ *	Release every message below sequence and open the window.
+ *
+ *  @param s The connection.
+ *  @param sequence The receiver's next expected sequence.
+ */
+
+void UdpConnector::handle_ack(UdpStream &s, uint32_t sequence){
+
+	boost::mutex::scoped_lock lock(s.send_lock);
+
+	bool released = false;
+	while(!s.unacked.empty() && seq_diff(sequence, s.unacked.front().sequence) > 0){
+		delete[] s.unacked.front().buf;
+		s.unacked.pop_front();
+		released = true;
+	}
+
+	if(released){
+		s.retransmit_probes = 0;
+		s.send_cond.notify_all();
+	}
+}
+
+/*!
+ *	Retransmit the fragments a NACK lists.
+ *
+ *  @param s The connection.
+ *  @param payload The NACK entries (network byte order).
+ *  @param length Bytes of entries.
+ */
+
+void UdpConnector::handle_nack(UdpStream &s, const char *payload, int length){
+
+	boost::mutex::scoped_lock lock(s.send_lock);
+
+	if(s.unacked.empty())
+		return;
+
+	std::vector<UdpDatagram> datagrams;
+	uint32_t base = s.unacked.front().sequence;
+
+	for(int offset = 0; offset + (int)sizeof(UdpNackEntry) <= length; offset += sizeof(UdpNackEntry)){
+		UdpNackEntry entry;
+		memcpy(&entry, payload + offset, sizeof(entry));
+		uint32_t sequence = ntohl(entry.sequence);
+		uint16_t fragment = ntohs(entry.fragment);
+
+		int32_t position = seq_diff(sequence, base);
+		if(position < 0 || position >= (int32_t)s.unacked.size())
+			continue;
+
+		UdpOutgoing &msg = s.unacked[position];
+		if(fragment == UDP_WHOLE_MESSAGE){
+			for(int f = 0; f < msg.fragments; f++)
+				add_fragment(datagrams, msg, f);
+		}
+		else if(fragment < msg.fragments){
+			add_fragment(datagrams, msg, fragment);
+		}
+	}
+
+	if(datagrams.empty())
+		return;
+
+	{
+		boost::mutex::scoped_lock stats(stats_mutex);
+		retransmitted += datagrams.size();
+	}
+
+	send_datagrams(s, datagrams, PACE_CHARGE);
+}
+
+/*!
+ *	Timer work for one connection: NACK overdue fragments, ACK any progress not yet acknowledged, and
+ *  probe with the newest message's last fragment if the ACK has not moved for a retransmit timeout.
+ *
+ *  @param s The connection.
+ */
+
+void UdpConnector::tick(UdpStream &s){
+
+	// Receive side
+	std::vector<UdpNackEntry> entries;
+	uint32_t expected;
+	bool ack = false;
+	{
+		boost::mutex::scoped_lock lock(s.recv_lock);
+
+		expected = s.expected;
+		for(uint32_t sequence = s.expected; seq_diff(s.highest, sequence) > 0; sequence++){
+			UdpNackEntry entry;
+			entry.sequence = htonl(sequence);
+			entry.reserved = 0;
+
+			std::map<uint32_t, UdpIncoming*>::iterator it = s.partial.find(sequence);
+
+			// Nothing of this message arrived, but later ones did
+			if(it == s.partial.end()){
+				entry.fragment = htons(UDP_WHOLE_MESSAGE);
+				entries.push_back(entry);
+				continue;
+			}
+
+			// Give fragments still in flight one full interval before asking for them
+			UdpIncoming *in = it->second;
+			if(++in->age < 2)
+				continue;
+
+			for(int f = 0; f < (int)in->have.size(); f++){
+				if(!in->have[f]){
+					entry.fragment = htons(f);
+					entries.push_back(entry);
+				}
+			}
+		}
+
+		if(s.ack_due || !entries.empty()){
+			ack = true;
+			s.ack_due = false;
+			s.last_ack = expected;
+		}
+	}
+
+	if(!entries.empty())
+		send_nacks(s, expected, entries);
+	else if(ack)
+		send_ack(s, expected);
+
+	// Send side
+	boost::mutex::scoped_lock lock(s.send_lock);
+
+	if(s.unacked.empty())
+		return;
+
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	UdpOutgoing &newest = s.unacked.back();
+	long timeout = (long)options.udp_retransmit_timeout << std::min(s.retransmit_probes, UDP_MAX_BACKOFF);
+
+	if((now - newest.sent).total_microseconds() < timeout)
+		return;
+
+	// The receiver either lost the tail or we lost its ACK; the last fragment makes it NACK or re-ACK
+	std::vector<UdpDatagram> datagrams;
+	add_fragment(datagrams, newest, newest.fragments - 1);
+	newest.sent = now;
+	s.retransmit_probes++;
+
+	{
+		boost::mutex::scoped_lock stats(stats_mutex);
+		retransmitted++;
+	}
+
+	send_datagrams(s, datagrams, PACE_CHARGE);
+}
+
+/// Write to the parent as a datagram message
+int UdpConnector::write_parent(char * msg, int size){
+	if(!started || streams[conn_of(-1)].fd < 0)
+		return EthernetConnector::write_parent(msg, size);
+	return write_conn(conn_of(-1), msg, size, false);
+}
+
+/// Read delivered messages from the parent
+int UdpConnector::read_parent(char * outbuf, int size){
+	if(!started || streams[conn_of(-1)].fd < 0)
+		return EthernetConnector::read_parent(outbuf, size);
+	return read_conn(conn_of(-1), outbuf, size);
+}
+
+/// Write to a child as a datagram message
+int UdpConnector::write_child(int index, char * inbuf, unsigned long size){
+	if(index > (numChildren - 1))
+		return -1;
+	if(!started || streams[index].fd < 0)
+		return EthernetConnector::write_child(index, inbuf, size);
+	return write_conn(index, inbuf, size, false);
+}
+
+/// Read delivered messages from a child
+int UdpConnector::read_child(int index, char * outbuf, int size){
+	if(!started || streams[index].fd < 0)
+		return EthernetConnector::read_child(index, outbuf, size);
+	return read_conn(index, outbuf, size);
+}
+
+/*!
+ *	Send a message without copying it; the connector keeps buf until the receiver acknowledges it.
+ *  Blocks only while the connection's window is full.
+ *
+ *  @param index The index of the child; -1 for the parent.
+ *  @param buf Buffer to send; ownership passes to the connector.
+ *  @param size The number of bytes in buf.
+ *  @return True if the message was sent.
+ */
+
+bool UdpConnector::write_async(int index, char * buf, unsigned long size){
+
+	int conn = conn_of(index);
+	if(!started || streams[conn].fd < 0)
+		return EthernetConnector::write_async(index, buf, size);
+
+	return write_conn(conn, buf, size, true) >= 0;
+}
+
+/*!
+ *	Stop the receiver and close all sockets.
+ */
+
+void UdpConnector::stop(){
+	shutdown_datagrams();
+	EthernetConnector::stop();
+}
+
+/*!
+ *	Give outstanding messages up to UDP_LINGER_MS to be acknowledged (the receiver is still running, so
+ *  NACKs are served), then stop the receiver and release everything still queued.
+ */
+
+void UdpConnector::shutdown_datagrams(){
+
+	if(!started)
+		return;
+
+	boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(UDP_LINGER_MS);
+	for(int c = 0; c < numConns; c++){
+		UdpStream &s = streams[c];
+		if(s.fd < 0)
+			continue;
+
+		boost::mutex::scoped_lock lock(s.send_lock);
+		while(!s.unacked.empty() && !s.closed){
+			if(!s.send_cond.timed_wait(lock, deadline))
+				break;
+		}
+	}
+
+	stopping = true;
+	receiver->join();
+
+	for(int c = 0; c < numConns; c++){
+		UdpStream &s = streams[c];
+		if(s.fd < 0)
+			continue;
+
+		{
+			boost::mutex::scoped_lock lock(s.send_lock);
+			while(!s.unacked.empty()){
+				delete[] s.unacked.front().buf;
+				s.unacked.pop_front();
+			}
+			s.send_cond.notify_all();
+		}
+
+		{
+			boost::mutex::scoped_lock lock(s.recv_lock);
+			for(std::map<uint32_t, UdpIncoming*>::iterator it = s.partial.begin(); it != s.partial.end(); ++it)
+				delete it->second;
+			s.partial.clear();
+			while(!s.ready.empty()){
+				delete s.ready.front();
+				s.ready.pop_front();
+			}
+			s.closed = true;
+			s.recv_cond.notify_all();
+		}
+
+		close(s.fd);
+		s.fd = -1;
+	}
+
+	started = false;
+}
@@ -0,0 +1,190 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef UDPCONNECTOR_H
+#define UDPCONNECTOR_H
+
+#include "EthernetConnector.h"
+
+#include <deque>
+#include <map>
+#include <vector>
+
+// Datagram types
+#define UDP_DATA	1 // One fragment of a message
+#define UDP_ACK		2 // Every message below sequence has been delivered
+#define UDP_NACK	3 // Payload lists (sequence, fragment) pairs the receiver is missing
+
+// NACK entry fragment meaning "every fragment of this message"
+#define UDP_WHOLE_MESSAGE	0xFFFF
+
+// How send_datagrams() treats the pacing bucket (TransportOptions::udp_pacing)
+#define PACE_WAIT	0 // New data: wait for the bucket
+#define PACE_CHARGE	1 // Retransmissions and probes: count against the bucket, never wait (they run on the receive and timer threads)
+#define PACE_NONE	2 // ACKs and NACKs: a few bytes that must not queue behind data
+
+// Header at the front of every datagram (network byte order)
+struct UdpHeader{
+	uint8_t type; // UDP_DATA, UDP_ACK or UDP_NACK
+	uint8_t reserved;
+	uint16_t fragment; // Fragment number within the message
+	uint16_t fragments; // Fragments in the message
+	uint16_t length; // Payload bytes in this datagram
+	uint32_t sequence; // Message sequence number on this connection
+	uint32_t size; // Total bytes in the message
+};
+
+// One entry in a NACK payload (network byte order)
+struct UdpNackEntry{
+	uint32_t sequence;
+	uint16_t fragment; // Missing fragment, or UDP_WHOLE_MESSAGE
+	uint16_t reserved;
+};
+
+// A datagram about to be sent: its header plus a pointer to its payload
+struct UdpDatagram{
+	UdpHeader header;
+	const char *payload;
+	int length;
+};
+
+// A message that has been sent but not yet acknowledged
+struct UdpOutgoing{
+	uint32_t sequence;
+	char *buf;
+	unsigned long size;
+	int fragments;
+	boost::posix_time::ptime sent; // Last (re)transmission
+};
+
+// A message that is partly received
+struct UdpIncoming{
+	std::vector<char> data;
+	std::vector<bool> have; // have[f] is true once fragment f arrived
+	int missing; // Fragments still to arrive
+	int age; // Ticks since the first fragment arrived; fragments are only NACKed once they are overdue
+};
+
+// Per-connection state
+struct UdpStream{
+	int fd; // Connected UDP socket; -1 while the connection stays on TCP
+	int control_fd; // The TCP connection set up by EthernetConnector; its close marks the end of the stream
+
+	// Send side
+	boost::mutex send_lock;
+	boost::condition_variable send_cond; // Signalled when the window opens
+	uint32_t next_sequence; // Sequence of the next message written
+	std::deque<UdpOutgoing> unacked; // In sequence order, front is the oldest
+	int retransmit_probes; // Consecutive timeouts without the ACK moving
+
+	// Receive side
+	boost::mutex recv_lock;
+	boost::condition_variable recv_cond; // Signalled when a message is delivered or the stream closes
+	uint32_t expected; // Sequence of the next message to deliver
+	uint32_t highest; // One past the highest sequence seen
+	std::map<uint32_t, UdpIncoming*> partial; // Messages at or above expected that are incomplete (or early)
+	std::deque<std::vector<char>*> ready; // Delivered messages waiting to be read
+	int ready_offset; // Bytes of ready.front() already read
+	uint32_t last_ack; // expected as of the last ACK sent
+	bool ack_due; // Progress (or a duplicate) since the last ACK
+	bool closed;
+};
+
+/*
+ UDP datagram backend for the Ethernet Connector.
+
+ Connections and the hello handshake still go over TCP; start() then trades UDP ports over each TCP connection
+ and moves the data path onto one connected UDP socket per connection. Every write becomes one message,
+ split into fragments that fit the datagram size, and messages are delivered whole and in order:
+ - The receiver NACKs missing fragments (or whole messages) after a gap, and ACKs delivered messages;
+   the sender keeps unacknowledged messages for selective retransmission and probes with the last
+   fragment if the ACK stops moving.
+ - There is no congestion control: the sender is limited by a window of unacknowledged messages and an
+   optional pacing rate, which suits a dedicated LAN segment.
+ - Fragments are sent with sendmmsg() and received with recvmmsg() in batches.
+ - TransportOptions::udp_loss drops that fraction of outgoing datagrams to exercise recovery on loopback.
+ A child only moves to UDP if it advertised CAP_DATAGRAM; otherwise its connection stays on TCP.
+ */
+
+class UdpConnector : public EthernetConnector{
+public:
+
+	UdpConnector(int number_of_children, int port, const TransportOptions &options);
+	~UdpConnector();
+
+	bool start();
+
+	int write_parent(char * msg, int size);
+	int read_parent(char * outbuf, int size);
+	int write_child(int index, char * inbuf, unsigned long size);
+	int read_child(int index, char * outbuf, int size);
+
+	bool write_async(int index, char * buf, unsigned long size);
+
+	void stop();
+
+	// Datagrams dropped by simulated loss and fragments retransmitted, over all connections
+	unsigned long dropped_datagrams(){ return dropped; }
+	unsigned long retransmitted_fragments(){ return retransmitted; }
+
+private:
+
+	bool started;
+	volatile bool stopping;
+
+	int numConns; // Children, plus the parent if this node has one
+	UdpStream *streams;
+	int payload_size; // Payload bytes per datagram
+
+	boost::shared_ptr<boost::thread> receiver;
+
+	// Pacing (token bucket shared by every connection on this node)
+	boost::mutex pace_mutex;
+	double tokens;
+	boost::posix_time::ptime last_refill;
+
+	// Simulated loss and statistics
+	boost::mutex stats_mutex;
+	unsigned int loss_seed;
+	unsigned long dropped;
+	unsigned long retransmitted;
+
+	int conn_of(int index){ return (index == -1) ? numChildren : index; }
+
+	int open_datagram(int conn);
+	bool connect_datagram(int conn, uint16_t port);
+	int write_conn(int conn, char *buf, unsigned long size, bool owned);
+	int read_conn(int conn, char *outbuf, int size);
+	void add_fragment(std::vector<UdpDatagram> &out, const UdpOutgoing &msg, int fragment);
+	void send_datagrams(UdpStream &s, std::vector<UdpDatagram> &datagrams, int pacing);
+	void send_ack(UdpStream &s, uint32_t expected);
+	void send_nacks(UdpStream &s, uint32_t expected, std::vector<UdpNackEntry> &entries);
+	void pace(unsigned long bytes, bool wait);
+	bool drop();
+	void receive_loop();
+	void handle_datagram(int conn, const char *datagram, int length);
+	void handle_data(UdpStream &s, const UdpHeader &header, const char *payload);
+	void handle_ack(UdpStream &s, uint32_t sequence);
+	void handle_nack(UdpStream &s, const char *payload, int length);
+	void tick(UdpStream &s);
+	void shutdown_datagrams();
+};
+
+#endif
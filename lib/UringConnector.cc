@@ -0,0 +1,576 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "UringConnector.h"
+
+#ifdef HAVE_LIBURING
+
+#include <iostream>
+#include <errno.h>
+#include <stdint.h>
+
+// Buffer group id of the provided-buffer ring
+#define URING_BGID	0
+
+// The low two bits of an SQE's user data say what completed; sends carry their (aligned) UringSend pointer
+#define OP_SEND		0
+#define OP_RECV		1
+#define OP_WAKE		2
+#define OP_MASK		3
+
+// Completions drained per batch by the reaper
+#define REAP_BATCH	64
+
+/*!
+ *	The constructor for the io_uring connector. Sockets are created exactly as for the Ethernet Connector;
+ *  the ring itself is set up by start() once every connection is established.
+ *
+ *  @param count The number of children that the router will connect to.
+ *  @param port The port on which the router will communicate.
+ *  @param options Socket tuning and ring sizing.
+ */
+
+UringConnector::UringConnector(int count, int port, const TransportOptions &options)
+: EthernetConnector(count, port, options), buf_ring(NULL), buffers(NULL), buf_mask(0), started(false), stopping(false), numConns(0), streams(NULL), fds(NULL), pending_submit(false), free_buffers(0)
+{
+}
+
+/*!
+ *	The destructor; tears the ring down before the sockets are closed.
+ */
+
+UringConnector::~UringConnector(){
+	shutdown_ring();
+	delete[] streams;
+}
+
+/*!
+ *	Set up the ring and the provided-buffer ring, post a multishot receive on every connection and start the reaper.
+ *
+ *  @return True if the ring is running; False if io_uring is unavailable (the caller should use plain sockets).
+ */
+
+bool UringConnector::start(){
+
+	numConns = numChildren + ((parent.socket_fd >= 0) ? 1 : 0);
+
+	int ret = io_uring_queue_init(options.ring_entries, &ring, 0);
+	if(ret < 0){
+		printf("\tUringConnector: Could not create io_uring (%s)\n", strerror(-ret));
+		return false;
+	}
+
+	streams = new UringStream[numConns];
+	fds = new int[numConns];
+
+	for(int c = 0; c < numConns; c++){
+		fds[c] = (c == numChildren) ? parent.socket_fd : children[c].socket_fd;
+		streams[c].closed = false;
+		streams[c].fallback = false;
+		streams[c].needs_repost = false;
+	}
+
+	buf_ring = io_uring_setup_buf_ring(&ring, options.ring_buffers, URING_BGID, 0, &ret);
+
+	// Without provided-buffer rings every connection reads the socket directly; sends still go through the ring
+	if(buf_ring == NULL){
+		printf("\tUringConnector: Kernel lacks provided-buffer rings (%s); receiving with read()\n", strerror(-ret));
+		for(int c = 0; c < numConns; c++)
+			streams[c].fallback = true;
+	}
+	else{
+		buffers = new char[(size_t)options.ring_buffers * options.ring_buffer_size];
+		buf_mask = io_uring_buf_ring_mask(options.ring_buffers);
+		free_buffers = options.ring_buffers;
+
+		for(int i = 0; i < options.ring_buffers; i++)
+			io_uring_buf_ring_add(buf_ring, buffers + (size_t)i * options.ring_buffer_size, options.ring_buffer_size, i, buf_mask, i);
+		io_uring_buf_ring_advance(buf_ring, options.ring_buffers);
+
+		boost::mutex::scoped_lock lock(ring_mutex);
+		for(int c = 0; c < numConns; c++)
+			post_recv(c);
+	}
+
+	started = true;
+	flush();
+
+	reaper = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&UringConnector::reap, this)));
+
+	if(V)
+		printf("\tUringConnector: Ring running for %d connections\n", numConns);
+
+	return true;
+}
+
+/*!
+ *	Post a multishot receive that pulls its buffers from the provided-buffer ring. Caller holds ring_mutex.
+ *
+ *  @param conn The connection to receive on.
+ */
+
+void UringConnector::post_recv(int conn){
+
+	io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+	if(sqe == NULL){
+		io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+	}
+
+	io_uring_prep_recv_multishot(sqe, fds[conn], NULL, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	io_uring_sqe_set_data64(sqe, ((uint64_t)conn << 2) | OP_RECV);
+
+	streams[conn].needs_repost = false;
+	pending_submit = true;
+}
+
+/*!
+ *	Prepare an SQE for the unsent remainder of a write. Caller holds the connection's stream lock.
+ *
+ *  @param op The write to (re)submit.
+ */
+
+void UringConnector::prep_send(UringSend *op){
+
+	boost::mutex::scoped_lock lock(ring_mutex);
+
+	io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+	if(sqe == NULL){
+		io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+	}
+
+	io_uring_prep_send(sqe, fds[op->conn], op->buf + op->done, op->size - op->done, MSG_NOSIGNAL);
+	io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)op | OP_SEND);
+
+	pending_submit = true;
+}
+
+/*!
+ *	Queue a write on its connection. Only the front write of a connection is in flight at a time, so a
+ *  short send can be finished before the next write starts and the byte stream stays in order.
+ *
+ *  @param op The write to queue.
+ */
+
+void UringConnector::enqueue(UringSend *op){
+
+	UringStream &s = streams[op->conn];
+	boost::mutex::scoped_lock lock(s.lock);
+
+	s.sends.push_back(op);
+	if(s.sends.size() == 1)
+		prep_send(op);
+}
+
+/*!
+ *	Submit every prepared SQE, across all connections, with a single io_uring_enter().
+ */
+
+void UringConnector::flush(){
+
+	if(!started)
+		return;
+
+	boost::mutex::scoped_lock lock(ring_mutex);
+	if(pending_submit){
+		io_uring_submit(&ring);
+		pending_submit = false;
+	}
+}
+
+/*!
+ *	Reaper thread: wait for completions and drain them in batches until the connector stops.
+ */
+
+void UringConnector::reap(){
+
+	io_uring_cqe *cqes[REAP_BATCH];
+
+	while(true){
+
+		io_uring_cqe *cqe;
+		int ret = io_uring_wait_cqe(&ring, &cqe);
+		if(ret < 0){
+			if(ret == -EINTR)
+				continue;
+			printf("\tUringConnector: Serious Error: Waiting for completions failed (%s)\n", strerror(-ret));
+			break;
+		}
+
+		unsigned count = io_uring_peek_batch_cqe(&ring, cqes, REAP_BATCH);
+		bool wake = false;
+
+		for(unsigned i = 0; i < count; i++){
+			uint64_t data = io_uring_cqe_get_data64(cqes[i]);
+
+			switch(data & OP_MASK){
+				case OP_RECV:
+					complete_recv((int)(data >> 2), cqes[i]->res, cqes[i]->flags);
+					break;
+				case OP_SEND:
+					complete_send((UringSend *)(uintptr_t)data, cqes[i]->res);
+					break;
+				case OP_WAKE:
+					wake = true;
+					break;
+			}
+		}
+
+		io_uring_cq_advance(&ring, count);
+
+		// Resubmissions, follow-on sends and reposted receives from the whole batch go out together
+		flush();
+
+		if(wake && stopping)
+			break;
+	}
+}
+
+/*!
+ *	Handle a send completion: finish a short send, or retire the write and start the next one on its connection.
+ *
+ *  @param op The write that completed.
+ *  @param res Bytes sent, or -errno.
+ */
+
+void UringConnector::complete_send(UringSend *op, int res){
+
+	UringStream &s = streams[op->conn];
+	boost::mutex::scoped_lock lock(s.lock);
+
+	if(res == -EINTR || res == -EAGAIN){
+		prep_send(op);
+		return;
+	}
+
+	if(res < 0){
+		if(!stopping)
+			printf("\tUringConnector: Send on connection %d failed (%s)\n", op->conn, strerror(-res));
+		op->result = -1;
+	}
+	else{
+		op->done += res;
+		if(op->done < op->size){
+			prep_send(op);
+			return;
+		}
+		op->result = op->size;
+	}
+
+	s.sends.pop_front();
+
+	if(op->owned){
+		delete[] op->buf;
+		delete op;
+	}
+	else{
+		op->finished = true;
+		s.cond.notify_all();
+	}
+
+	if(!s.sends.empty())
+		prep_send(s.sends.front());
+}
+
+/*!
+ *	Handle a receive completion: queue the filled buffer for the reader, and re-arm the receive if the kernel stopped it.
+ *
+ *  @param conn The connection the data arrived on.
+ *  @param res Bytes received, 0 on end of stream, or -errno.
+ *  @param flags CQE flags (buffer id, more-to-come).
+ */
+
+void UringConnector::complete_recv(int conn, int res, unsigned flags){
+
+	UringStream &s = streams[conn];
+	boost::mutex::scoped_lock lock(s.lock);
+
+	if(res > 0 && (flags & IORING_CQE_F_BUFFER)){
+		UringChunk chunk;
+		chunk.bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		chunk.offset = 0;
+		chunk.length = res;
+		s.chunks.push_back(chunk);
+
+		boost::mutex::scoped_lock ring_lock(ring_mutex);
+		free_buffers--;
+	}
+	else if(res == 0){
+		s.closed = true;
+	}
+	else if(res == -ENOBUFS){
+		// Every buffer is waiting to be read; the receive is re-armed when one is recycled
+		boost::mutex::scoped_lock ring_lock(ring_mutex);
+		if(free_buffers > 0)
+			post_recv(conn);
+		else
+			s.needs_repost = true;
+		return;
+	}
+	else if(res == -EINVAL || res == -EOPNOTSUPP){
+		if(V)
+			printf("\tUringConnector: Multishot receive unsupported; connection %d falls back to read()\n", conn);
+		s.fallback = true;
+	}
+	else if(res < 0){
+		if(!stopping)
+			printf("\tUringConnector: Receive on connection %d failed (%s)\n", conn, strerror(-res));
+		s.closed = true;
+	}
+
+	s.cond.notify_all();
+
+	if(!(flags & IORING_CQE_F_MORE) && !s.closed && !s.fallback){
+		boost::mutex::scoped_lock ring_lock(ring_mutex);
+		post_recv(conn);
+	}
+}
+
+/*!
+ *	Hand a receive buffer back to the kernel, and re-arm any receive that stopped for lack of buffers.
+ *
+ *  @param bid The buffer id to recycle.
+ */
+
+void UringConnector::recycle(unsigned short bid){
+
+	boost::mutex::scoped_lock lock(ring_mutex);
+
+	io_uring_buf_ring_add(buf_ring, buffers + (size_t)bid * options.ring_buffer_size, options.ring_buffer_size, bid, buf_mask, 0);
+	io_uring_buf_ring_advance(buf_ring, 1);
+	free_buffers++;
+
+	bool reposted = false;
+	for(int c = 0; c < numConns; c++){
+		if(streams[c].needs_repost){
+			post_recv(c);
+			reposted = true;
+		}
+	}
+
+	if(reposted){
+		io_uring_submit(&ring);
+		pending_submit = false;
+	}
+}
+
+/*!
+ *	Read up to size bytes from a connection, blocking until at least one byte (or end of stream) is available.
+ *
+ *  @param conn The connection to read from.
+ *  @param outbuf Where to copy the bytes.
+ *  @param size The maximum number of bytes to copy.
+ *  @return The number of bytes read; 0 at end of stream; -1 on error.
+ */
+
+int UringConnector::read_conn(int conn, char *outbuf, int size){
+
+	UringStream &s = streams[conn];
+	boost::mutex::scoped_lock lock(s.lock);
+
+	while(s.chunks.empty() && !s.closed && !s.fallback)
+		s.cond.wait(lock);
+
+	if(s.chunks.empty()){
+		if(s.fallback){
+			lock.unlock();
+			return read(fds[conn], outbuf, size);
+		}
+		return 0;
+	}
+
+	int copied = 0;
+	while(copied < size && !s.chunks.empty()){
+		UringChunk &chunk = s.chunks.front();
+		int n = std::min(chunk.length, size - copied);
+
+		memcpy(outbuf + copied, buffers + (size_t)chunk.bid * options.ring_buffer_size + chunk.offset, n);
+		chunk.offset += n;
+		chunk.length -= n;
+		copied += n;
+
+		if(chunk.length == 0){
+			unsigned short bid = chunk.bid;
+			s.chunks.pop_front();
+			recycle(bid);
+		}
+	}
+
+	return copied;
+}
+
+/*!
+ *	Write a buffer through the ring and wait for it to complete.
+ *
+ *  @param conn The connection to write to.
+ *  @param buf The bytes to write.
+ *  @param size The number of bytes.
+ *  @return The number of bytes written; -1 on error.
+ */
+
+int UringConnector::write_conn(int conn, char *buf, unsigned long size){
+
+	UringSend op;
+	op.conn = conn;
+	op.buf = buf;
+	op.size = size;
+	op.done = 0;
+	op.owned = false;
+	op.finished = false;
+	op.result = -1;
+
+	enqueue(&op);
+	flush();
+
+	UringStream &s = streams[conn];
+	boost::mutex::scoped_lock lock(s.lock);
+	while(!op.finished)
+		s.cond.wait(lock);
+
+	return op.result;
+}
+
+/// Write to the parent through the ring
+int UringConnector::write_parent(char * msg, int size){
+	if(!started)
+		return EthernetConnector::write_parent(msg, size);
+	return write_conn(conn_of(-1), msg, size);
+}
+
+/// Read from the parent through the ring
+int UringConnector::read_parent(char * outbuf, int size){
+	if(!started)
+		return EthernetConnector::read_parent(outbuf, size);
+	return read_conn(conn_of(-1), outbuf, size);
+}
+
+/// Write to a child through the ring
+int UringConnector::write_child(int index, char * inbuf, unsigned long size){
+	if(!started)
+		return EthernetConnector::write_child(index, inbuf, size);
+	if(index > (numChildren - 1))
+		return -1;
+	return write_conn(index, inbuf, size);
+}
+
+/// Read from a child through the ring
+int UringConnector::read_child(int index, char * outbuf, int size){
+	if(!started)
+		return EthernetConnector::read_child(index, outbuf, size);
+	return read_conn(index, outbuf, size);
+}
+
+/*!
+ *	Queue a write without waiting for it; it is submitted with the next flush(), together with the writes
+ *  queued for every other connection.
+ *
+ *  @param index The index of the child; -1 for the parent.
+ *  @param buf Buffer to send; ownership passes to the connector.
+ *  @param size The number of bytes in buf.
+ *  @return True if the write was queued.
+ */
+
+bool UringConnector::write_async(int index, char * buf, unsigned long size){
+
+	if(!started)
+		return EthernetConnector::write_async(index, buf, size);
+
+	UringSend *op = new UringSend();
+	op->conn = conn_of(index);
+	op->buf = buf;
+	op->size = size;
+	op->done = 0;
+	op->owned = true;
+	op->finished = false;
+	op->result = -1;
+
+	enqueue(op);
+	return true;
+}
+
+/*!
+ *	Stop the reaper, release the ring and close all sockets.
+ */
+
+void UringConnector::stop(){
+	shutdown_ring();
+	EthernetConnector::stop();
+}
+
+/*!
+ *	Wake the reaper with a NOP, wait for it to exit and release everything the ring owns.
+ */
+
+void UringConnector::shutdown_ring(){
+
+	if(!started)
+		return;
+
+	stopping = true;
+
+	{
+		boost::mutex::scoped_lock lock(ring_mutex);
+		io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+		if(sqe == NULL){
+			io_uring_submit(&ring);
+			sqe = io_uring_get_sqe(&ring);
+		}
+		io_uring_prep_nop(sqe);
+		io_uring_sqe_set_data64(sqe, OP_WAKE);
+		io_uring_submit(&ring);
+		pending_submit = false;
+	}
+
+	reaper->join();
+
+	// Release blocked readers and writers, and any writes that never went out
+	for(int c = 0; c < numConns; c++){
+		boost::mutex::scoped_lock lock(streams[c].lock);
+		streams[c].closed = true;
+		while(!streams[c].sends.empty()){
+			UringSend *op = streams[c].sends.front();
+			streams[c].sends.pop_front();
+			if(op->owned){
+				delete[] op->buf;
+				delete op;
+			}
+			else{
+				op->finished = true;
+			}
+		}
+		streams[c].cond.notify_all();
+	}
+
+	if(buf_ring != NULL)
+		io_uring_free_buf_ring(&ring, buf_ring, options.ring_buffers, URING_BGID);
+	io_uring_queue_exit(&ring);
+
+	started = false;
+
+	delete[] buffers;
+	buffers = NULL;
+	delete[] fds;
+	fds = NULL;
+}
+
+#endif /* HAVE_LIBURING */
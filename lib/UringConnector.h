@@ -0,0 +1,127 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef URINGCONNECTOR_H
+#define URINGCONNECTOR_H
+
+#include "EthernetConnector.h"
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+#include <deque>
+#include <algorithm>
+
+// A run of received bytes sitting in one of the ring's receive buffers
+struct UringChunk{
+	unsigned short bid; // Buffer id within the provided-buffer ring
+	int offset; // First unread byte
+	int length; // Unread bytes
+};
+
+// One write to a connection; only the front of a connection's queue is ever in flight so bytes stay in order
+struct UringSend{
+	int conn; // Connection index
+	char *buf; // Bytes to send
+	unsigned long size; // Total bytes in buf
+	unsigned long done; // Bytes already on the socket
+	bool owned; // delete[] buf on completion (write_async)
+	bool finished; // Set on completion of a synchronous write
+	int result; // Bytes written or -1
+};
+
+// Per-connection state: received chunks waiting to be read and writes waiting to go out
+struct UringStream{
+	boost::mutex lock;
+	boost::condition_variable cond;
+	std::deque<UringChunk> chunks;
+	std::deque<UringSend*> sends;
+	bool closed; // Peer closed the connection or the receive failed
+	bool fallback; // Kernel lacks multishot receive; read() the socket directly
+	bool needs_repost; // Multishot receive stopped because the buffer ring ran dry
+};
+
+/*
+ io_uring backend for the Ethernet Connector.
+
+ Connections are set up by EthernetConnector exactly as before; start() then moves the data path onto one ring:
+ - Every connection keeps one multishot receive posted against a provided-buffer ring, so the kernel fills
+   receive buffers without a read() per chunk. A reaper thread drains completions in batches and hands the
+   chunks to read_child()/read_parent(), which copy out of the ring buffers and recycle them.
+ - write_async() queues sends per connection and flush() submits the queued sends of every connection with
+   one io_uring_enter(), so the root dispatching to many children pays one syscall per batch, not per segment.
+ - If the kernel rejects multishot receive the connection falls back to plain read() transparently.
+ */
+
+class UringConnector : public EthernetConnector{
+public:
+
+	UringConnector(int number_of_children, int port, const TransportOptions &options);
+	~UringConnector();
+
+	bool start();
+
+	int write_parent(char * msg, int size);
+	int read_parent(char * outbuf, int size);
+	int write_child(int index, char * inbuf, unsigned long size);
+	int read_child(int index, char * outbuf, int size);
+
+	bool write_async(int index, char * buf, unsigned long size);
+	void flush();
+	bool async_writes_block(){ return !started; }
+
+	void stop();
+
+private:
+
+	io_uring ring;
+	io_uring_buf_ring *buf_ring;
+	char *buffers; // ring_buffers * ring_buffer_size bytes backing the provided-buffer ring
+	int buf_mask;
+	bool started;
+	volatile bool stopping;
+
+	int numConns; // Children, plus the parent if this node has one
+	UringStream *streams;
+	int *fds;
+
+	boost::mutex ring_mutex; // Guards the submission queue, the buffer ring and pending_submit
+	bool pending_submit; // SQEs have been prepared but not submitted
+	int free_buffers; // Receive buffers currently owned by the kernel
+
+	boost::shared_ptr<boost::thread> reaper;
+
+	int conn_of(int index){ return (index == -1) ? numChildren : index; }
+
+	void reap();
+	void post_recv(int conn);
+	void prep_send(UringSend *op);
+	void enqueue(UringSend *op);
+	void complete_send(UringSend *op, int res);
+	void complete_recv(int conn, int res, unsigned flags);
+	void recycle(unsigned short bid);
+	int read_conn(int conn, char *outbuf, int size);
+	int write_conn(int conn, char *buf, unsigned long size);
+	void shutdown_ring();
+};
+
+#endif /* HAVE_LIBURING */
+
+#endif
@@ -0,0 +1,216 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "ZeroCopy.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef MSG_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
+
+// Verbose Flag
+#define V	false
+
+// Completions to see before deciding the kernel copies every send anyway
+#define ZEROCOPY_PROBE	64
+
+/// Sender with nothing outstanding; enable() turns it on for a socket
+ZeroCopySender::ZeroCopySender() : fd(-1), active(false), next_id(0), completed(0), copied(0){
+}
+
+/// Buffers still pinned by the kernel are released; the socket is already closed by now
+ZeroCopySender::~ZeroCopySender(){
+	while(!pending.empty()){
+		delete[] pending.front().buf;
+		pending.pop_front();
+	}
+}
+
+/*!
+ *	Ask the kernel for zero-copy sends on a socket.
+ *
+ *  @param socket_fd The connected TCP socket.
+ *  @return True if MSG_ZEROCOPY sends can be used; False if the kernel (or libc) lacks SO_ZEROCOPY.
+ */
+
+bool ZeroCopySender::enable(int socket_fd){
+
+	fd = socket_fd;
+	active = false;
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+	int value = 1;
+	if(setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) == 0)
+		active = true;
+	else if(V)
+		perror("\tZeroCopySender: SO_ZEROCOPY");
+#endif
+
+	return active;
+}
+
+/*!
+ *	Send a whole buffer with MSG_ZEROCOPY. The buffer is kept until the kernel reports it is done with
+ *  the pages; each send() call the loop makes takes one notification id.
+ *
+ *  @param buf The bytes to send, allocated with new[]; ownership passes to the sender.
+ *  @param size Bytes in buf.
+ *  @return True if every byte was handed to the kernel.
+ */
+
+bool ZeroCopySender::send(char *buf, unsigned long size){
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+	unsigned long sent = 0;
+	bool issued = false;
+
+	while(sent < size){
+		ssize_t r = ::send(fd, buf + sent, size - sent, MSG_ZEROCOPY | MSG_NOSIGNAL);
+		if(r < 0){
+			if(errno == EINTR)
+				continue;
+
+			// Out of pinned-page budget (optmem): wait for completions to give some back
+			if(errno == ENOBUFS){
+				reap(true);
+				continue;
+			}
+
+			perror("\tZeroCopySender::send");
+			break;
+		}
+
+		next_id++;
+		issued = true;
+		sent += r;
+	}
+
+	// Pages the kernel already took stay pinned until their completion, even if the send failed part way
+	if(issued){
+		Pending p;
+		p.last_id = next_id - 1;
+		p.buf = buf;
+		pending.push_back(p);
+	}
+	else{
+		delete[] buf;
+	}
+
+	reap(false);
+	return sent == size;
+#else
+	delete[] buf;
+	return false;
+#endif
+}
+
+/*!
+ *	Read completion notifications off the socket's error queue and release every buffer they cover.
+ *  TCP completes sends in order, so a notification for id n also finishes everything before n.
+ *
+ *  @param wait Block (up to 100 ms at a time) until at least one notification arrives.
+ */
+
+void ZeroCopySender::reap(bool wait){
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+	while(!pending.empty()){
+
+		char control[128];
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		int r = recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+		if(r < 0){
+			if(errno == EINTR)
+				continue;
+			if(errno != EAGAIN || !wait)
+				return;
+
+			// Error-queue data is signalled as POLLERR, which poll() always reports
+			pollfd p;
+			p.fd = fd;
+			p.events = 0;
+			p.revents = 0;
+			if(poll(&p, 1, 100) <= 0)
+				return;
+			continue;
+		}
+
+		for(cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)){
+			if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+			     (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+
+			sock_extended_err *err = (sock_extended_err *)CMSG_DATA(cm);
+			if(err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			uint32_t lo = err->ee_info;
+			uint32_t hi = err->ee_data;
+			unsigned long count = (unsigned long)(hi - lo) + 1;
+
+			completed += count;
+			if(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				copied += count;
+
+			while(!pending.empty() && (int32_t)(pending.front().last_id - hi) <= 0){
+				delete[] pending.front().buf;
+				pending.pop_front();
+			}
+		}
+
+		wait = false;
+
+		// Pinning pages only to have them copied later costs more than copying up front
+		if(active && completed >= ZEROCOPY_PROBE && copied == completed){
+			if(V)
+				printf("\tZeroCopySender: Kernel copies every send on this connection; using plain sends\n");
+			active = false;
+		}
+	}
+#endif
+}
+
+/*!
+ *	Wait for every outstanding completion, then release whatever is left.
+ *
+ *  @param timeout_ms How long to wait in total.
+ */
+
+void ZeroCopySender::drain(int timeout_ms){
+
+	for(int waited = 0; !pending.empty() && waited < timeout_ms; waited += 100)
+		reap(true);
+
+	while(!pending.empty()){
+		delete[] pending.front().buf;
+		pending.pop_front();
+	}
+}
@@ -0,0 +1,78 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+
+/*
+ Kernel zero-copy sends for one TCP connection (Linux only; everything falls back to plain write()).
+
+ ZeroCopySender sends with MSG_ZEROCOPY: the kernel pins the caller's pages instead of copying them, so the
+ buffer may only be released once the kernel says so on the socket's error queue. The sender keeps every
+ buffer it was handed until its completion arrives, then delete[]s it. If the kernel reports that it had to
+ copy anyway (loopback, or a NIC without scatter-gather), the connection goes back to plain sends.
+
+ There is no receive counterpart. TCP_ZEROCOPY_RECEIVE only pays when the reader keeps the mapped pages, and
+ every reader here (NetworkInterface::receive() and its callers) fills its own buffer, so it would still copy.
+ */
+
+class ZeroCopySender{
+public:
+
+	ZeroCopySender();
+	~ZeroCopySender();
+
+	// Turn on SO_ZEROCOPY for socket_fd; False if the kernel does not support it
+	bool enable(int socket_fd);
+	bool enabled(){ return active; }
+
+	// Send all of buf with MSG_ZEROCOPY and take ownership of it (allocated with new[])
+	bool send(char *buf, unsigned long size);
+
+	// Release buffers whose completions have arrived; block until at least one arrives if wait is set
+	void reap(bool wait);
+
+	// Wait (up to timeout_ms) for every outstanding completion, then release all buffers
+	void drain(int timeout_ms);
+
+	unsigned long completions(){ return completed; }
+	unsigned long copied_completions(){ return copied; }
+
+private:
+
+	struct Pending{
+		uint32_t last_id; // Notification id of the last send() that used the buffer
+		char *buf;
+	};
+
+	int fd;
+	bool active;
+	uint32_t next_id; // Id the kernel will give the next MSG_ZEROCOPY send
+	std::deque<Pending> pending;
+
+	unsigned long completed; // Sends completed
+	unsigned long copied; // Sends the kernel completed by copying after all
+};
+
+#endif
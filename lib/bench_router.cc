@@ -0,0 +1,374 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ Microbenchmarks for the router's hot paths (Google Benchmark).
+
+ 	bench-router --benchmark_out=results.json --benchmark_out_format=json
+
+ writes the results as JSON for tracking over time; --benchmark_filter picks benchmarks by name. The network
+ benchmarks open a root and a child NetworkInterface on loopback (ROUTER_BENCH_PORT, default 18080, and the
+ ports after it); bin/bench_crossover.py reads their results and reports the segment size above which
+ zero-copy sends pay off.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <router/queue_source.h>
+#include "queue_source_base.h"
+#include "ReorderBuffer.h"
+#include "ChildSelection.h"
+#include "SegmentChannel.h"
+#include "SegmentBuilder.h"
+#include "NetworkInterface.h"
+
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <vector>
+#include <stdlib.h>
+
+using gr::router::segment_format;
+
+typedef boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > float_queue;
+
+//--------------------------------------------------------------------------------------------------------------------
+// Segment headers
+//--------------------------------------------------------------------------------------------------------------------
+
+// A segment header written (with the segment allocated), as a sink does for each window
+template <typename T>
+static void BM_HeaderEncode(benchmark::State &state){
+	int size = state.range(0);
+	long index = 0;
+	for(auto _ : state){
+		std::vector<T> *segment = segment_format<T>::make(index++, size);
+		benchmark::DoNotOptimize(segment->data());
+		delete segment;
+	}
+}
+BENCHMARK_TEMPLATE(BM_HeaderEncode, float)->Arg(768);
+BENCHMARK_TEMPLATE(BM_HeaderEncode, char)->Arg(3072);
+
+// A segment header checked and read, as a queue source does for each segment
+template <typename T>
+static void BM_HeaderDecode(benchmark::State &state){
+	std::vector<T> *segment = segment_format<T>::make(12345, state.range(0));
+	for(auto _ : state){
+		benchmark::DoNotOptimize(segment_format<T>::is_data(*segment));
+		benchmark::DoNotOptimize(segment_format<T>::index(*segment));
+		benchmark::DoNotOptimize(segment_format<T>::size(*segment));
+		benchmark::DoNotOptimize(segment_format<T>::data_offset(*segment));
+		benchmark::DoNotOptimize(segment_format<T>::sideband_bytes(*segment));
+	}
+	delete segment;
+}
+BENCHMARK_TEMPLATE(BM_HeaderDecode, float)->Arg(768);
+BENCHMARK_TEMPLATE(BM_HeaderDecode, char)->Arg(3072);
+
+//--------------------------------------------------------------------------------------------------------------------
+// Segment construction in the sink (build_segment, which queue_sink_base::build_window calls)
+//--------------------------------------------------------------------------------------------------------------------
+
+// count rx_time tags spread over a window of items
+static std::vector<gr::tag_t> bench_tags(int items, int count){
+	std::vector<gr::tag_t> tags;
+	for(int i = 0; i < count; i++){
+		gr::tag_t tag;
+		tag.offset = (uint64_t)i * items / count;
+		tag.key = pmt::string_to_symbol("rx_time");
+		tag.value = pmt::make_tuple(pmt::from_uint64(1000 + i), pmt::from_double(0.5));
+		tag.srcid = pmt::PMT_F;
+		tags.push_back(tag);
+	}
+	return tags;
+}
+
+// Type-1 segment: header and data copied in
+static void BM_SinkSegment(benchmark::State &state){
+	int items = state.range(0);
+	std::vector<float> data(items, 1.0f), history;
+	std::vector<gr::tag_t> tags;
+	std::vector<char> sideband;
+	float index = 0;
+	for(auto _ : state){
+		std::vector<float> *segment = build_segment(index++, &data[0], items, 0, tags, history, sideband);
+		benchmark::DoNotOptimize(segment->data());
+		delete segment;
+	}
+	state.SetBytesProcessed(state.iterations() * items * sizeof(float));
+}
+BENCHMARK(BM_SinkSegment)->RangeMultiplier(4)->Range(256, 65536);
+
+// Type-4 segment: the same, plus a side-band carrying state.range(1) tags
+static void BM_SinkSegmentTagged(benchmark::State &state){
+	int items = state.range(0);
+	std::vector<float> data(items, 1.0f), history;
+	std::vector<gr::tag_t> tags = bench_tags(items, state.range(1));
+	std::vector<char> sideband;
+	float index = 0;
+	for(auto _ : state){
+		std::vector<float> *segment = build_segment(index++, &data[0], items, 0, tags, history, sideband);
+		benchmark::DoNotOptimize(segment->data());
+		delete segment;
+	}
+	state.SetBytesProcessed(state.iterations() * items * sizeof(float));
+}
+BENCHMARK(BM_SinkSegmentTagged)->Args({768, 1})->Args({768, 8})->Args({65536, 8});
+
+// Type-4 segment led by state.range(1) items of overlap history (and the overlap tag), with no other tags
+static void BM_SinkSegmentOverlap(benchmark::State &state){
+	int items = state.range(0);
+	std::vector<float> data(items, 1.0f), history(state.range(1), 0.5f);
+	std::vector<gr::tag_t> tags;
+	std::vector<char> sideband;
+	float index = 0;
+	for(auto _ : state){
+		std::vector<float> *segment = build_segment(index++, &data[0], items, history.size(), tags, history, sideband);
+		benchmark::DoNotOptimize(segment->data());
+		delete segment;
+	}
+	state.SetBytesProcessed(state.iterations() * (items + history.size()) * sizeof(float));
+}
+BENCHMARK(BM_SinkSegmentOverlap)->Args({768, 64})->Args({768, 768})->Args({65536, 1024});
+
+//--------------------------------------------------------------------------------------------------------------------
+// Shared segment queues
+//--------------------------------------------------------------------------------------------------------------------
+
+// Every thread pushes and pops the same queue, with the channel's counting and wakeups
+static void BM_QueueContention(benchmark::State &state){
+	static float_queue queue(1024);
+	SegmentChannel *channel = SegmentChannel::get(&queue);
+	std::vector<float> segment(3, 0);
+
+	for(auto _ : state){
+		while(!channel->try_push(queue, &segment));
+
+		std::vector<float> *popped;
+		while(!queue.pop(popped));
+		channel->notify_pop();
+		benchmark::DoNotOptimize(popped);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_QueueContention)->ThreadRange(1, 8)->UseRealTime();
+
+// One sink thread hands segments to one consumer that sleeps on the channel when the queue runs dry
+static void BM_QueueHandoff(benchmark::State &state){
+	float_queue queue(state.range(0));
+	SegmentChannel *channel = SegmentChannel::get(&queue);
+	std::vector<float> segment(3, 0);
+	volatile bool done = false;
+
+	boost::thread consumer([&]{
+		std::vector<float> *popped;
+		while(!done){
+			unsigned ticket = channel->prepare();
+			if(queue.pop(popped)){
+				channel->notify_pop();
+				continue;
+			}
+			channel->wait(ticket, 1000);
+		}
+		while(queue.pop(popped))
+			channel->notify_pop();
+	});
+
+	for(auto _ : state)
+		channel->push(queue, &segment);
+
+	done = true;
+	channel->notify();
+	consumer.join();
+	SegmentChannel::release(channel); // The next run's queue may land at the same address
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_QueueHandoff)->Arg(16)->Arg(1024)->UseRealTime();
+
+//--------------------------------------------------------------------------------------------------------------------
+// Reordering (queue_source with order=true)
+//--------------------------------------------------------------------------------------------------------------------
+
+// Segments arriving shuffled within runs of state.range(0) indexes, filed and drained in order
+static void BM_ReorderInsertDrain(benchmark::State &state){
+	int spread = state.range(0);
+	const int run = 4096;
+
+	std::vector<long> arrivals(run);
+	for(int i = 0; i < run; i++)
+		arrivals[i] = i;
+	srand(1);
+	for(int i = 0; i < run; i += spread)
+		std::random_shuffle(arrivals.begin() + i, arrivals.begin() + std::min(i + spread, run));
+
+	ReorderBuffer<int> reorder(1024);
+	long base = 0;
+	for(auto _ : state){
+		for(int i = 0; i < run; i++){
+			reorder.insert(base + arrivals[i], 1);
+			while(reorder.ready())
+				benchmark::DoNotOptimize(reorder.pop());
+		}
+		base += run;
+	}
+	state.SetItemsProcessed(state.iterations() * run);
+}
+BENCHMARK(BM_ReorderInsertDrain)->Arg(1)->Arg(16)->Arg(256);
+
+//--------------------------------------------------------------------------------------------------------------------
+// Child selection (root)
+//--------------------------------------------------------------------------------------------------------------------
+
+// Outbound queues as NetworkInterface reports them, without the sockets
+struct bench_queues{
+	std::vector<unsigned long> bytes;
+	std::vector<char> full;
+
+	bool queue_full(int child){ return full[child]; }
+	unsigned long queued_bytes(int child){ return bytes[child]; }
+};
+
+static void BM_ChildSelection(benchmark::State &state){
+	int children = state.range(0);
+
+	std::vector<float> weights(children);
+	bench_queues queues;
+	queues.bytes.resize(children);
+	queues.full.resize(children);
+	srand(1);
+	for(int i = 0; i < children; i++){
+		weights[i] = rand() % 64;
+		queues.bytes[i] = (rand() % 8) * 3072;
+		queues.full[i] = (rand() % 8 == 0);
+	}
+
+	for(auto _ : state){
+		// As the root does: pick a child, then charge it the segment
+		int child = least_loaded(&weights[0], children, queues, 3072.0f);
+		weights[child] += 1;
+		benchmark::DoNotOptimize(child);
+	}
+}
+BENCHMARK(BM_ChildSelection)->RangeMultiplier(2)->Range(1, 64);
+
+//--------------------------------------------------------------------------------------------------------------------
+// NetworkInterface
+//--------------------------------------------------------------------------------------------------------------------
+
+static int next_port(){
+	static int port = getenv("ROUTER_BENCH_PORT") ? atoi(getenv("ROUTER_BENCH_PORT")) : 18080;
+	return port++;
+}
+
+/*
+ A root with one child, connected over loopback. The child either counts what arrives (stream) or sends it
+ straight back (echo). Deleting the connector ends the process, so a link stays up for the whole run and each
+ benchmark reuses its own.
+ */
+struct bench_link{
+	bench_link(const TransportOptions &options, bool echo) : received(0){
+		int port = next_port();
+		root = new NetworkInterface(sizeof(char), 1, port, true, options);
+		child = new NetworkInterface(sizeof(char), 0, port, false, options);
+
+		// The root listens from inside connect(); a child that dials first backs off for a second
+		boost::thread accept(boost::bind(&NetworkInterface::connect, root, (char *)NULL, 0));
+		boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+		char host[] = "127.0.0.1";
+		child->connect(host, 0);
+		accept.join();
+
+		boost::thread reader(boost::bind(echo ? &bench_link::echo : &bench_link::count, this));
+		reader.detach();
+	}
+
+	void count(){
+		std::vector<char> buffer(1 << 20);
+		int n;
+		while((n = child->receive(-1, &buffer[0], buffer.size())) > 0)
+			__sync_fetch_and_add(&received, n);
+	}
+
+	void echo(){
+		std::vector<char> buffer(1 << 20);
+		int n;
+		while((n = child->receive(-1, &buffer[0], buffer.size())) > 0)
+			child->send(-1, &buffer[0], n);
+	}
+
+	NetworkInterface *root, *child;
+	volatile long received;
+};
+
+// Segments streamed from the root to a child through send_async(); state.range(1) turns on zero-copy sends
+static void BM_NetworkStream(benchmark::State &state){
+	int size = state.range(0);
+
+	static bench_link *links[2] = { NULL, NULL };
+	bench_link *&link = links[state.range(1)];
+	if(link == NULL){
+		TransportOptions options;
+		options.zerocopy_send = state.range(1);
+		link = new bench_link(options, false);
+	}
+
+	long sent = 0, start = link->received;
+	for(auto _ : state){
+		link->root->send_async(0, new char[size], size);
+		sent += size;
+	}
+
+	// The run lasts until the last byte is in
+	while(link->received - start < sent)
+		boost::this_thread::yield();
+
+	state.SetBytesProcessed(sent);
+	state.counters["zerocopy"] = state.range(1);
+}
+BENCHMARK(BM_NetworkStream)->ArgsProduct({benchmark::CreateRange(4096, 1 << 20, 4), {0, 1}})->UseRealTime();
+
+// One segment to the child and back through send() and receive()
+static void BM_NetworkRoundTrip(benchmark::State &state){
+	int size = state.range(0);
+
+	static bench_link *link = new bench_link(TransportOptions(), true);
+	std::vector<char> out(size), in(size);
+
+	for(auto _ : state){
+		link->root->send(0, &out[0], size);
+		int got = 0;
+		while(got < size){
+			int n = link->root->receive(0, &in[got], size - got);
+			if(n <= 0){
+				state.SkipWithError("connection to the child lost");
+				break;
+			}
+			got += n;
+		}
+		if(got < size)
+			break;
+	}
+
+	state.SetBytesProcessed(state.iterations() * size * 2);
+}
+BENCHMARK(BM_NetworkRoundTrip)->Arg(64)->Arg(3084)->Arg(65536)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -31,8 +31,6 @@
 #include <gnuradio/io_signature.h>
 #include "child_impl.h"
 
-#define VERBOSE     false
-
 namespace gr {
  	namespace router {
         
@@ -45,13 +43,14 @@ namespace gr {
          *  @param &input_queue A pointer to the input lockfree queue, where segments sent from the parent will be pushed.
          *  @param &output_queue A pointer to the output lockfree queue, where completed segments will be pulled from to send to the parent.
          *  @param throughput The maximum rate at which the child router will pull from the output queue. (Not currently being used)
+         *  @param transport "tcp", "udp" or "uring", matching the root; empty to take ROUTER_TRANSPORT from the environment.
          *  @return A shared pointer to the child router block.
          */
         
         child::sptr
- 		child::make(int number_of_children, int child_index, char * hostname, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &input_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &output_queue, double throughput)
+ 		child::make(int number_of_children, int child_index, char * hostname, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &input_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &output_queue, double throughput, const std::string &transport)
  		{
- 			return gnuradio::get_initial_sptr (new child_impl(number_of_children, child_index, hostname, input_queue, output_queue, throughput));
+ 			return gnuradio::get_initial_sptr (new child_impl(number_of_children, child_index, hostname, input_queue, output_queue, throughput, transport));
  		}
         
         /*!
@@ -63,35 +62,40 @@ namespace gr {
          *  @param &input_queue A pointer to the input lockfree queue, where segments sent from the parent will be pushed.
          *  @param &output_queue A pointer to the output lockfree queue, where completed segments will be pulled from to send to the parent.
          *  @param throughput The maximum rate at which the child router will pull from the output queue. (Not currently being used)
+         *  @param transport "tcp", "udp" or "uring", matching the root; empty to take ROUTER_TRANSPORT from the environment.
          */
         
-        child_impl::child_impl( int numberofchildren, int index, char * hostname, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &input_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &output_queue, double throughput)
+        child_impl::child_impl( int numberofchildren, int index, char * hostname, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &input_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &output_queue, double throughput, const std::string &transport)
         : gr::sync_block("child",
                          gr::io_signature::make(0, 0, 0),
-                         gr::io_signature::make(0, 0, 0)), in_queue(&input_queue), out_queue(&output_queue), child_index(index), global_counter(0), parent_hostname(hostname), number_of_children(numberofchildren), d_finished(false), d_throughput(throughput)
+                         gr::io_signature::make(0, 0, 0)), in_queue(&input_queue), out_queue(&output_queue), in_channel(SegmentChannel::get(&input_queue)), out_channel(SegmentChannel::get(&output_queue)), child_index(index), global_counter(0), parent_hostname(hostname), number_of_children(numberofchildren), d_finished(false), parent_down(false), d_throughput(throughput)
         {
             
-            
-            if(VERBOSE)
-                myfile.open("child_router.data");
-            
             // Connect to <hostname>
-            if(VERBOSE)
-                myfile << "Attempting to connect to parent\n";
+            ROUTER_LOG(LOG_INFO, "child %d: connecting to parent", index);
             
-            connector = new NetworkInterface(sizeof(char), 0, 8080, false);
+            TransportOptions options = TransportOptions::from_environment();
+            if(!transport.empty() && !options.set_transport(transport.c_str()))
+                ROUTER_LOG(LOG_ERROR, "child %d: unknown transport %s; using tcp", index, transport.c_str());
+            connector = new NetworkInterface(sizeof(char), 0, 8080, false, options);
             
-            // Interconnect all blocks (hostname of Root)
-            connector->connect(hostname);
+            // Interconnect all blocks (hostname of Root); our index is declared in the hello frame
+            connector->connect(hostname, child_index);
             
-            if(VERBOSE){
-                myfile << "Connected to parent\n";
-                std::cout << "\tChild Router Finished connecting to hostname=" << hostname << std::endl;
-            }
+            ROUTER_LOG(LOG_INFO, "child %d: connected to parent", index);
             
 		    // Weights table to keep track of the 'business' of child nodes
 		    weights = new float[number_of_children];
             
+            char labels[32];
+            sprintf(labels, "child=\"%d\"", child_index);
+            
+            segments_received = MetricsRegistry::get()->counter("router_child_segments_received_total", "Segments the child received from the root", labels);
+            bytes_received = MetricsRegistry::get()->counter("router_child_bytes_received_total", "Bytes the child received from the root", labels);
+            segments_sent = MetricsRegistry::get()->counter("router_child_segments_sent_total", "Segments the child sent to the root", labels);
+            bytes_sent = MetricsRegistry::get()->counter("router_child_bytes_sent_total", "Bytes the child sent to the root", labels);
+            weight_reported = MetricsRegistry::get()->gauge("router_child_weight", "Weight the child last reported to the root", labels);
+            
 		    // Create a thread per child for listeners (future work)
 		    //for(int i = 0; i < number_of_children; i++){
 		    //	thread_vector.append(boost::shared_ptr<boost::thread>(new Boost::thread(boost::bind(&child_impl::run, this))));
@@ -103,10 +107,7 @@ namespace gr {
 		    // Create single thread for receiving messages from root
 		    d_thread_receive_root = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&child_impl::receive_root, this)));
             
-            if(VERBOSE){
-                myfile << "Calling Child Router Constructor v.2\n";
-                myfile << "Arguments: number of children=" << numberofchildren << " index=" << index << " hostname= " << hostname << "\n\n" << std::flush;
-            }
+            ROUTER_LOG(LOG_DEBUG, "child %d: constructed with %d children", index, numberofchildren);
         }
         
         /**
@@ -118,11 +119,7 @@ namespace gr {
         child_impl::~child_impl()
         {
             
-            if(VERBOSE){
-                std::cout << "Calling Child Router " << child_index << "'s destructor!" << std::endl;
-                myfile << "Calling Child Router Destructor\n";
-                myfile << std::flush;
-            }
+            ROUTER_LOG(LOG_DEBUG, "child %d: destructor", child_index);
             
      	    d_finished = true;
             
@@ -135,6 +132,9 @@ namespace gr {
      	    d_thread_receive_root->join();
             
             delete connector;
+            
+            SegmentChannel::release(in_channel);
+            SegmentChannel::release(out_channel);
         }
         
         /**
@@ -159,22 +159,13 @@ namespace gr {
         void child_impl::receive_root(){
             
             char * temp_header_bytes = new char[3*sizeof(float)]; // Grab the first three header values
-            char * temp_buffer;
-     	    float * buffer;
             std::vector<float> *arrival;
-            int size;
             
-     	    while(!d_finished){
+     	    while(!d_finished && !parent_down){
                 
                 // Calling the blocking receive; receive array of bytes
-                size = 0;
-                while(size < (3*sizeof(float))){
-                    size += connector->receive(-1, &(temp_header_bytes[0]), (3*sizeof(float)-size));
-                    if(size == 0 && d_finished){
-                        delete[] temp_header_bytes;
-                        continue;
-                    }
-                }
+                if(!receive_parent(temp_header_bytes, 3*sizeof(float)))
+                    break;
                 
                 float packet_type; // The message type of the current segment
                 memcpy(&packet_type, &(temp_header_bytes[0]), 4);
@@ -185,35 +176,88 @@ namespace gr {
                 float data_size; // size in floats
                 memcpy(&data_size, &(temp_header_bytes[8]), 4);
                 
+                if((int)packet_type != 3)
+                    SegmentTrace::record(TRACE_CHILD_RECEIVE, (long)index);
+                
+                // A size we cannot trust leaves us nowhere to find the next header; stop reading from the parent
+                if(!wire_size_ok(data_size, sizeof(float))){
+                    ROUTER_LOG(LOG_ERROR, "child %d: parent sent a segment of %g floats", child_index, data_size);
+                    mark_parent_down();
+                    break;
+                }
+                
                 // Switch on packet type and parse messages; only type 1 is current supported
                 switch((int)packet_type){
                     case 1:
-                        temp_buffer = new char[(int)data_size*sizeof(float)];
-                        buffer = new float[(int)data_size];
-                        size = 0;
+                    {
+                        // Rebuild the float vector and receive the data straight into it, behind the header
+                        arrival = new std::vector<float>((int)data_size + 3);
+                        (*arrival)[0] = packet_type;
+                        (*arrival)[1] = index;
+                        (*arrival)[2] = data_size;
                         
                         // Wait for the rest of the message bytes
-                        while(size < ((int)data_size*sizeof(float)))
-                            size += connector->receive(-1, &(temp_buffer[size]), ((int)data_size*sizeof(float)-size)); // Receive the rest of the segment
+                        if(!receive_parent((char *)&((*arrival)[3]), (int)data_size*sizeof(float))){
+                            delete arrival;
+                            break;
+                        }
                         
-                        memcpy(&buffer[0], &temp_buffer[0], (int)data_size*sizeof(float));
+                        ROUTER_PROBE3(receive, (long)index, -1, (3 + (int)data_size) * sizeof(float));
                         
-                        // Rebuild float vectors and push those into the input queue
-                        arrival = new std::vector<float>();
-                        arrival->push_back(packet_type);
-                        arrival->push_back(index);
-                        arrival->push_back(data_size);
-                        arrival->insert(arrival->end(), &buffer[0], &buffer[(int)data_size]);
+                        // Push the segment (waiting for room if the queue is full) and wake the queue source
+                        in_channel->push(*in_queue, arrival);
+                        SegmentTrace::record(TRACE_CHILD_PUSH, (long)index);
+                        ROUTER_PROBE3(queue_push, in_channel->id(), (long)index, in_channel->occupancy());
                         
-                        // Keep attempting to push the segment until successful (may want to make this more efficient)
-                        while(!in_queue->push(arrival))
-                            ;
+                        segments_received->add();
+                        bytes_received->add((3 + (int)data_size) * sizeof(float));
                         
                         // Keep incrementing the number of segments being used (change this)
                         for(int i = 0; i < (data_size/1024); i++)
                             increment();
                         
                         break;
+                    }
+                    case 4:
+                    {
+                        // Type 1 with a tag side-band: one more header value (the side-band size in floats), then data and side-band
+                        float tag_floats;
+                        if(!receive_parent((char *)&tag_floats, sizeof(float)))
+                            break;
+                        
+                        if(!wire_size_ok(tag_floats, sizeof(float)) || !wire_size_ok(data_size + tag_floats, sizeof(float))){
+                            ROUTER_LOG(LOG_ERROR, "child %d: parent sent a side-band of %g floats", child_index, tag_floats);
+                            mark_parent_down();
+                            break;
+                        }
+                        
+                        int body_size = ((int)data_size + (int)tag_floats) * sizeof(float);
+                        
+                        arrival = new std::vector<float>((int)data_size + (int)tag_floats + 4);
+                        (*arrival)[0] = packet_type;
+                        (*arrival)[1] = index;
+                        (*arrival)[2] = data_size;
+                        (*arrival)[3] = tag_floats;
+                        
+                        if(!receive_parent((char *)&((*arrival)[4]), body_size)){ // Receive the rest of the segment
+                            delete arrival;
+                            break;
+                        }
+                        
+                        ROUTER_PROBE3(receive, (long)index, -1, 4 * sizeof(float) + body_size);
+                        
+                        in_channel->push(*in_queue, arrival);
+                        SegmentTrace::record(TRACE_CHILD_PUSH, (long)index);
+                        ROUTER_PROBE3(queue_push, in_channel->id(), (long)index, in_channel->occupancy());
+                        
+                        segments_received->add();
+                        bytes_received->add(4 * sizeof(float) + body_size);
+                        
+                        for(int i = 0; i < (data_size/1024); i++)
+                            increment();
+                        
+                        break;
+                    }
                     case 2:
                         std::cout << "ERROR: Right now we're not supporting this format" << std::endl;
                         break;
@@ -221,12 +265,11 @@ namespace gr {
                         arrival = new std::vector<float>();
                         arrival->push_back(3);
                         
-                        while(!in_queue->push(arrival))
-                            ;
+                        in_channel->push(*in_queue, arrival);
                         
                         break;
                     default:
-                        myfile << "ERROR: Got a message of unexpected type" << std::endl;
+                        ROUTER_LOG(LOG_ERROR, "child %d: got a message of unexpected type %d", child_index, (int)packet_type);
                         
                 }
             }
@@ -235,6 +278,66 @@ namespace gr {
             
         }
         
+        /*!
+         *	Read exactly size bytes from the parent. A read that fails (NetworkInterface::receive() gives -1 for a closed
+         *  connection and for errors alike) marks the parent down, which ends both of its threads.
+         *
+         *  @param buffer Where the bytes go.
+         *  @param size The number of bytes to read.
+         *  @return True once all size bytes are in; False if the connection is gone.
+         */
+        
+        bool child_impl::receive_parent(char *buffer, int size){
+            
+            int got = 0;
+            while(got < size){
+                int received = connector->receive(-1, &buffer[got], size - got);
+                if(received <= 0){
+                    if(!d_finished)
+                        mark_parent_down();
+                    return false;
+                }
+                got += received;
+            }
+            return true;
+        }
+        
+        /*!
+         *	Write all size bytes to the parent; a write that fails marks the parent down.
+         *
+         *  @param buffer The bytes.
+         *  @param size The number of bytes to write.
+         *  @return True once all size bytes are out; False if the connection is gone.
+         */
+        
+        bool child_impl::send_parent(char *buffer, int size){
+            
+            int sent = 0;
+            while(sent < size){
+                int written = connector->send(-1, &buffer[sent], size - sent);
+                if(written <= 0){
+                    if(!d_finished)
+                        mark_parent_down();
+                    return false;
+                }
+                sent += written;
+            }
+            return true;
+        }
+        
+        /*!
+         *	Give up on the parent once its connection is gone or its stream cannot be parsed. Logged only the first time.
+         */
+        
+        void child_impl::mark_parent_down(){
+            
+            if(parent_down)
+                return;
+            
+            parent_down = true;
+            ROUTER_LOG(LOG_ERROR, "child %d: lost the connection to the parent", child_index);
+        }
+        
         
         /**
          * The send_root thread function grabs segments from the output queue, appends a weight (business) and sends the message to the child's parent.
@@ -243,10 +346,10 @@ namespace gr {
         void child_impl::send_root(){
             
             std::vector<char> *temp; // Pointer to current vector of bytes to be sent
-            int sent = 0;
+            bool corked = false; // True while a batch of segments is being written back to back
             
             // Until the thread is killed, keep sending
-     	    while(!d_finished){
+     	    while(!d_finished && !parent_down){
                 
                 
                 // This is an internal throttle; it is not being used yet.
@@ -263,9 +366,13 @@ namespace gr {
                 //----------
                 
                 
+                unsigned ticket = out_channel->prepare(); // Any push from here on ends the wait below
+                
                 // If there is a segment in the output queue, pop it and send it
                 if(out_queue->pop(temp)){
                     
+                    out_channel->notify_pop(); // Room for a waiting queue sink
+                    
                     char packet_type = temp->at(0); // Get the packet type
                     
                     float index; // Get the packet index
@@ -274,35 +381,58 @@ namespace gr {
                     float data_size; // Get the packet data_size
                     memcpy(&data_size, &(temp->at(5)), 4);
                     
+                    if(packet_type != '3'){
+                        SegmentTrace::record(TRACE_CHILD_POP, (long)index);
+                        ROUTER_PROBE3(queue_pop, out_channel->id(), (long)index, out_channel->occupancy());
+                    }
+                    
                     float num_windows = data_size / 50;
                     float packet_size = data_size + 1 + 2 * sizeof(float);
                     
                     //Switch on the packet_type
                     switch(packet_type){
                         case '2':
+                        case '5': // Type 2 with a tag side-band
                         {
                             
                             d_total_samples += data_size;
                             
-                            // Shove on a weight value, and make it a type-2 message
+                            // Shove on a weight value, and make it a type-3 message (type-6 if it carries tags)
                             
                             int weight = get_weight(); // Grab the current weight of the child
                             
-                            char* weight_bytes = new char[4];
-                            memcpy(weight_bytes, &weight, 4);
+                            char* weight_bytes = (char *)&weight;
                             
                             temp->insert(temp->end(), &(weight_bytes[0]), &(weight_bytes[4]));
-                            temp->at(0) = '3'; // Change to type 3 message
+                            temp->at(0) = (packet_type == '2') ? '3' : '6'; // Change to type 3 (or 6) message
                             
-                            packet_size += 4; // Increment the packet size; we're adding a weight
+                            packet_size = temp->size(); // Headers, data, side-band and the weight we just added
                             
-                            sent = 0;
-                            while(sent < packet_size)
-                                sent += connector->send(-1, &((temp->data())[sent]), (packet_size-sent)); // *4
+                            if(!corked){
+                                connector->begin_batch(-1);
+                                corked = true;
+                            }
+                            
+                            if(!send_parent(temp->data(), (int)packet_size)){
+                                delete temp;
+                                break;
+                            }
+                            SegmentTrace::record(TRACE_CHILD_SEND, (long)index);
+                            ROUTER_PROBE3(send, (long)index, -1, (int)packet_size);
+                            
+                            // Flush once there is nothing left to batch with this segment
+                            if(out_queue->empty()){
+                                connector->end_batch(-1);
+                                corked = false;
+                            }
                             
                             for(int i = 0; i < num_windows; i++)
                                 decrement();
                             
+                            segments_sent->add();
+                            bytes_sent->add(packet_size);
+                            weight_reported->set(weight);
+                            
                             delete temp;
                             break;
                         }
@@ -316,14 +446,11 @@ namespace gr {
                         }
                         case '3': // Got a kill message
                         {
-                            if(VERBOSE)
-                                myfile << "Got a kill message \n" << std::flush;
+                            ROUTER_LOG(LOG_INFO, "child %d: got a kill message", child_index);
                             
                             packet_size = 1;
                             
-                            sent = 0;
-                            while(sent < packet_size)
-                                sent += connector->send(-1, (char*)&((temp->data())[sent]), (packet_size-sent));
+                            send_parent(temp->data(), (int)packet_size);
                             
                             d_finished = true;
                             return;
@@ -338,8 +465,8 @@ namespace gr {
                     }
                 }
                 else{
-                    boost::this_thread::sleep(boost::posix_time::microseconds(1000));
-                    
+                    // Until the queue sink pushes (the timeout lets the loop see d_finished)
+                    out_channel->wait(ticket, 1000);
                 }
      	    }
         }
@@ -22,6 +22,11 @@
 #define INCLUDED_ROUTER_CHILD_IMPL_H
 
 #include "NetworkInterface.h"
+#include "SegmentChannel.h"
+#include "MetricsRegistry.h"
+#include "SegmentTrace.h"
+#include "RouterProbes.h"
+#include "AsyncLog.h"
 #include <router/child.h>
 #include <memory>
 #include <boost/lockfree/queue.hpp>
@@ -44,7 +49,6 @@ namespace gr {
 			//----------
             
             
-            std::ofstream myfile; // Output file stream for debugging
             
             int master_thread_index;
             boost::mutex index_lock;
@@ -53,14 +57,15 @@ namespace gr {
             
             int number_of_children;
             bool d_finished;
+            volatile bool parent_down; // The parent's connection is gone (or its stream unreadable); both threads stop
             char * parent_hostname;
             
-            // Queues used to read from and write to
+            // Queues used to read from and write to; the channels keep their counts
             boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > *in_queue;
-            float in_queue_counter;
-            
             boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > *out_queue;
-            float out_queue_counter;
+            
+            SegmentChannel *in_channel; // Wakeups for in_queue (popped by the queue source)
+            SegmentChannel *out_channel; // Wakeups for out_queue (pushed by the queue sink)
             
             int global_counter;
             boost::mutex global_lock;
@@ -77,9 +82,17 @@ namespace gr {
             // Connector used for networking between nodes
             NetworkInterface *connector;
             
+            // Metrics
+            MetricCounter *segments_received, *bytes_received;
+            MetricCounter *segments_sent, *bytes_sent;
+            MetricGauge *weight_reported;
+            
             // Thread programs
             void receive_root(); // Receive messages from root
             void send_root(); // Send messages to root
+            bool receive_parent(char *buffer, int size); // Read exactly size bytes; False (parent down) if the connection is gone
+            bool send_parent(char *buffer, int size); // Write all size bytes; False (parent down) if the connection is gone
+            void mark_parent_down();
             
             // This is not implemented yet
             void receive_child(int index);
@@ -96,7 +109,7 @@ namespace gr {
             int get_weight();
             
         public:
-            child_impl(int number_of_children, int child_index, char* hostname, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &out_queue, double throughput);
+            child_impl(int number_of_children, int child_index, char* hostname, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &out_queue, double throughput, const std::string &transport);
             ~child_impl();
             
             // Where all the action really happens
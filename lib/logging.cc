@@ -0,0 +1,56 @@
+/* -*- c++ -*- */
+/* 
+ * Copyright 2013 <+YOU OR YOUR COMPANY+>.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <router/logging.h>
+#include "AsyncLog.h"
+
+namespace gr {
+  namespace router {
+
+    bool
+    logging::set_level(const std::string &level)
+    {
+      return AsyncLog::set_level(level);
+    }
+
+    bool
+    logging::set_file(const std::string &path)
+    {
+      return AsyncLog::set_file(path);
+    }
+
+    void
+    logging::flush()
+    {
+      AsyncLog::flush();
+    }
+
+    unsigned long
+    logging::dropped()
+    {
+      return AsyncLog::dropped();
+    }
+
+  } /* namespace router */
+} /* namespace gr */
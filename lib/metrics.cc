@@ -0,0 +1,44 @@
+/* -*- c++ -*- */
+/* 
+ * Copyright 2013 <+YOU OR YOUR COMPANY+>.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <router/metrics.h>
+#include "MetricsRegistry.h"
+
+namespace gr {
+  namespace router {
+
+    std::string
+    metrics::text()
+    {
+      return MetricsRegistry::get()->render();
+    }
+
+    bool
+    metrics::serve(int port)
+    {
+      return MetricsRegistry::get()->serve(port);
+    }
+
+  } /* namespace router */
+} /* namespace gr */
@@ -0,0 +1,249 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "qa_queue_source.h"
+#include "SegmentChannel.h"
+#include "SegmentBuilder.h"
+#include <router/queue_source.h>
+
+#include <gnuradio/top_block.h>
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <boost/thread.hpp>
+
+namespace gr {
+  namespace router {
+
+    typedef boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > float_queue;
+
+    // Keeps everything streamed into it, and the tags on it
+    class capture_sink : public gr::sync_block
+    {
+    public:
+      typedef boost::shared_ptr<capture_sink> sptr;
+
+      std::vector<float> data;
+      std::vector<gr::tag_t> tags;
+
+      capture_sink()
+      : gr::sync_block("capture_sink",
+                       gr::io_signature::make(1, 1, sizeof(float)),
+                       gr::io_signature::make(0, 0, 0))
+      {
+      }
+
+      int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items)
+      {
+        const float *in = (const float *) input_items[0];
+        data.insert(data.end(), &in[0], &in[noutput_items]);
+        get_tags_in_range(tags, 0, nitems_read(0), nitems_read(0) + noutput_items);
+        return noutput_items;
+      }
+    };
+
+    // A type-1 segment of 4 items: index * 10 + 1, ... + 4
+    static std::vector<float> *
+    make_segment(long index)
+    {
+      std::vector<float> *segment = segment_format<float>::make(index, 4);
+      for(int i = 0; i < 4; i++)
+        (*segment)[3 + i] = index * 10 + i + 1;
+      return segment;
+    }
+
+    static void
+    push_kill(float_queue &queue, SegmentChannel *channel)
+    {
+      channel->push(queue, new std::vector<float>(1, 3));
+    }
+
+    // The tags with this key
+    static std::vector<gr::tag_t>
+    tags_named(const std::vector<gr::tag_t> &tags, const char *key)
+    {
+      std::vector<gr::tag_t> named;
+      for(size_t i = 0; i < tags.size(); i++)
+        if(pmt::eqv(tags[i].key, pmt::string_to_symbol(key)))
+          named.push_back(tags[i]);
+      return named;
+    }
+
+    /*
+     Stream segments 0 and 2 through an ordered source with a 5 ms gap deadline; 1 turns up long after the deadline,
+     followed by 3 and the kill. Returns what came out.
+     */
+    static capture_sink::sptr
+    run_gap(bool repeat, queue_source::sptr &source)
+    {
+      float_queue queue(16);
+      SegmentChannel *channel = SegmentChannel::get(&queue);
+
+      source = queue_source::make(sizeof(float), queue, false, true);
+      source->set_gap_deadline(5000);
+      source->set_gap_repeat(repeat);
+      capture_sink::sptr sink = gnuradio::get_initial_sptr(new capture_sink());
+
+      gr::top_block_sptr tb = gr::make_top_block("qa_queue_source");
+      tb->connect(source, 0, sink, 0);
+      tb->start();
+
+      channel->push(queue, make_segment(0));
+      channel->push(queue, make_segment(2));
+      boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+
+      channel->push(queue, make_segment(1)); // Late: its index was filled in long ago
+      channel->push(queue, make_segment(3));
+      push_kill(queue, channel);
+      tb->wait();
+
+      SegmentChannel::release(channel);
+      return sink;
+    }
+
+    /*
+     Stream a ramp of 40 items cut as a queue sink with window_size 8 and overlap 3 cuts it (build_segment()), with
+     a "burst" tag on item 14: in segment 1's data and segment 2's overlap. Returns what came out.
+     */
+    static capture_sink::sptr
+    run_overlap(bool trim, queue_source::sptr &source)
+    {
+      float_queue queue(16);
+      SegmentChannel *channel = SegmentChannel::get(&queue);
+
+      source = queue_source::make(sizeof(float), queue, false, true);
+      source->set_trim_overlap(trim);
+      capture_sink::sptr sink = gnuradio::get_initial_sptr(new capture_sink());
+
+      std::vector<float> ramp(40);
+      for(int i = 0; i < 40; i++)
+        ramp[i] = i;
+
+      gr::tag_t burst;
+      burst.offset = 14;
+      burst.key = pmt::string_to_symbol("burst");
+      burst.value = pmt::from_long(7);
+      burst.srcid = pmt::PMT_F;
+
+      std::vector<float> history;
+      std::vector<char> sideband;
+      for(int first = 0; first < 40; first += 8){
+        std::vector<gr::tag_t> tags;
+        if(burst.offset >= (uint64_t)first && burst.offset < (uint64_t)first + 8)
+          tags.push_back(burst);
+
+        channel->push(queue, build_segment(first / 8, &ramp[first], 8, first, tags, history, sideband));
+        history.assign(&ramp[first + 5], &ramp[first + 8]);
+      }
+      push_kill(queue, channel);
+
+      gr::top_block_sptr tb = gr::make_top_block("qa_queue_source");
+      tb->connect(source, 0, sink, 0);
+      tb->run();
+
+      SegmentChannel::release(channel);
+      return sink;
+    }
+
+    void
+    qa_queue_source::t_gap_zeros()
+    {
+      queue_source::sptr source;
+      capture_sink::sptr sink = run_gap(false, source);
+
+      const float expected[] = {1, 2, 3, 4, 0, 0, 0, 0, 21, 22, 23, 24, 31, 32, 33, 34};
+      CPPUNIT_ASSERT(sink->data == std::vector<float>(expected, expected + 16));
+
+      std::vector<gr::tag_t> gaps = tags_named(sink->tags, "gap");
+      CPPUNIT_ASSERT_EQUAL((size_t)1, gaps.size());
+      CPPUNIT_ASSERT_EQUAL((uint64_t)4, gaps[0].offset);
+      CPPUNIT_ASSERT_EQUAL(1L, pmt::to_long(gaps[0].value));
+
+      CPPUNIT_ASSERT_EQUAL(1UL, source->gaps_filled());
+      CPPUNIT_ASSERT_EQUAL(1UL, source->late_segments());
+      CPPUNIT_ASSERT(source->reorder_latency_max() >= 5000);
+    }
+
+    void
+    qa_queue_source::t_gap_repeat()
+    {
+      queue_source::sptr source;
+      capture_sink::sptr sink = run_gap(true, source);
+
+      // The filler repeats segment 0
+      const float expected[] = {1, 2, 3, 4, 1, 2, 3, 4, 21, 22, 23, 24, 31, 32, 33, 34};
+      CPPUNIT_ASSERT(sink->data == std::vector<float>(expected, expected + 16));
+
+      std::vector<gr::tag_t> gaps = tags_named(sink->tags, "gap");
+      CPPUNIT_ASSERT_EQUAL((size_t)1, gaps.size());
+      CPPUNIT_ASSERT_EQUAL((uint64_t)4, gaps[0].offset);
+
+      CPPUNIT_ASSERT_EQUAL(1UL, source->gaps_filled());
+      CPPUNIT_ASSERT_EQUAL(1UL, source->late_segments());
+    }
+
+    void
+    qa_queue_source::t_trim_overlap()
+    {
+      queue_source::sptr source;
+      capture_sink::sptr sink = run_overlap(true, source);
+
+      // The ramp again, as it went into the sink
+      CPPUNIT_ASSERT_EQUAL((size_t)40, sink->data.size());
+      for(int i = 0; i < 40; i++)
+        CPPUNIT_ASSERT_EQUAL((float)i, sink->data[i]);
+
+      // Overlap tags go with the items they mark; the burst tag is back on its item, once
+      CPPUNIT_ASSERT(tags_named(sink->tags, "overlap").empty());
+      std::vector<gr::tag_t> bursts = tags_named(sink->tags, "burst");
+      CPPUNIT_ASSERT_EQUAL((size_t)1, bursts.size());
+      CPPUNIT_ASSERT_EQUAL((uint64_t)14, bursts[0].offset);
+      CPPUNIT_ASSERT_EQUAL(7L, pmt::to_long(bursts[0].value));
+
+      CPPUNIT_ASSERT_EQUAL(12UL, source->overlap_trimmed());
+    }
+
+    void
+    qa_queue_source::t_keep_overlap()
+    {
+      queue_source::sptr source;
+      capture_sink::sptr sink = run_overlap(false, source);
+
+      // Every segment after the first starts with the last 3 items of the one before, marked by an overlap tag
+      CPPUNIT_ASSERT_EQUAL((size_t)52, sink->data.size());
+      CPPUNIT_ASSERT_EQUAL(5.0f, sink->data[8]);
+      CPPUNIT_ASSERT_EQUAL(8.0f, sink->data[11]);
+
+      std::vector<gr::tag_t> overlaps = tags_named(sink->tags, "overlap");
+      CPPUNIT_ASSERT_EQUAL((size_t)4, overlaps.size());
+      for(size_t i = 0; i < overlaps.size(); i++){
+        CPPUNIT_ASSERT_EQUAL((uint64_t)(8 + 11 * i), overlaps[i].offset);
+        CPPUNIT_ASSERT_EQUAL(3L, pmt::to_long(overlaps[i].value));
+      }
+
+      std::vector<gr::tag_t> bursts = tags_named(sink->tags, "burst");
+      CPPUNIT_ASSERT_EQUAL((size_t)1, bursts.size());
+      CPPUNIT_ASSERT_EQUAL((uint64_t)17, bursts[0].offset); // Item 14, after segment 1's overlap
+
+      CPPUNIT_ASSERT_EQUAL(0UL, source->overlap_trimmed());
+    }
+
+  } /* namespace router */
+} /* namespace gr */
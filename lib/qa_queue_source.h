@@ -0,0 +1,53 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _QA_QUEUE_SOURCE_H_
+#define _QA_QUEUE_SOURCE_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCase.h>
+
+namespace gr {
+  namespace router {
+
+    // queue_source: with a gap deadline, a missing index is filled in (zeros or a repeat) and tagged, and the segment
+    // turning up late is dropped; with trim_overlap, the items a queue sink repeated as overlap are dropped again
+    class qa_queue_source : public CppUnit::TestCase
+    {
+    public:
+      CPPUNIT_TEST_SUITE(qa_queue_source);
+      CPPUNIT_TEST(t_gap_zeros);
+      CPPUNIT_TEST(t_gap_repeat);
+      CPPUNIT_TEST(t_trim_overlap);
+      CPPUNIT_TEST(t_keep_overlap);
+      CPPUNIT_TEST_SUITE_END();
+
+    private:
+      void t_gap_zeros();
+      void t_gap_repeat();
+      void t_trim_overlap();
+      void t_keep_overlap();
+    };
+
+  } /* namespace router */
+} /* namespace gr */
+
+#endif /* _QA_QUEUE_SOURCE_H_ */
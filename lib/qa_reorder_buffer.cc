@@ -0,0 +1,130 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "qa_reorder_buffer.h"
+#include "ReorderBuffer.h"
+
+namespace gr {
+  namespace router {
+
+    void
+    qa_reorder_buffer::t_insert_drain()
+    {
+      ReorderBuffer<int> reorder(6, 10); // Rounded up to 8 slots
+      CPPUNIT_ASSERT_EQUAL(8, reorder.capacity());
+
+      // Every index of the window, back to front
+      for(long index = 17; index >= 10; index--)
+        CPPUNIT_ASSERT(reorder.insert(index, (int)index * 2) == ReorderBuffer<int>::REORDER_INSERTED);
+
+      CPPUNIT_ASSERT_EQUAL(8, reorder.occupancy());
+      CPPUNIT_ASSERT_EQUAL(8, reorder.high_water_mark());
+      CPPUNIT_ASSERT(reorder.holds(13));
+
+      for(long index = 10; index < 18; index++){
+        CPPUNIT_ASSERT(reorder.ready());
+        CPPUNIT_ASSERT_EQUAL((int)index * 2, reorder.front());
+        CPPUNIT_ASSERT_EQUAL((int)index * 2, reorder.pop());
+      }
+
+      CPPUNIT_ASSERT(!reorder.ready());
+      CPPUNIT_ASSERT_EQUAL(0, reorder.occupancy());
+      CPPUNIT_ASSERT_EQUAL(18L, reorder.next_index());
+
+      // The ring wraps: the slots just drained take the next span
+      CPPUNIT_ASSERT(reorder.insert(19, 1) == ReorderBuffer<int>::REORDER_INSERTED);
+      CPPUNIT_ASSERT(reorder.insert(18, 2) == ReorderBuffer<int>::REORDER_INSERTED);
+      CPPUNIT_ASSERT_EQUAL(2, reorder.pop());
+      CPPUNIT_ASSERT_EQUAL(1, reorder.pop());
+      CPPUNIT_ASSERT_EQUAL(8, reorder.high_water_mark());
+    }
+
+    void
+    qa_reorder_buffer::t_skip()
+    {
+      ReorderBuffer<int> reorder(8);
+
+      // 0 never turns up; 1 waits behind it until it is given up on
+      reorder.insert(1, 100);
+      CPPUNIT_ASSERT(!reorder.ready());
+      reorder.skip();
+      CPPUNIT_ASSERT(reorder.ready());
+      CPPUNIT_ASSERT_EQUAL(100, reorder.pop());
+      CPPUNIT_ASSERT_EQUAL(1UL, reorder.skipped_count());
+
+      // With nothing held, skip_to() gives up on any number of indexes in one step
+      reorder.skip_to(1000002);
+      CPPUNIT_ASSERT_EQUAL(1000002L, reorder.next_index());
+      CPPUNIT_ASSERT_EQUAL(1000001UL, reorder.skipped_count());
+
+      // ...and never moves the window back
+      reorder.skip_to(5);
+      CPPUNIT_ASSERT_EQUAL(1000002L, reorder.next_index());
+      CPPUNIT_ASSERT_EQUAL(1000001UL, reorder.skipped_count());
+
+      CPPUNIT_ASSERT(reorder.insert(1000002, 7) == ReorderBuffer<int>::REORDER_INSERTED);
+      CPPUNIT_ASSERT_EQUAL(7, reorder.pop());
+    }
+
+    void
+    qa_reorder_buffer::t_overflow()
+    {
+      ReorderBuffer<int> reorder(4);
+
+      // The window spans [0, 4); 4 and beyond do not fit and are not stored
+      CPPUNIT_ASSERT(reorder.insert(3, 3) == ReorderBuffer<int>::REORDER_INSERTED);
+      CPPUNIT_ASSERT(reorder.insert(4, 4) == ReorderBuffer<int>::REORDER_OVERFLOW);
+      CPPUNIT_ASSERT(reorder.insert(1000, 5) == ReorderBuffer<int>::REORDER_OVERFLOW);
+      CPPUNIT_ASSERT_EQUAL(2UL, reorder.overflow_count());
+      CPPUNIT_ASSERT_EQUAL(1, reorder.occupancy());
+      CPPUNIT_ASSERT(!reorder.holds(4));
+
+      // Once the window moves on, the same index fits
+      reorder.skip();
+      CPPUNIT_ASSERT(reorder.insert(4, 4) == ReorderBuffer<int>::REORDER_INSERTED);
+      CPPUNIT_ASSERT_EQUAL(2UL, reorder.overflow_count());
+    }
+
+    void
+    qa_reorder_buffer::t_stale()
+    {
+      ReorderBuffer<int> reorder(8, 5);
+
+      // Before the window: already written or skipped
+      CPPUNIT_ASSERT(reorder.insert(4, 1) == ReorderBuffer<int>::REORDER_STALE);
+
+      // A duplicate of an index held keeps the first
+      CPPUNIT_ASSERT(reorder.insert(6, 2) == ReorderBuffer<int>::REORDER_INSERTED);
+      CPPUNIT_ASSERT(reorder.insert(6, 3) == ReorderBuffer<int>::REORDER_STALE);
+
+      // A late segment, after its index was given up on
+      reorder.skip();
+      CPPUNIT_ASSERT_EQUAL(2, reorder.pop());
+      CPPUNIT_ASSERT(reorder.insert(5, 4) == ReorderBuffer<int>::REORDER_STALE);
+      CPPUNIT_ASSERT(reorder.insert(6, 5) == ReorderBuffer<int>::REORDER_STALE);
+
+      CPPUNIT_ASSERT_EQUAL(4UL, reorder.stale_count());
+      CPPUNIT_ASSERT_EQUAL(0, reorder.occupancy());
+      CPPUNIT_ASSERT_EQUAL(0UL, reorder.overflow_count());
+    }
+
+  } /* namespace router */
+} /* namespace gr */
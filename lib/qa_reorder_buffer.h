@@ -0,0 +1,52 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _QA_REORDER_BUFFER_H_
+#define _QA_REORDER_BUFFER_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCase.h>
+
+namespace gr {
+  namespace router {
+
+    // ReorderBuffer: segments come out in index order whatever order they went in, and the window's edges hold
+    class qa_reorder_buffer : public CppUnit::TestCase
+    {
+    public:
+      CPPUNIT_TEST_SUITE(qa_reorder_buffer);
+      CPPUNIT_TEST(t_insert_drain);
+      CPPUNIT_TEST(t_skip);
+      CPPUNIT_TEST(t_overflow);
+      CPPUNIT_TEST(t_stale);
+      CPPUNIT_TEST_SUITE_END();
+
+    private:
+      void t_insert_drain();
+      void t_skip();
+      void t_overflow();
+      void t_stale();
+    };
+
+  } /* namespace router */
+} /* namespace gr */
+
+#endif /* _QA_REORDER_BUFFER_H_ */
@@ -26,11 +26,19 @@
  */
 
 #include "qa_router.h"
+#include "qa_tag_sideband.h"
+#include "qa_reorder_buffer.h"
+#include "qa_segment_channel.h"
+#include "qa_queue_source.h"
 
 CppUnit::TestSuite *
 qa_router::suite()
 {
   CppUnit::TestSuite *s = new CppUnit::TestSuite("router");
+  s->addTest(gr::router::qa_tag_sideband::suite());
+  s->addTest(gr::router::qa_reorder_buffer::suite());
+  s->addTest(gr::router::qa_segment_channel::suite());
+  s->addTest(gr::router::qa_queue_source::suite());
 
   return s;
 }
@@ -0,0 +1,168 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "qa_segment_channel.h"
+#include "SegmentChannel.h"
+
+#include <boost/thread.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace gr {
+  namespace router {
+
+    typedef boost::lockfree::queue< int*, boost::lockfree::fixed_sized<true> > int_queue;
+
+    static long
+    elapsed_us(boost::posix_time::ptime start)
+    {
+      return (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+    }
+
+    // Takes a ticket, says so, and waits on it
+    struct waiter
+    {
+      SegmentChannel *channel;
+      volatile bool ready;
+      bool notified;
+
+      void operator()(){
+        unsigned ticket = channel->prepare();
+        ready = true;
+        notified = channel->wait(ticket, 5000000);
+      }
+    };
+
+    // Pops the queue after a while, as a consumer catching up would
+    struct popper
+    {
+      SegmentChannel *channel;
+      int_queue *queue;
+
+      void operator()(){
+        boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+        int *item;
+        if(queue->pop(item))
+          channel->notify_pop();
+      }
+    };
+
+    void
+    qa_segment_channel::t_notify_before_wait()
+    {
+      int_queue queue(4);
+      SegmentChannel *channel = SegmentChannel::get(&queue);
+
+      // A notify between the ticket and the wait is not lost
+      unsigned ticket = channel->prepare();
+      channel->notify();
+
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      CPPUNIT_ASSERT(channel->wait(ticket, 5000000));
+      CPPUNIT_ASSERT(elapsed_us(start) < 1000000);
+
+      SegmentChannel::release(channel);
+    }
+
+    void
+    qa_segment_channel::t_wait_timeout()
+    {
+      int_queue queue(4);
+      SegmentChannel *channel = SegmentChannel::get(&queue);
+
+      // A notify from before the ticket does not count
+      channel->notify();
+      unsigned ticket = channel->prepare();
+
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      CPPUNIT_ASSERT(!channel->wait(ticket, 20000));
+      CPPUNIT_ASSERT(elapsed_us(start) >= 15000);
+
+      SegmentChannel::release(channel);
+    }
+
+    void
+    qa_segment_channel::t_wakes_waiter()
+    {
+      int_queue queue(4);
+      SegmentChannel *channel = SegmentChannel::get(&queue);
+
+      waiter w;
+      w.channel = channel;
+      w.ready = false;
+      w.notified = false;
+
+      boost::thread thread(boost::ref(w));
+      while(!w.ready)
+        boost::this_thread::yield();
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10)); // Past the spin, parked
+
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      channel->notify();
+      thread.join();
+
+      // Woken by the notify, well before the wait's timeout
+      CPPUNIT_ASSERT(w.notified);
+      CPPUNIT_ASSERT(elapsed_us(start) < 1000000);
+
+      SegmentChannel::release(channel);
+    }
+
+    void
+    qa_segment_channel::t_blocked_push()
+    {
+      int_queue queue(2);
+      SegmentChannel *channel = SegmentChannel::get(&queue);
+      channel->set_capacity(2);
+
+      int items[4];
+      CPPUNIT_ASSERT(channel->try_push(queue, &items[0]));
+      CPPUNIT_ASSERT(channel->try_push(queue, &items[1]));
+      CPPUNIT_ASSERT_EQUAL(2L, channel->occupancy());
+
+      // Full, and nobody popping: the push gives up after its timeout
+      CPPUNIT_ASSERT(!channel->push(queue, &items[2], 10000));
+      CPPUNIT_ASSERT_EQUAL(1UL, channel->push_gave_up());
+
+      // The pop wakes the blocked push, which then gets in
+      popper p;
+      p.channel = channel;
+      p.queue = &queue;
+      boost::thread thread(p);
+
+      boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      CPPUNIT_ASSERT(channel->push(queue, &items[3], 5000000));
+      CPPUNIT_ASSERT(elapsed_us(start) < 1000000);
+      thread.join();
+
+      CPPUNIT_ASSERT_EQUAL(2L, channel->occupancy());
+      CPPUNIT_ASSERT_EQUAL(2L, channel->capacity());
+      CPPUNIT_ASSERT_EQUAL(1UL, channel->push_gave_up());
+
+      int *item;
+      while(queue.pop(item))
+        channel->notify_pop();
+
+      SegmentChannel::release(channel);
+    }
+
+  } /* namespace router */
+} /* namespace gr */
@@ -0,0 +1,53 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _QA_SEGMENT_CHANNEL_H_
+#define _QA_SEGMENT_CHANNEL_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCase.h>
+
+namespace gr {
+  namespace router {
+
+    // SegmentChannel: a notify after the ticket ends the wait, a wait without one times out, and a blocked push gets in
+    // once the other side pops
+    class qa_segment_channel : public CppUnit::TestCase
+    {
+    public:
+      CPPUNIT_TEST_SUITE(qa_segment_channel);
+      CPPUNIT_TEST(t_notify_before_wait);
+      CPPUNIT_TEST(t_wait_timeout);
+      CPPUNIT_TEST(t_wakes_waiter);
+      CPPUNIT_TEST(t_blocked_push);
+      CPPUNIT_TEST_SUITE_END();
+
+    private:
+      void t_notify_before_wait();
+      void t_wait_timeout();
+      void t_wakes_waiter();
+      void t_blocked_push();
+    };
+
+  } /* namespace router */
+} /* namespace gr */
+
+#endif /* _QA_SEGMENT_CHANNEL_H_ */
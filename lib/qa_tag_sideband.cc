@@ -0,0 +1,132 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "qa_tag_sideband.h"
+#include "TagSideband.h"
+
+#include <string.h>
+
+namespace gr {
+  namespace router {
+
+    static gr::tag_t
+    make_tag(uint64_t offset, const char *key, pmt::pmt_t value, pmt::pmt_t srcid = pmt::PMT_F)
+    {
+      gr::tag_t tag;
+      tag.offset = offset;
+      tag.key = pmt::string_to_symbol(key);
+      tag.value = value;
+      tag.srcid = srcid;
+      return tag;
+    }
+
+    // One tag; its value's serialized bytes start at VALUE_AT in the side-band
+    static std::vector<char>
+    single_tag()
+    {
+      std::vector<gr::tag_t> tags(1, make_tag(1000, "k", pmt::from_long(42)));
+      std::vector<char> sideband;
+      TagSideband::pack(tags, 1000, sideband);
+      return sideband;
+    }
+
+    // count, offset, key, flags, key length, "k", value length
+    static const int VALUE_LENGTH_AT = 4 + 4 + 2 + 2 + 2 + 1;
+    static const int VALUE_AT = VALUE_LENGTH_AT + 4;
+
+    void
+    qa_tag_sideband::t_round_trip()
+    {
+      std::vector<gr::tag_t> tags;
+      tags.push_back(make_tag(1007, "burst", pmt::PMT_T));
+      tags.push_back(make_tag(1000, "rx_time", pmt::make_tuple(pmt::from_uint64(5), pmt::from_double(0.25))));
+      tags.push_back(make_tag(1003, "i", pmt::from_long(9))); // The index travels in the header, not here
+      tags.push_back(make_tag(1007, "rx_time", pmt::make_tuple(pmt::from_uint64(6), pmt::from_double(0.5)), pmt::string_to_symbol("usrp")));
+
+      std::vector<char> sideband;
+      CPPUNIT_ASSERT_EQUAL(3, TagSideband::pack(tags, 1000, sideband));
+
+      std::vector<gr::tag_t> unpacked;
+      CPPUNIT_ASSERT(TagSideband::unpack(&sideband[0], sideband.size(), unpacked));
+      CPPUNIT_ASSERT_EQUAL((size_t)3, unpacked.size());
+
+      // In offset order, relative to the first item; ties keep their packing order
+      CPPUNIT_ASSERT_EQUAL((uint64_t)0, unpacked[0].offset);
+      CPPUNIT_ASSERT(pmt::eqv(unpacked[0].key, pmt::string_to_symbol("rx_time")));
+      CPPUNIT_ASSERT(pmt::equal(unpacked[0].value, tags[1].value));
+      CPPUNIT_ASSERT(pmt::eqv(unpacked[0].srcid, pmt::PMT_F));
+
+      CPPUNIT_ASSERT_EQUAL((uint64_t)7, unpacked[1].offset);
+      CPPUNIT_ASSERT(pmt::eqv(unpacked[1].key, pmt::string_to_symbol("burst")));
+      CPPUNIT_ASSERT(pmt::equal(unpacked[1].value, pmt::PMT_T));
+
+      CPPUNIT_ASSERT_EQUAL((uint64_t)7, unpacked[2].offset);
+      CPPUNIT_ASSERT(pmt::eqv(unpacked[2].key, pmt::string_to_symbol("rx_time")));
+      CPPUNIT_ASSERT(pmt::equal(unpacked[2].value, tags[3].value));
+      CPPUNIT_ASSERT(pmt::eqv(unpacked[2].srcid, pmt::string_to_symbol("usrp")));
+
+      // Only the index tag: no side-band
+      std::vector<char> none;
+      CPPUNIT_ASSERT_EQUAL(0, TagSideband::pack(std::vector<gr::tag_t>(1, tags[2]), 1000, none));
+      CPPUNIT_ASSERT(none.empty());
+    }
+
+    void
+    qa_tag_sideband::t_truncated()
+    {
+      std::vector<char> sideband = single_tag();
+
+      for(size_t length = 0; length < sideband.size(); length++){
+        std::vector<gr::tag_t> unpacked;
+        CPPUNIT_ASSERT(!TagSideband::unpack(&sideband[0], length, unpacked));
+        CPPUNIT_ASSERT(unpacked.empty());
+      }
+    }
+
+    void
+    qa_tag_sideband::t_oversized_length()
+    {
+      std::vector<char> sideband = single_tag();
+
+      // A length that wraps a signed comparison must still be caught
+      uint32_t huge = 0xFFFFFFF0;
+      memcpy(&sideband[VALUE_LENGTH_AT], &huge, sizeof(huge));
+
+      std::vector<gr::tag_t> unpacked;
+      CPPUNIT_ASSERT(!TagSideband::unpack(&sideband[0], sideband.size(), unpacked));
+      CPPUNIT_ASSERT(unpacked.empty());
+    }
+
+    void
+    qa_tag_sideband::t_damaged_value()
+    {
+      std::vector<char> sideband = single_tag();
+
+      // Not a pmt type tag; pmt::deserialize_str() throws on it
+      sideband[VALUE_AT] = (char)0xEE;
+
+      std::vector<gr::tag_t> unpacked;
+      CPPUNIT_ASSERT(!TagSideband::unpack(&sideband[0], sideband.size(), unpacked));
+      CPPUNIT_ASSERT(unpacked.empty());
+    }
+
+  } /* namespace router */
+} /* namespace gr */
@@ -0,0 +1,52 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _QA_TAG_SIDEBAND_H_
+#define _QA_TAG_SIDEBAND_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/TestCase.h>
+
+namespace gr {
+  namespace router {
+
+    // TagSideband: tags survive pack() and unpack(), and damaged side-bands are rejected rather than trusted
+    class qa_tag_sideband : public CppUnit::TestCase
+    {
+    public:
+      CPPUNIT_TEST_SUITE(qa_tag_sideband);
+      CPPUNIT_TEST(t_round_trip);
+      CPPUNIT_TEST(t_truncated);
+      CPPUNIT_TEST(t_oversized_length);
+      CPPUNIT_TEST(t_damaged_value);
+      CPPUNIT_TEST_SUITE_END();
+
+    private:
+      void t_round_trip();
+      void t_truncated();
+      void t_oversized_length();
+      void t_damaged_value();
+    };
+
+  } /* namespace router */
+} /* namespace gr */
+
+#endif /* _QA_TAG_SIDEBAND_H_ */
@@ -0,0 +1,461 @@
+/* -*- c++ -*- */
+/*
+ * Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ROUTER_QUEUE_SINK_BASE_H
+#define INCLUDED_ROUTER_QUEUE_SINK_BASE_H
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <cstdio>
+#include <boost/lockfree/queue.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <gnuradio/tags.h>
+#include "SegmentChannel.h"
+#include "TagSideband.h"
+#include "SegmentBuilder.h"
+#include "MetricsRegistry.h"
+#include "SegmentTrace.h"
+#include "RouterProbes.h"
+#include "AsyncLog.h"
+
+#define PUSH_TIMEOUT 100000 // Default longest a work() call blocks on a full queue (microseconds)
+
+namespace gr {
+    namespace router {
+
+        /*!
+         The work() shared by the queue sinks: cut the stream into segments (build_segment()) and push them onto a
+         shared queue, blocking for room when it is full.
+
+         With no window size, each call's input becomes one segment. With one, the input is cut into windows of
+         exactly window_size items; the windows completed in a call are pushed together and whatever is left over
+         waits in the carry buffer for the next call. With overlap, each segment starts with the last overlap items
+         of the stream before it.
+
+         T is the sample type (float or char) and Interface the block's public class, whose pure virtuals this
+         implements; the most derived class constructs the sync_block.
+         */
+
+        template <typename T, typename Interface>
+        class queue_sink_base : public Interface
+        {
+        public:
+
+            typedef boost::lockfree::queue< std::vector<T>*, boost::lockfree::fixed_sized<true> > segment_queue;
+            typedef segment_format<T> format;
+
+            int work(int noutput_items,
+                     gr_vector_const_void_star &input_items,
+                     gr_vector_void_star &output_items);
+
+            void set_push_timeout(long timeout_us){ push_timeout_us = timeout_us; }
+            long queue_capacity(){ return channel->capacity(); }
+            long blocked_time(){ return blocked_us; }
+            unsigned long blocked_count(){ return blocked_pushes; }
+            unsigned long overlap_bytes(){ return overlap_sent * sizeof(T); }
+            unsigned long segment_bytes(){ return items_sent * sizeof(T); }
+
+        protected:
+
+            queue_sink_base(segment_queue &shared_queue, bool preserve_index, int window_size, int overlap, int queue_capacity, int multiple);
+            ~queue_sink_base();
+
+        private:
+
+            segment_queue *queue; // Pointer to shared queue
+            SegmentChannel *channel; // Wakeups shared with whoever pops the queue
+
+            std::vector<gr::tag_t> tags; // Vector of tags pulled from stream
+
+            std::vector<T> *window; // Window buffer for building windows
+            int window_items; // Input items window was built from
+            std::vector<char> sideband; // Tag side-band for the window being built
+            std::vector<float> index_vector; // Indexes pulled from the stream tags, waiting for their windows
+
+            float index_of_window; // window indexing if not preserved from stream tags
+            bool preserve; // Re-establish index from source?
+
+            bool waiting_on_window; // We still have a window we can't push?
+
+            long push_timeout_us; // Longest work() blocks on a full queue
+            long blocked_us; // Time spent blocked on a full queue
+            unsigned long blocked_pushes; // Pushes that found the queue full
+            MetricCounter *segments_pushed; // Registered metrics
+            MetricCounter *blocked_metric;
+
+            // Fixed-size windows
+            int window_size; // Items per segment; 0 makes one segment of each work() call's input
+            std::vector<T> carry; // Items of the next window, gathered across calls
+            uint64_t carry_start; // Absolute offset of carry's first item
+            std::deque< std::vector<T>* > ready; // Completed windows waiting to be pushed
+
+            // Overlap
+            int overlap; // Items of the previous segment repeated at the start of each segment
+            std::vector<T> history; // The last overlap items of the stream so far
+            unsigned long overlap_sent; // Items sent again as overlap
+            unsigned long items_sent; // Items sent in all, overlap included
+
+            float get_index();
+            bool push_blocking();
+            int work_windows(int noutput_items, const T *in);
+            void read_tags(uint64_t nread, int ninput_items);
+            std::vector<gr::tag_t> window_tags(uint64_t first);
+            std::vector<T> *build_window(const T *data, int items, uint64_t first, const std::vector<gr::tag_t> &window_tags);
+            bool push_windows();
+        };
+
+        /*!
+         *  @param shared_queue The queue segments are pushed onto.
+         *  @param preserve_index True to take segment indexes from the index stream tags; count from 0 otherwise.
+         *  @param windowsize Items per segment; 0 makes each work() call's input one segment.
+         *  @param overlap_items Items of the previous segment repeated at the start of each segment.
+         *  @param queue_capacity Segments shared_queue was made to hold (reported by queue_capacity()); 0 if not known.
+         *  @param multiple The output multiple the scheduler is held to without a window size.
+         */
+
+        template <typename T, typename Interface>
+        queue_sink_base<T, Interface>::queue_sink_base(segment_queue &shared_queue, bool preserve_index, int windowsize, int overlap_items, int queue_capacity, int multiple)
+        : queue(&shared_queue), channel(SegmentChannel::get(&shared_queue)), window(NULL), window_items(0), index_of_window(0), preserve(preserve_index),
+        waiting_on_window(false), push_timeout_us(PUSH_TIMEOUT), blocked_us(0), blocked_pushes(0), window_size(std::max(0, windowsize)), carry_start(0),
+        overlap(std::max(0, overlap_items)), overlap_sent(0), items_sent(0)
+        {
+            if(queue_capacity > 0)
+                channel->set_capacity(queue_capacity);
+
+            // Fixed-size windows are cut from whatever the scheduler hands us
+            if(window_size == 0)
+                this->set_output_multiple(multiple);
+            else
+                carry.reserve(window_size);
+
+            char labels[32];
+            sprintf(labels, "queue=\"%d\"", channel->id());
+            segments_pushed = MetricsRegistry::get()->counter("router_queue_sink_segments_total", "Segments queue sinks pushed onto the queue", labels);
+            blocked_metric = MetricsRegistry::get()->counter("router_queue_sink_blocked_microseconds_total", "Time queue sinks spent blocked on the queue full", labels);
+        }
+
+        /// Windows that never made it onto the queue are freed
+        template <typename T, typename Interface>
+        queue_sink_base<T, Interface>::~queue_sink_base()
+        {
+            while(!ready.empty()){
+                delete ready.front();
+                ready.pop_front();
+            }
+
+            SegmentChannel::release(channel);
+        }
+
+        /*!
+         *  Segment the stream and push the resulting segments onto the queue.
+         *
+         *  @param noutput_items The number of data samples
+         *  @param &input_items Pointer to input vector
+         *  @param &output_items Pointer to output vector
+         *  @return The items consumed (0 while a window is still waiting for room).
+         */
+
+        template <typename T, typename Interface>
+        int
+        queue_sink_base<T, Interface>::work(int noutput_items,
+                                            gr_vector_const_void_star &input_items,
+                                            gr_vector_void_star &output_items)
+        {
+            const T *in = (const T *) input_items[0]; // Input buffer pointer
+
+            if(window_size > 0)
+                return work_windows(noutput_items, in);
+
+            // If we don't have a segment ready to push... let's make one
+            if(!waiting_on_window){
+
+                const uint64_t nread = this->nitems_read(0); //number of items read on port 0 up until the start of this work function (index of first sample)
+
+                read_tags(nread, noutput_items);
+
+                window = build_window(in, noutput_items, nread, tags);
+                tags.clear();
+
+                window_items = noutput_items;
+            }
+
+            // Push the window; with the queue full, sleep until the consumer makes room. After push_timeout_us we hand
+            // the scheduler back its thread and try the same window again on the next call.
+            long segment_index = format::index(*window); // Read before the consumer can free the window
+            if(!channel->try_push(*queue, window) && !push_blocking())
+                return 0;
+
+            window = NULL; // We're done with this window; it's on the queue
+            waiting_on_window = false; // Whichever way it went in, even after an earlier call timed out
+            segments_pushed->add();
+            SegmentTrace::record(TRACE_SINK_PUSH, segment_index);
+            ROUTER_PROBE3(queue_push, channel->id(), segment_index, channel->occupancy());
+            return window_items; // The items the window was built from (it may have waited since an earlier call)
+        }
+
+        /*!
+         *  work() with a fixed window size: cut the input into windows of window_size items, carrying the remainder
+         *  over to the next call, and push the completed windows as a batch.
+         *
+         *  @param noutput_items The number of data samples
+         *  @param in The input buffer
+         *  @return The items consumed: all of them, or 0 if windows from the last call still do not fit in the queue.
+         */
+
+        template <typename T, typename Interface>
+        int
+        queue_sink_base<T, Interface>::work_windows(int noutput_items, const T *in)
+        {
+            // Windows that did not fit last time go first
+            if(!push_windows())
+                return 0;
+
+            const uint64_t nread = this->nitems_read(0);
+            read_tags(nread, noutput_items);
+
+            int consumed = 0;
+
+            while(consumed < noutput_items){
+
+                // Whole windows straight out of the input buffer
+                if(carry.empty() && noutput_items - consumed >= window_size){
+                    ready.push_back(build_window(&in[consumed], window_size, nread + consumed, window_tags(nread + consumed)));
+                    consumed += window_size;
+                    continue;
+                }
+
+                // The rest is gathered in the carry buffer until it makes a window
+                if(carry.empty())
+                    carry_start = nread + consumed;
+
+                int count = std::min(window_size - (int)carry.size(), noutput_items - consumed);
+                carry.insert(carry.end(), &in[consumed], &in[consumed + count]);
+                consumed += count;
+
+                if((int)carry.size() == window_size){
+                    ready.push_back(build_window(&carry[0], window_size, carry_start, window_tags(carry_start)));
+                    carry.clear();
+                }
+            }
+
+            push_windows(); // Anything that does not fit waits for the next call
+            return noutput_items;
+        }
+
+        /*!
+         *  Read the tags on this call's items. With preserve, index tags go to index_vector; the rest stay in tags.
+         *
+         *  @param nread Absolute offset of the first item.
+         *  @param ninput_items Number of items.
+         */
+
+        template <typename T, typename Interface>
+        void
+        queue_sink_base<T, Interface>::read_tags(uint64_t nread, int ninput_items)
+        {
+            size_t start = tags.size();
+
+            //read all tags associated with port 0 for items in this work function
+            this->get_tags_in_range(tags, 0, nread, nread + ninput_items);
+
+            // Do we want to pull indexes from the stream tags and use those for window indexes?
+            if(!preserve)
+                return;
+
+            pmt::pmt_t key = pmt::string_to_symbol("i"); // Filter on key (i is for index)
+
+            //Convert all index tags to floats and add to index_vector
+            for(size_t i = start; i < tags.size(); i++){
+                if(!pmt::eqv(tags[i].key, key))
+                    continue;
+
+                if(tags[i].value != NULL)
+                    index_vector.push_back((float)(pmt::to_long(tags[i].value))); // Pulled from here when constructing window segments
+                else
+                    ROUTER_LOG(LOG_WARN, "queue_sink: got an index tag with no value");
+            }
+        }
+
+        /*!
+         *  Take the tags that belong on a fixed-size window out of tags.
+         *
+         *  @param first Absolute offset of the window's first item.
+         *  @return The window's tags.
+         */
+
+        template <typename T, typename Interface>
+        std::vector<gr::tag_t>
+        queue_sink_base<T, Interface>::window_tags(uint64_t first)
+        {
+            std::vector<gr::tag_t> mine;
+            std::vector<gr::tag_t> rest;
+
+            for(size_t i = 0; i < tags.size(); i++){
+                if(tags[i].offset < first + window_size)
+                    mine.push_back(tags[i]);
+                else
+                    rest.push_back(tags[i]);
+            }
+
+            tags.swap(rest);
+            return mine;
+        }
+
+        /*!
+         *  Build a segment (build_segment(): type 1 or 2, or type 4 or 5 if there are tags or overlap to carry) and
+         *  keep the end of the stream for the next one's overlap.
+         *
+         *  @param data The items.
+         *  @param items Number of items.
+         *  @param first Absolute offset of the first item.
+         *  @param window_tags The tags on those items.
+         *  @return The segment.
+         */
+
+        template <typename T, typename Interface>
+        std::vector<T> *
+        queue_sink_base<T, Interface>::build_window(const T *data, int items, uint64_t first, const std::vector<gr::tag_t> &window_tags)
+        {
+            int history_items = history.size();
+            std::vector<T> *segment = build_segment(get_index(), data, items, first, window_tags, history, sideband);
+
+            ROUTER_PROBE2(segment_create, format::index(*segment), history_items + items);
+
+            overlap_sent += history_items;
+            items_sent += history_items + items;
+
+            // Keep the end of the stream so far for the next segment's overlap
+            if(overlap > 0){
+                if(items >= overlap){
+                    history.assign(&data[items - overlap], &data[items]);
+                }
+                else{
+                    history.insert(history.end(), &data[0], &data[items]);
+                    if((int)history.size() > overlap)
+                        history.erase(history.begin(), history.end() - overlap);
+                }
+            }
+
+            return segment;
+        }
+
+        /*!
+         *  Push the completed fixed-size windows. As many as fit go in back to back with one wakeup for the consumer;
+         *  with the queue full, block for room as push_blocking() does.
+         *
+         *  @return True if every window was pushed; False if some are still waiting.
+         */
+
+        template <typename T, typename Interface>
+        bool
+        queue_sink_base<T, Interface>::push_windows()
+        {
+            while(!ready.empty()){
+
+                int pushed = 0;
+                while(!ready.empty()){
+                    std::vector<T> *next = ready.front();
+                    long segment_index = format::index(*next); // Read before the consumer can free the window
+                    if(!queue->push(next)){
+                        channel->push_failed();
+                        break;
+                    }
+                    SegmentTrace::record(TRACE_SINK_PUSH, segment_index);
+                    ROUTER_PROBE3(queue_push, channel->id(), segment_index, channel->occupancy());
+                    ready.pop_front();
+                    pushed++;
+                }
+
+                if(pushed > 0){
+                    channel->notify_push(pushed); // Wake the consumer once for the batch
+                    segments_pushed->add(pushed);
+                }
+
+                if(ready.empty())
+                    break;
+
+                window = ready.front();
+                long segment_index = format::index(*window);
+                if(!push_blocking())
+                    return false;
+
+                ready.pop_front();
+                window = NULL;
+                segments_pushed->add();
+                SegmentTrace::record(TRACE_SINK_PUSH, segment_index);
+                ROUTER_PROBE3(queue_push, channel->id(), segment_index, channel->occupancy());
+            }
+
+            return true;
+        }
+
+        /*!
+         *  Push the window onto a full queue, blocking until there is room or push_timeout_us passes.
+         *
+         *  @return True if the window was pushed; False if it is still waiting.
+         */
+
+        template <typename T, typename Interface>
+        bool
+        queue_sink_base<T, Interface>::push_blocking()
+        {
+            blocked_pushes++;
+
+            boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+            waiting_on_window = !channel->push(*queue, window, push_timeout_us);
+            long blocked = (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+            blocked_us += blocked;
+            blocked_metric->add(blocked);
+
+            if(waiting_on_window)
+                ROUTER_LOG(LOG_DEBUG, "queue_sink: queue %d still full after %ld us", channel->id(), push_timeout_us);
+
+            return !waiting_on_window;
+        }
+
+        /*!
+         *  The index of the next segment: the next index tag pulled from the stream if the index is preserved,
+         *  otherwise counted up from 0. With no index tag waiting, the count carries on from the last one.
+         *
+         *  @return index_of_window A float representing the index of the current window.
+         */
+
+        template <typename T, typename Interface>
+        float
+        queue_sink_base<T, Interface>::get_index()
+        {
+            if(preserve){
+                if(!index_vector.empty()){
+                    index_of_window = index_vector.front();
+                    index_vector.erase(index_vector.begin());
+                }
+                else{
+                    ROUTER_LOG(LOG_WARN, "queue_sink: preserving the index, but there is no index tag for this segment");
+                }
+            }
+
+            return index_of_window++;
+        }
+
+    } // namespace router
+} // namespace gr
+
+#endif /* INCLUDED_ROUTER_QUEUE_SINK_BASE_H */
@@ -0,0 +1,605 @@
+/* -*- c++ -*- */
+/*
+ * Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ROUTER_QUEUE_SOURCE_BASE_H
+#define INCLUDED_ROUTER_QUEUE_SOURCE_BASE_H
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <boost/lockfree/queue.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <gnuradio/tags.h>
+#include "ReorderBuffer.h"
+#include "SegmentChannel.h"
+#include "TagSideband.h"
+#include "SegmentBuilder.h"
+#include "MetricsRegistry.h"
+#include "SegmentTrace.h"
+#include "RouterProbes.h"
+#include "AsyncLog.h"
+
+// Indexes the reorder window spans (order=true); a window further ahead than this makes the source give up on the gap
+#define REORDER_CAPACITY 1024
+
+// Items in a gap filler made before any real segment has streamed (set_gap_size); a queue sink's unwindowed multiple
+#define GAP_DEFAULT_SIZE 768
+
+namespace gr {
+    namespace router {
+
+        /*!
+         The work() shared by the queue sources: pop segments off a shared queue and stream their data, optionally
+         restoring index order (ReorderBuffer), tagging each segment's first item with its index ("i") and putting
+         back the stream tags carried in the segment's side-band.
+
+         Ordered output normally waits as long as it takes for the next index (or until the reorder window overflows).
+         With a gap deadline set, an index is given up on once the segment after it has waited that long: a segment of
+         zeros (or a repeat of the last one) goes out in its place, tagged "gap", and the real one is dropped if it
+         turns up later.
+
+         Segments from a queue sink with overlap start with items repeated from the segment before, marked by an
+         "overlap" tag on the first of them. With set_trim_overlap(true) those items (and the tag) are dropped again.
+
+         T is the sample type (float or char) and Interface the block's public class, whose pure virtuals this
+         implements; the most derived class constructs the sync_block.
+         */
+
+        template <typename T, typename Interface>
+        class queue_source_base : public Interface
+        {
+        public:
+
+            typedef boost::lockfree::queue< std::vector<T>*, boost::lockfree::fixed_sized<true> > segment_queue;
+            typedef segment_format<T> format;
+            typedef ReorderBuffer<std::vector<T>*> reorder_buffer;
+
+            int work(int noutput_items,
+                     gr_vector_const_void_star &input_items,
+                     gr_vector_void_star &output_items);
+
+            unsigned long reorder_overflows(){ return reorder.overflow_count(); }
+            unsigned long reorder_skipped(){ return reorder.skipped_count(); }
+            int reorder_high_water(){ return reorder.high_water_mark(); }
+
+            void set_gap_deadline(long deadline){ deadline_us = deadline; }
+            void set_gap_repeat(bool repeat){ repeat_gaps = repeat; }
+            void set_gap_size(int items){ gap_size = std::max(0, items); }
+            unsigned long gaps_filled(){ return gaps; }
+            unsigned long late_segments(){ return reorder.stale_count(); }
+            double reorder_latency_avg(){ return (latency_count > 0) ? latency_total_us / latency_count : 0; }
+            long reorder_latency_max(){ return latency_max_us; }
+
+            void set_trim_overlap(bool trim){ trim_overlap = trim; }
+            unsigned long overlap_trimmed(){ return trimmed; }
+
+        protected:
+
+            queue_source_base(segment_queue &shared_queue, bool preserve_index, bool order_data);
+            ~queue_source_base();
+
+        private:
+
+            segment_queue *queue;
+            SegmentChannel *channel; // Wakeups shared with whoever pushes the queue
+
+            bool preserve; // Preserve indexes across flow graph
+            bool order; // Do we need to enforce ordering of leaving segments' data?
+            bool dead; // Received kill message
+
+            reorder_buffer reorder; // Segments waiting for their turn, keyed by index
+            std::vector<T> *held; // Popped segment that did not fit in the reorder window yet
+            std::vector<T> *partial; // Segment being streamed; carried over when out fills up part way through it
+            int partial_written; // Items of partial already streamed
+            int partial_offset; // Where partial's data starts
+            int partial_size; // Items of data in partial
+            std::vector<gr::tag_t> partial_tags; // partial's side-band tags (offsets relative to its first item), by offset
+            size_t next_tag; // First tag of partial_tags not yet written
+            bool partial_is_gap; // partial stands in for a given-up index
+
+            // Real-time ordering
+            long deadline_us; // Longest a segment waits behind a missing index; 0 waits forever
+            bool repeat_gaps; // Fill a given-up index with the last segment's data instead of zeros
+            std::vector<T> *last; // Last segment streamed (kept only to repeat it)
+            int last_offset; // Where last's data starts (after any overlap trimmed off its front)
+            int last_items; // Items of data in last; not last_size when repeat_gaps was off for later segments
+            int last_size; // Items in the last segment streamed, the size given to gap fillers; -1 until one has
+            int gap_size; // Size given to gap fillers until a real segment has streamed
+            unsigned long gaps; // Indexes filled in
+
+            // Time each segment in the reorder window arrived, in the same ring slots (index & mask)
+            std::vector<boost::posix_time::ptime> arrivals;
+            double latency_total_us; // Reorder window latency (arrival to start of streaming)
+            unsigned long latency_count;
+            long latency_max_us;
+
+            // Overlap
+            bool trim_overlap; // Drop items marked as overlap
+            long trim_left; // Overlap items still to drop at the start of the next segment
+            unsigned long trimmed; // Overlap items dropped
+
+            // Registered metrics
+            MetricCounter *segments_metric;
+            MetricCounter *gaps_metric;
+            MetricHistogram *latency_metric;
+
+            void tag_index(uint64_t offset, long index);
+            void tag_gap(uint64_t offset, long index);
+            std::vector<T> *fill_gap();
+            long overdue();
+            void trim();
+            void start_segment(uint64_t offset);
+            std::vector<T> *pop_segment();
+            std::vector<T> *next_segment();
+        };
+
+        template <typename T, typename Interface>
+        queue_source_base<T, Interface>::queue_source_base(segment_queue &shared_queue, bool preserve_index, bool order_data)
+        : queue(&shared_queue), channel(SegmentChannel::get(&shared_queue)), preserve(preserve_index), order(order_data), dead(false),
+        reorder(REORDER_CAPACITY, 0), // Zero is the initial index used for ordering. All first segments must be ordered from index 0
+        held(NULL), partial(NULL), partial_written(0), partial_offset(0), partial_size(0), next_tag(0), partial_is_gap(false),
+        deadline_us(0), repeat_gaps(false), last(NULL), last_offset(0), last_items(0), last_size(-1), gap_size(GAP_DEFAULT_SIZE), gaps(0),
+        latency_total_us(0), latency_count(0), latency_max_us(0),
+        trim_overlap(false), trim_left(0), trimmed(0)
+        {
+            arrivals.resize(reorder.capacity());
+
+            char labels[32];
+            sprintf(labels, "queue=\"%d\"", channel->id());
+            segments_metric = MetricsRegistry::get()->counter("router_queue_source_segments_total", "Segments queue sources streamed", labels);
+            gaps_metric = MetricsRegistry::get()->counter("router_queue_source_gaps_total", "Missing indexes queue sources filled in", labels);
+            latency_metric = MetricsRegistry::get()->histogram("router_queue_source_reorder_microseconds", "Time segments waited in the reorder window", labels);
+        }
+
+        /// Segments that never made it out are freed
+        template <typename T, typename Interface>
+        queue_source_base<T, Interface>::~queue_source_base()
+        {
+            delete held;
+            delete partial;
+            delete last;
+            while(reorder.occupancy() > 0){
+                if(reorder.ready())
+                    delete reorder.pop();
+                else
+                    reorder.skip();
+            }
+            SegmentChannel::release(channel);
+        }
+
+        /*!
+         *	Write an index stream tag.
+         *
+         *  @param offset Absolute offset of the item that carries the tag (the first item of the segment).
+         *  @param index The segment's index.
+         */
+
+        template <typename T, typename Interface>
+        void
+        queue_source_base<T, Interface>::tag_index(uint64_t offset, long index)
+        {
+            gr::tag_t temp_tag;
+            temp_tag.key = pmt::string_to_symbol("i"); // Key associated with the index
+            temp_tag.value = pmt::from_long(index); // Have to cast index to long (pmt does not handle floats)
+            temp_tag.offset = offset;
+
+            this->add_item_tag(0, temp_tag); // write <index> to stream at location stream = 0+offset with key = key
+
+            ROUTER_LOG(LOG_DEBUG, "queue_source: index tag %ld at offset %lu", index, offset);
+        }
+
+        /*!
+         *	Write a gap stream tag, marking data that stands in for a segment that never arrived in time.
+         *
+         *  @param offset Absolute offset of the filler's first item.
+         *  @param index The index that was given up on.
+         */
+
+        template <typename T, typename Interface>
+        void
+        queue_source_base<T, Interface>::tag_gap(uint64_t offset, long index)
+        {
+            gr::tag_t temp_tag;
+            temp_tag.key = pmt::string_to_symbol("gap");
+            temp_tag.value = pmt::from_long(index);
+            temp_tag.offset = offset;
+
+            this->add_item_tag(0, temp_tag);
+        }
+
+        /*!
+         *	How long past the gap deadline the reorder window is. The window is stuck on a missing index; the first
+         *  segment held behind it has waited since it arrived.
+         *
+         *  @return Microseconds past the deadline (zero or more once it has passed), or a negative number for the
+         *  microseconds still to go. LONG_MIN if nothing is waiting behind the missing index.
+         */
+
+        template <typename T, typename Interface>
+        long
+        queue_source_base<T, Interface>::overdue()
+        {
+            if(reorder.occupancy() == 0)
+                return LONG_MIN;
+
+            long index = reorder.next_index();
+            while(!reorder.holds(index))
+                index++;
+
+            boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+            return (now - arrivals[index & (reorder.capacity() - 1)]).total_microseconds() - deadline_us;
+        }
+
+        /*!
+         *	Give up on the missing index: skip it in the reorder window and make a segment to stream in its place,
+         *  the size of the last one streamed, holding zeros or (with repeat_gaps) the last segment's data as it was
+         *  streamed. Before any segment has streamed the filler is gap_size zeros. A segment with that index turning
+         *  up later is dropped as stale.
+         *
+         *  @return The filler segment.
+         */
+
+        template <typename T, typename Interface>
+        std::vector<T> *
+        queue_source_base<T, Interface>::fill_gap()
+        {
+            long index = reorder.next_index();
+            reorder.skip();
+            gaps++;
+            gaps_metric->add();
+
+            int size = (last_size < 0) ? gap_size : last_size;
+            std::vector<T> *filler = format::make(index, size);
+
+            // last may be older (and smaller) than the segment last_size came from, if repeat_gaps was turned on late
+            if(repeat_gaps && last != NULL)
+                memcpy(filler->data() + format::data_offset(*filler), last->data() + last_offset, sizeof(T)*std::min(last_items, size));
+
+            ROUTER_LOG(LOG_INFO, "queue_source: gap deadline passed; filling in index %ld", index);
+
+            partial_is_gap = true;
+            return filler;
+        }
+
+        /*!
+         *	Get partial ready to stream: find its data and unpack the tags in its side-band. The index tag goes on
+         *  its first item straight away; the side-band tags are written as their items are.
+         *
+         *  @param offset Absolute offset of the segment's first item in the output stream.
+         */
+
+        template <typename T, typename Interface>
+        void
+        queue_source_base<T, Interface>::start_segment(uint64_t offset)
+        {
+            partial_written = 0;
+            partial_offset = format::data_offset(*partial);
+
+            if(!partial_is_gap)
+                SegmentTrace::record(TRACE_SOURCE_EMIT, format::index(*partial));
+            ROUTER_PROBE3(reorder_emit, format::index(*partial), (int)partial_is_gap, reorder.occupancy());
+
+            // A size claiming more data than the segment carries is cut short
+            int available = (int)partial->size() - partial_offset;
+            partial_size = std::max(0, std::min(format::size(*partial), available));
+
+            //If we want to preserve index, write an index stream tag on the segment's first item
+            if(preserve)
+                tag_index(offset, format::index(*partial));
+
+            if(partial_is_gap)
+                tag_gap(offset, format::index(*partial));
+
+            partial_tags.clear();
+            next_tag = 0;
+
+            int sideband_bytes = format::sideband_bytes(*partial);
+            if(sideband_bytes > 0){
+                int room = (available - partial_size) * sizeof(T);
+                const char *sideband = (const char *)(partial->data() + partial_offset + partial_size);
+
+                if(!TagSideband::unpack(sideband, std::min(sideband_bytes, room), partial_tags))
+                    std::cout << "ERROR: Queue source got a segment with a damaged tag side-band" << std::endl;
+            }
+
+            if(trim_overlap)
+                trim();
+        }
+
+        /*!
+         *	Drop the overlap from partial: the items each overlap tag covers (and any left over from the previous
+         *  segment, at its start). Tags on the dropped items go with them; the tags after them move up.
+         */
+
+        template <typename T, typename Interface>
+        void
+        queue_source_base<T, Interface>::trim()
+        {
+            pmt::pmt_t key = pmt::string_to_symbol("overlap");
+
+            // Ranges to drop, in the segment's original item offsets
+            std::vector< std::pair<long, long> > ranges;
+            if(trim_left > 0)
+                ranges.push_back(std::make_pair(0L, trim_left));
+            trim_left = 0;
+
+            std::vector<gr::tag_t> kept;
+            for(size_t i = 0; i < partial_tags.size(); i++){
+                if(pmt::eqv(partial_tags[i].key, key))
+                    ranges.push_back(std::make_pair((long)partial_tags[i].offset, (long)partial_tags[i].offset + pmt::to_long(partial_tags[i].value)));
+                else
+                    kept.push_back(partial_tags[i]);
+            }
+
+            if(ranges.empty())
+                return;
+
+            long removed = 0; // Items dropped so far
+            long end = 0; // End of the last range dropped
+            for(size_t r = 0; r < ranges.size(); r++){
+                long first = std::max(ranges[r].first, end);
+                long last = std::min(ranges[r].second, (long)partial_size + removed);
+
+                // Overlap running past the end of this segment is dropped from the next one
+                trim_left = std::max(trim_left, ranges[r].second - ((long)partial_size + removed));
+
+                if(last <= first)
+                    continue;
+
+                if(first == removed)
+                    partial_offset += last - first; // At the front: just start later
+                else
+                    partial->erase(partial->begin() + partial_offset + (first - removed), partial->begin() + partial_offset + (last - removed));
+
+                partial_size -= last - first;
+                trimmed += last - first;
+
+                // Tags on dropped items go, and the ones after them move up
+                std::vector<gr::tag_t> moved;
+                for(size_t i = 0; i < kept.size(); i++){
+                    long offset = (long)kept[i].offset;
+                    if(offset >= first - removed && offset < last - removed)
+                        continue;
+                    if(offset >= last - removed)
+                        kept[i].offset -= last - first;
+                    moved.push_back(kept[i]);
+                }
+                kept.swap(moved);
+
+                removed += last - first;
+                end = last;
+            }
+
+            partial_tags.swap(kept);
+        }
+
+        /*!
+         *	Pop segments off the shared queue until a data segment turns up. A kill message marks the source dead;
+         *  anything else is dropped.
+         *
+         *  @return The next data segment, or NULL if the queue is empty (or the kill has arrived).
+         */
+
+        template <typename T, typename Interface>
+        std::vector<T> *
+        queue_source_base<T, Interface>::pop_segment()
+        {
+            std::vector<T> *temp_vector; // Temp vector pointer for popping vector pointers off of the shared queue
+
+            while(!dead && queue->pop(temp_vector)){
+
+                channel->notify_pop(); // Room for a waiting queue sink
+
+                if(format::is_data(*temp_vector)){
+                    ROUTER_PROBE3(queue_pop, channel->id(), format::index(*temp_vector), channel->occupancy());
+                    return temp_vector;
+                }
+
+                if(!temp_vector->empty() && format::is_kill(*temp_vector))
+                    dead = true;
+                else
+                    std::cout << "ERROR: Queue source got a segment of unexpected type" << std::endl;
+
+                delete temp_vector;
+            }
+
+            return NULL;
+        }
+
+        /*!
+         *	Find the segment to stream next. Unordered, that is simply the next one popped; ordered, popped segments
+         *  are filed in the reorder window under their index until the one next in line is there (or, with a gap
+         *  deadline, until the segments behind it have waited too long).
+         *
+         *  @return The next segment to stream, or NULL if it has not arrived yet.
+         */
+
+        template <typename T, typename Interface>
+        std::vector<T> *
+        queue_source_base<T, Interface>::next_segment()
+        {
+            if(!order)
+                return pop_segment();
+
+            while(true){
+
+                if(reorder.ready()){
+                    ROUTER_LOG(LOG_DEBUG, "queue_source: got the next segment; index %ld", reorder.next_index());
+
+                    // Time spent in the reorder window
+                    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+                    long latency = (now - arrivals[reorder.next_index() & (reorder.capacity() - 1)]).total_microseconds();
+                    latency_total_us += latency;
+                    latency_count++;
+                    latency_max_us = std::max(latency_max_us, latency);
+                    latency_metric->observe(latency);
+
+                    return reorder.pop();
+                }
+
+                // Pop the next segment, unless the last one is still waiting for room in the reorder window
+                if(held == NULL)
+                    held = pop_segment();
+
+                if(held != NULL){
+                    long held_index = format::index(*held);
+
+                    switch(reorder.insert(held_index, held)){
+                        case reorder_buffer::REORDER_INSERTED:
+                            arrivals[held_index & (reorder.capacity() - 1)] = boost::posix_time::microsec_clock::universal_time();
+                            held = NULL;
+                            break;
+
+                        case reorder_buffer::REORDER_STALE:
+                            // Late segments (their index was given up on) end up here too
+                            ROUTER_LOG(LOG_WARN, "queue_source: dropping segment %ld; already written, skipped or held", held_index);
+                            delete held;
+                            held = NULL;
+                            break;
+
+                        case reorder_buffer::REORDER_OVERFLOW:
+                            // The segment is a full span ahead of the index we are waiting for. Give up on the missing
+                            // indexes up to the first segment we do hold (less than a window away), or, holding none, jump
+                            // straight to where this one fits: one bogus index must not cost a skip per index it is ahead.
+                            ROUTER_LOG(LOG_WARN, "queue_source: segment %ld overflows the reorder window; giving up on %ld", held_index, reorder.next_index());
+                            if(reorder.occupancy() > 0){
+                                while(!reorder.ready())
+                                    reorder.skip();
+                            }
+                            else
+                                reorder.skip_to(held_index - reorder.capacity() + 1);
+                            break;
+                    }
+                    continue;
+                }
+
+                // After the kill nothing else is coming: skip the gaps and flush what is left, in order
+                if(dead && reorder.occupancy() > 0){
+                    while(!reorder.ready())
+                        reorder.skip();
+                    continue;
+                }
+
+                // Real-time streams do not wait forever for a missing index
+                if(deadline_us > 0 && overdue() >= 0)
+                    return fill_gap();
+
+                return NULL;
+            }
+        }
+
+        /*!
+         *	The objective of the work() function is to grab segments from the shared_queue and dump their contents into the out memory buffer.
+         *
+         *  Segments are copied straight into out, one after the other, until it is full; a segment that does not fit is
+         *  finished on the next call. If required, the segments are ordered prior to dumping their contents to maintain
+         *  order across the flow graph.
+         *
+         *  Also, if the index of the segment is to be maintained, the indexes are shared via stream tags.
+         *
+         */
+
+        template <typename T, typename Interface>
+        int
+        queue_source_base<T, Interface>::work(int noutput_items,
+                                              gr_vector_const_void_star &input_items,
+                                              gr_vector_void_star &output_items)
+        {
+            T *out = (T *) output_items[0];
+
+            unsigned ticket = channel->prepare(); // Any push from here on ends the wait below
+            int produced = 0;
+
+            while(produced < noutput_items){
+
+                // Start on the next segment
+                if(partial == NULL){
+                    partial = next_segment();
+                    if(partial == NULL)
+                        break;
+
+                    start_segment(this->nitems_written(0) + produced);
+                }
+
+                int count = std::min(partial_size - partial_written, noutput_items - produced);
+
+                if(count > 0){
+                    memcpy(out + produced, partial->data() + partial_offset + partial_written, sizeof(T)*count);
+
+                    // Put back the side-band tags that belong on the items just written
+                    uint64_t first = this->nitems_written(0) + produced - partial_written; // Where the segment started
+                    while(next_tag < partial_tags.size() && partial_tags[next_tag].offset < (uint64_t)(partial_written + count)){
+                        gr::tag_t tag = partial_tags[next_tag++];
+                        tag.offset += first;
+                        this->add_item_tag(0, tag);
+                    }
+
+                    produced += count;
+                    partial_written += count;
+                }
+
+                if(partial_written >= partial_size){
+                    // Fillers are sized after the last real segment (and with repeat_gaps, copy its data)
+                    if(!partial_is_gap){
+                        segments_metric->add();
+                        last_size = partial_size;
+                        if(repeat_gaps){
+                            delete last;
+                            last = partial;
+                            last_offset = partial_offset;
+                            last_items = partial_size;
+                            partial = NULL;
+                        }
+                    }
+
+                    delete partial;
+                    partial = NULL;
+                    partial_is_gap = false;
+                }
+            }
+
+            if(produced == 0){
+
+                // Everything before the kill has been streamed
+                if(dead && partial == NULL && held == NULL && reorder.occupancy() == 0)
+                    return -1;
+
+                // If none available, wait for the next push (the timeout only bounds how long work() blocks),
+                // or until the gap deadline runs out
+                long timeout = 1000;
+                if(order && deadline_us > 0){
+                    long late = overdue();
+                    if(late != LONG_MIN)
+                        timeout = std::max(1L, std::min(timeout, -late));
+                }
+                channel->wait(ticket, timeout);
+            }
+
+            return produced;
+        }
+
+    } // namespace router
+} // namespace gr
+
+#endif /* INCLUDED_ROUTER_QUEUE_SOURCE_BASE_H */
@@ -36,17 +36,9 @@
 #include "queue_source_byte_impl.h"
 #include <stdio.h>
 
-#define VERBOSE false
-
-
 namespace gr {
     namespace router {
         
-        /// Compare function used by std::sort to sort the windows from low to high index
-        bool order_window(const std::vector<char>* a, const std::vector<char>* b){
-            return(a->at(1) < b->at(1));
-        }
-        
         /*!
          *	The public constructor for the queue source byte block
          *
@@ -75,23 +67,10 @@ namespace gr {
         queue_source_byte_impl::queue_source_byte_impl(int size, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &shared_queue, bool preserve_index, bool order_data)
         : gr::sync_block("queue_source_byte",
                          gr::io_signature::make(0, 0, 0),
-                         gr::io_signature::make(1, 1, size)), queue(&shared_queue), item_size(size), preserve(preserve_index), order(order_data)
+                         gr::io_signature::make(1, 1, size)),
+        queue_source_base<char, queue_source_byte>(shared_queue, preserve_index, order_data)
         {
-            set_output_multiple(50); // 50 bytes per packet
-            dead = false;
-            
-            if(VERBOSE)
-                myfile.open("queue_source_byte.data");
-            
-            global_index = 0;
-            
-            if(VERBOSE){
-                myfile << "Calling QUEUE_SOURCE_BYTE Constructor\n\n";
-                myfile << std::flush;
-            }
-            
-            found_kill = false;
-            
+            ROUTER_LOG(LOG_DEBUG, "queue_source_byte: constructed");
         }
         
         /*!
@@ -100,58 +79,7 @@ namespace gr {
         
         queue_source_byte_impl::~queue_source_byte_impl()
         {
-            
-            if(VERBOSE){
-                std::cout << "*Calling Queue_Source_Byte Destructor*" << std::endl;
-                myfile << "Calling Queue_Source_Byte Destructor\n";
-                myfile << std::flush;
-                myfile.close();
-            }
-        }
-        
-        /*!
-         *	The objective of the work() function is to grab windows from the shared_queue and dump their contents into the out memory buffer.
-         *
-         *  If required, the windows are ordered prior to dumping their contents to maintain order across the flow graph.
-         *
-         *  Also, if the index of the window is to be maintained, the indexes are shared via stream tags.
-         *
-         */
-        
-        int
-        queue_source_byte_impl::work(int noutput_items,
-                                     gr_vector_const_void_star &input_items,
-                                     gr_vector_void_star &output_items)
-        {
-            char *out = (char *) output_items[0];
-            
-            std::vector<char> *temp_vector;
-            std::vector<char> buffer;
-            
-            float index;
-            float data_size;
-            
-            if(queue->pop(temp_vector)){
-                
-                char type = temp_vector->at(0);
-                
-                switch(type){
-                    case '2':
-                        memcpy(&index, &(temp_vector->at(1)), 4);
-                        memcpy(&data_size, &(temp_vector->at(5)), 4);
-                        memcpy(out, &(temp_vector->at(9)), data_size);
-                        
-                        delete temp_vector;
-                        
-                        return data_size;
-                        break;
-                }
-                
-            }
-            else{
-                boost::this_thread::sleep(boost::posix_time::microseconds(100));
-                return 0;
-            }
+            ROUTER_LOG(LOG_DEBUG, "queue_source_byte: destructor");
         }
         
     } /* namespace router */
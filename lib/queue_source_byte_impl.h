@@ -22,50 +22,16 @@
 #define INCLUDED_ROUTER_QUEUE_SOURCE_BYTE_IMPL_H
 
 #include <router/queue_source_byte.h>
-#include <vector>
-#include <boost/thread.hpp>
-#include <algorithm>
-#include <boost/lockfree/queue.hpp>
-#include <memory>
-#include <gnuradio/tagged_stream_block.h>
-#include <iostream>
-#include <fstream>
+#include "queue_source_base.h"
 
 namespace gr {
   namespace router {
 
-    class queue_source_byte_impl : public queue_source_byte
+    class queue_source_byte_impl : public queue_source_base<char, queue_source_byte>
     {
-     private:
-
-        std::ofstream myfile;
-
-        bool dead;
-
-        int number_of_windows;
-        int left_over_values;
-        int global_index;
-
-        bool found_kill;
-
-        bool order;
-        std::vector<std::vector<char>* > local;
-
-        boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > *queue;
-
-        int item_size;
-
-        std::vector<char> window;
-        bool preserve;
-
      public:
       queue_source_byte_impl(int size, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &shared_queue, bool preserve_index, bool order);
       ~queue_source_byte_impl();
-
-      // Where all the action really happens
-      int work(int noutput_items,
-	       gr_vector_const_void_star &input_items,
-	       gr_vector_void_star &output_items);
     };
 
   } // namespace router
@@ -44,16 +44,10 @@
 #include <stdio.h>
 
 #define BOOLEAN_STRING(b) ((b) ? "true":"false")
-#define VERBOSE false
 
 namespace gr {
     namespace router {
         
-        /// Compare function used by std::sort to sort the windows from low to high index
-        bool order_window(const std::vector<float>* a, const std::vector<float>* b){
-            return (a->at(1) < b->at(1));
-        }
-        
         /*!
          *	The public constructor for the Queue Source.
          *
@@ -81,18 +75,10 @@ namespace gr {
         queue_source_impl::queue_source_impl(int size, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &shared_queue, bool preserve_index, bool order_data)
         : gr::sync_block("queue_source",
                          gr::io_signature::make(0, 0, 0),
-                         gr::io_signature::make(1, 1, size)), queue(&shared_queue), item_size(size), preserve(preserve_index), order(order_data)
+                         gr::io_signature::make(1, 1, size)),
+        queue_source_base<float, queue_source>(shared_queue, preserve_index, order_data)
         {
-            
-            set_output_multiple(768); // Guarantee outputs in multiples of 768 (in this case) floats!
-            dead = false;
-            
-            if(VERBOSE)
-                myfile.open("queue_source.data"); // Dump information to file
-            
-            global_index = 0; // Zero is the initial index used for ordering. All first Windows must be ordered from index 0
-            
-            found_kill = false;
+            ROUTER_LOG(LOG_DEBUG, "queue_source: constructed");
         }
         
         /*!
@@ -101,169 +87,7 @@ namespace gr {
         
         queue_source_impl::~queue_source_impl()
         {
-            // Any alloc'd structures I need to delete?
-            
-            if(VERBOSE){
-                std::cout << "*Calling Queue_Source Destructor*" << std::endl;
-                myfile << "Calling Queue_Source Destructor\n";
-                myfile << std::flush;
-                myfile.close();
-            }
-        }
-        
-        
-        /*!
-         *	The objective of the work() function is to grab windows from the shared_queue and dump their contents into the out memory buffer.
-         *
-         *  If required, the windows are ordered prior to dumping their contents to maintain order across the flow graph.
-         *
-         *  Also, if the index of the window is to be maintained, the indexes are shared via stream tags.
-         *
-         */
-        
-        int
-        queue_source_impl::work(int noutput_items,
-                                gr_vector_const_void_star &input_items,
-                                gr_vector_void_star &output_items)
-        {
-            float *out = (float *) output_items[0]; // output float buffer pointer (where we're writing the floats to)
-            
-            std::vector<float> *temp_vector; // Temp vector pointer for popping vector pointers off of the shared queue
-            std::vector<float> buffer; // A temporary buffer; might not be necessary
-            
-            float index;
-            float data_size;
-            
-            // Pop next value off of shared queue if there is one available
-            if(queue->pop(temp_vector)){
-                
-                // Grab type from the vector
-                int type = (int)temp_vector->at(0);
-                
-                // Switch on the type
-                switch(type){
-                        
-                        // If the segment is of type 1...
-                    case 1:
-                        index = temp_vector->at(1);
-                        data_size = (int)temp_vector->at(2);
-                        
-                        if(order){
-                            local.push_back(temp_vector);
-                            std::sort(local.begin(), local.end(), order_window);
-                            
-                            int temp_counter = 0;
-                            
-                            while((local.size() > 0) && ((int)(local.at(0)->at(1)) == global_index)){
-                                if(VERBOSE)
-                                    myfile << "Got the next window; index=" << global_index << std::endl;
-                                
-                                buffer.insert(buffer.end(), local.front()->begin()+3, local.front()->end()); // Copy the contents of the temp_vector to the buffer minus the type, index, size
-                                
-                                local.erase(local.begin()); // Remove the pointer from the local vector
-                                
-                                //If we want to preserve index, write an index stream tag
-                                if(preserve){
-                                    
-                                    const size_t item_index = 0; //Let the first item in the stream contain the index tag
-                                    const uint64_t offset = this->nitems_written(0) + item_index; // Determine offset from first element in stream where tag will be placed
-                                    pmt::pmt_t key = pmt::string_to_symbol("i"); // Key associated with the index
-                                    
-                                    // Have to cast index to long (pmt does not handle floats)
-                                    pmt::pmt_t value = pmt::from_long((long)global_index);
-                                    
-                                    //write a tag to output port 0 with given absolute item offset
-                                    gr::tag_t temp_tag;
-                                    temp_tag.key = key;
-                                    temp_tag.value = value;
-                                    temp_tag.offset = offset;
-                                    
-                                    this->add_item_tag(0, temp_tag); // write <index> to stream at location stream = 0+offset with key = key
-                                    
-                                    if(VERBOSE)
-                                        myfile << "Writing stream tag: (key=i, offset=" << offset << ", value=" << index << "\n" << std::flush;
-                                }
-                                
-                                global_index++;
-                                temp_counter++;
-                                
-                            }
-                            
-                            if(temp_counter > 0){
-                                memcpy(out, &(buffer.data()[0]), sizeof(float)*data_size*temp_counter);
-                                return temp_counter*data_size;
-                            }
-                            else{
-                                if(VERBOSE)
-                                    myfile << "Looking for: " << global_index << " but our lowest index is: " << local.at(0)->at(0) << "\n" << std::flush;
-                                return 0;
-                            }
-                            
-                        }
-                        
-                        // If ordering doesn't matter
-                        else{
-                            if(VERBOSE)
-                                myfile << "Queue Source Memcpy size=" << sizeof(float)*data_size << std::endl;
-                            
-                            memcpy(out, &(temp_vector->at(3)), sizeof(float)*data_size);
-                            
-                            // If the index is to be preserved (with stream tags)
-                            if(preserve){
-                                
-                                const size_t item_index = 0; //Let the first item in the stream contain the index tag
-                                const uint64_t offset = this->nitems_written(0) + item_index; // Determine offset from first element in stream where tag will be placed
-                                pmt::pmt_t key = pmt::string_to_symbol("i"); // Key associated with the index
-                                
-                                // Have to cast index to long (pmt does not handle floats)
-                                pmt::pmt_t value = pmt::from_long((long)index);
-                                
-                                gr::tag_t temp_tag;
-                                temp_tag.key = key;
-                                temp_tag.value = value;
-                                temp_tag.offset = offset;
-                                
-                                //write a tag to output port 0 with given absolute item offset
-                                this->add_item_tag(0, temp_tag);
-                                
-                                if(VERBOSE)
-                                    myfile << "Writing stream tag: (key=i, offset=" << offset << ", value=" << index << "\n" << std::flush;
-                                
-                            }
-                            
-                            delete temp_vector;
-                            
-                            return data_size;
-                            
-                        }
-                        break;
-                        
-                    case 2:
-                        std::cout << "ERROR: We don't expect type-2 messages" << std::endl;
-                        break;
-                        
-                    case 3:
-                        dead = true;
-                        if(local.size() == 0){
-                            return -1;
-                        }
-                        else{
-                            if(VERBOSE)
-                                myfile << "ERROR: Got the kill msg, but there's still stuff in local! No good" << std::endl;
-                            return -1;
-                        }
-                        break;
-                    default:
-                        return 0;
-                }
-            }
-            
-            // If none available, wait
-            else{
-                boost::this_thread::sleep(boost::posix_time::microseconds(100)); // Arbitrary sleep time
-                return 0;
-            }
-            
+            ROUTER_LOG(LOG_DEBUG, "queue_source: destructor");
         }
         
     } /* namespace router */
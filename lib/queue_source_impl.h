@@ -22,56 +22,20 @@
 #define INCLUDED_ROUTER_QUEUE_SOURCE_IMPL_H
 
 #include <router/queue_source.h>
-#include <vector>
-#include <boost/thread.hpp>
-#include <algorithm>
-#include <boost/lockfree/queue.hpp>
-#include <memory>
-#include <gnuradio/tagged_stream_block.h>
-#include <iostream>
-#include <fstream>
+#include "queue_source_base.h"
 
 namespace gr {
     namespace router {
         
-        class queue_source_impl : public queue_source
+        class queue_source_impl : public queue_source_base<float, queue_source>
         {
-        private:
-            
-            std::ofstream myfile; // output file stream
-            
-            bool dead;
-            
-            int number_of_windows; // Number of Windows we can construct from available samples
-            int left_over_values; // Values left after filling Windows
-            int global_index; // Current Index to maintain ordering
-            
-            bool found_kill; // Received kill message
-            
-            
-            bool order; // Do we need to enforce ordering of leaving Windows' data?
-            std::vector<std::vector<float>* > local; // Local vector for ordering
-            
-            boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > *queue;
-            
-            // Right now everything is Floats, but future versions need to support any data type
-            int item_size; // size of items to be windowd
-            
-            std::vector<float> window; // Window buffer
-            bool preserve; // Preserve indexes across flow graph
-            
-            
         public:
             queue_source_impl(int size, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &shared_queue, bool preserve_index, bool order);
             ~queue_source_impl();
-            
-            // Where all the action really happens
-            int work(int noutput_items,
-                     gr_vector_const_void_star &input_items,
-                     gr_vector_void_star &output_items);
         };
         
     } // namespace router
 } // namespace gr
 
 #endif /* INCLUDED_ROUTER_QUEUE_SOURCE_IMPL_H */
+
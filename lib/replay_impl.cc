@@ -0,0 +1,147 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "replay_impl.h"
+#include "RateMeter.h"
+#include "AsyncLog.h"
+#include <algorithm>
+#include <time.h>
+
+#define LATE_NS 1000000 // A segment this far behind its captured time counts as behind
+#define PAUSE_SLICE_NS 10000000
+
+namespace gr {
+    namespace router {
+        
+        /*!
+         *  Create a replay of a capture.
+         *
+         *  @param path The capture file (from root::set_capture).
+         *  @param &in_queue The root's input queue, to push the segments onto.
+         *  @return A shared pointer to the replay.
+         */
+        
+        replay::sptr
+        replay::make(const std::string &path, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue)
+        {
+            return replay::sptr(new replay_impl(path, in_queue));
+        }
+        
+        replay_impl::replay_impl(const std::string &path, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue)
+        : queue(&in_queue), channel(SegmentChannel::get(&in_queue)), stopping(false), done(false), count(0), late(0)
+        {
+            is_loaded = reader.open(path);
+            if(!is_loaded)
+                ROUTER_LOG(LOG_ERROR, "replay: cannot read the capture");
+        }
+        
+        replay_impl::~replay_impl()
+        {
+            stop();
+            SegmentChannel::release(channel);
+        }
+        
+        bool replay_impl::start(double speed){
+            
+            if(!is_loaded)
+                return false;
+            
+            stop();
+            
+            reader.rewind();
+            stopping = false;
+            done = false;
+            count = 0;
+            late = 0;
+            
+            thread = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&replay_impl::run, this, speed)));
+            return true;
+        }
+        
+        void replay_impl::stop(){
+            if(thread){
+                stopping = true;
+                thread->join();
+                thread.reset();
+            }
+        }
+        
+        void replay_impl::wait(){
+            if(thread){
+                thread->join();
+                thread.reset();
+            }
+        }
+        
+        /*!
+         *  Push the captured segments onto the queue, each once its captured arrival (scaled) comes around.
+         *
+         *  @param speed Multiple of the captured rate; 0 pushes as fast as the queue takes them.
+         */
+        
+        void replay_impl::run(double speed){
+            
+            uint64_t arrival;
+            const float *data;
+            uint32_t floats;
+            
+            uint64_t start = MonotonicClock::monotonic_ns();
+            
+            while(!stopping && reader.next(arrival, data, floats)){
+                
+                if(speed > 0){
+                    uint64_t due = start + (uint64_t)(arrival / speed);
+                    uint64_t now = MonotonicClock::monotonic_ns();
+                    
+                    if(now - due > LATE_NS && now > due)
+                        late++;
+                    
+                    // Sleep off the gap, a slice at a time so stop() is not held up by a long idle stretch
+                    while(due > now && !stopping){
+                        struct timespec pause;
+                        pause.tv_sec = 0;
+                        pause.tv_nsec = std::min(due - now, (uint64_t)PAUSE_SLICE_NS);
+                        nanosleep(&pause, NULL);
+                        now = MonotonicClock::monotonic_ns();
+                    }
+                }
+                
+                std::vector<float> *segment = new std::vector<float>(data, data + floats);
+                
+                // Wait for room rather than drop: the stream is only worth replaying whole
+                while(!stopping && !channel->push(*queue, segment, 100000));
+                if(stopping){
+                    delete segment;
+                    break;
+                }
+                
+                count++;
+            }
+            
+            ROUTER_LOG(LOG_INFO, "replay: %lu segments replayed (%lu behind)", (unsigned long)count, (unsigned long)late);
+            done = true;
+        }
+        
+    } /* namespace router */
+} /* namespace gr */
@@ -0,0 +1,68 @@
+/* -*- c++ -*- */
+/*
+ *  Written by Tommy Tracy II (University of Virginia HPLP) 2014
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ROUTER_REPLAY_IMPL_H
+#define INCLUDED_ROUTER_REPLAY_IMPL_H
+
+#include <router/replay.h>
+#include "SegmentCapture.h"
+#include "SegmentChannel.h"
+#include <boost/thread.hpp>
+
+namespace gr {
+    namespace router {
+        
+        class replay_impl : public replay
+        {
+        private:
+            boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > *queue;
+            SegmentChannel *channel; // Wakeups for the root popping the queue
+            
+            CaptureReader reader;
+            bool is_loaded;
+            
+            boost::shared_ptr<boost::thread> thread;
+            volatile bool stopping;
+            volatile bool done;
+            
+            volatile unsigned long count;
+            volatile unsigned long late;
+            
+            // Thread program: push every segment, paced
+            void run(double speed);
+            
+        public:
+            replay_impl(const std::string &path, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue);
+            ~replay_impl();
+            
+            bool loaded(){ return is_loaded; }
+            bool start(double speed);
+            void stop();
+            void wait();
+            bool finished(){ return done; }
+            
+            unsigned long replayed(){ return count; }
+            unsigned long behind(){ return late; }
+        };
+        
+    } // namespace router
+} // namespace gr
+
+#endif /* INCLUDED_ROUTER_REPLAY_IMPL_H */
@@ -25,7 +25,18 @@
 #include <gnuradio/io_signature.h>
 #include "root_impl.h"
 
-#define VERBOSE false
+// Bytes in one window of floats; converts a child's queued bytes into the same units as its weight
+#define WINDOW_BYTES (768 * sizeof(float))
+
+// Send times kept per child for round-trip timing; more segments than this in flight to one child go untimed
+#define RTT_SLOTS 1024
+
+// A send time is one 64-bit word, so the sender and the receiver never see half of one: the low 24 bits of the
+// segment index over the low 40 bits of the tick count (minutes at any TSC rate, far longer than a round trip)
+#define RTT_TICK_BITS 40
+#define RTT_TICK_MASK ((1ULL << RTT_TICK_BITS) - 1)
+#define RTT_EMPTY (~0ULL)
+#define RTT_PACK(index, ticks) ((((uint64_t)(index) & 0xFFFFFF) << RTT_TICK_BITS) | ((ticks) & RTT_TICK_MASK))
 
 namespace gr {
  	namespace router {
@@ -38,12 +49,13 @@ namespace gr {
          *  @param &input_queue Reference to input queue to push computable segments to.
          *  @param &output_queue Reference to output queue to pop result segments from.
          *  @param throughput The maximum rate at which segments are popped from the output queue
+         *  @param transport "tcp", "udp" or "uring"; empty to take ROUTER_TRANSPORT from the environment.
          */
         
  		root::sptr
- 		root::make(int number_of_children, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &input_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &output_queue, double throughput)
+ 		root::make(int number_of_children, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &input_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &output_queue, double throughput, const std::string &transport)
  		{
- 			return gnuradio::get_initial_sptr (new root_impl(number_of_children, input_queue, output_queue, throughput));
+ 			return gnuradio::get_initial_sptr (new root_impl(number_of_children, input_queue, output_queue, throughput, transport));
  		}
         
         /*!
@@ -53,12 +65,13 @@ namespace gr {
          *  @param &input_queue Reference to input queue to push computable segments to.
          *  @param &output_queue Reference to output queue to pop result segments from.
          *  @param throughput The maximum rate at which segments are popped from the output queue
+         *  @param transport "tcp", "udp" or "uring"; empty to take ROUTER_TRANSPORT from the environment.
          */
         
-        root_impl::root_impl(int numberofchildren, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &input_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &output_queue, double throughput)
+        root_impl::root_impl(int numberofchildren, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &input_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &output_queue, double throughput, const std::string &transport)
         : gr::sync_block("root",
                          gr::io_signature::make(0,0,0),
-                         gr::io_signature::make(0,0,0)), number_of_children(numberofchildren), in_queue(&input_queue), out_queue(&output_queue), d_throughput(throughput)
+                         gr::io_signature::make(0,0,0)), number_of_children(numberofchildren), in_queue(&input_queue), out_queue(&output_queue), in_channel(SegmentChannel::get(&input_queue)), out_channel(SegmentChannel::get(&output_queue)), d_throughput(throughput)
         {
             
             // Throughput stuff ----------
@@ -69,27 +82,66 @@ namespace gr {
             d_samples_per_us = d_throughput/1e6; // Number of samples in a micro-second
             // ----------
             
-            
-            if(VERBOSE)
-                myfile.open("root_router.data");
-            
             num_killed = 0;
             
     		// Set global counter; no need to lock -> no contention
          	global_counter = 0;
             
             // Communication connector between nodes (size of elements, number of children, port number, are we root?)
-    		connector =  new NetworkInterface(sizeof(char), number_of_children, 8080, true);
+    		TransportOptions options = TransportOptions::from_environment();
+    		if(!transport.empty() && !options.set_transport(transport.c_str()))
+    		    ROUTER_LOG(LOG_ERROR, "root: unknown transport %s; using tcp", transport.c_str());
+    		connector =  new NetworkInterface(sizeof(char), number_of_children, 8080, true, options);
             
     	   	// Interconnect all blocks (we're root, so localhost=NULL)
-    		connector->connect(NULL);
-            
-        	// Initialize counters for both queues to 0 (not sure we need this)
-    		in_queue_counter = 0;
-    		out_queue_counter = 0;
+    		// A child that never connects (ROUTER_ACCEPT_TIMEOUT) is marked down by its receiver's first read
+    		if(!connector->connect(NULL))
+    		    ROUTER_LOG(LOG_ERROR, "root: not every child connected; carrying on with the ones that did");
             
     	  	// Array of weights values for each child + local (index 0)
     		weights = new float[number_of_children];
+    		for(int i = 0; i < number_of_children; i++)
+    			weights[i] = 0;
+            
+            down = new bool[number_of_children];
+            for(int i = 0; i < number_of_children; i++)
+                down[i] = false;
+            
+            // Register each child's metrics
+            for(int i = 0; i < number_of_children; i++){
+                char labels[32];
+                sprintf(labels, "child=\"%d\"", i);
+                
+                child_metrics m;
+                m.segments_sent = MetricsRegistry::get()->counter("router_root_segments_sent_total", "Segments the root sent to a child", labels);
+                m.bytes_sent = MetricsRegistry::get()->counter("router_root_bytes_sent_total", "Bytes the root sent to a child", labels);
+                m.segments_received = MetricsRegistry::get()->counter("router_root_segments_received_total", "Segments the root received from a child", labels);
+                m.bytes_received = MetricsRegistry::get()->counter("router_root_bytes_received_total", "Bytes the root received from a child", labels);
+                m.errors = MetricsRegistry::get()->counter("router_root_child_errors_total", "Failed sends, failed reads and malformed messages on a child's connection", labels);
+                m.disconnects = MetricsRegistry::get()->counter("router_root_child_disconnects_total", "Times a child's connection was lost", labels);
+                m.weight = MetricsRegistry::get()->gauge("router_root_child_weight", "Weight a child last reported", labels);
+                m.rtt = MetricsRegistry::get()->histogram("router_root_child_rtt_us", "Microseconds from sending a segment to a child to its result coming back", labels);
+                
+                m.sent_at = new uint64_t[RTT_SLOTS];
+                for(int j = 0; j < RTT_SLOTS; j++)
+                    m.sent_at[j] = RTT_EMPTY;
+                
+                metrics.push_back(m);
+            }
+            
+            // Statistics go out on the stats port once a second, and on request
+            tick_rate = MonotonicClock::ticks_per_second();
+            stats_period = (uint64_t)tick_rate;
+            next_stats = MonotonicClock::ticks() + stats_period;
+            
+            message_port_register_out(pmt::mp("stats"));
+            message_port_register_in(pmt::mp("stats_request"));
+            set_msg_handler(pmt::mp("stats_request"), boost::bind(&root_impl::stats_requested, this, _1));
+            
+            const char *capture_path = getenv("ROUTER_CAPTURE");
+            if(capture_path != NULL && !set_capture(capture_path)){
+                ROUTER_LOG(LOG_ERROR, "root: cannot capture segments to ROUTER_CAPTURE");
+            }
             
     	   	// Finished flag for threads(true if finished)
     		d_finished = false;
@@ -100,18 +152,14 @@ namespace gr {
             // Threads for parent to receive from all children
     		for(int i = 0; i < number_of_children; i++){
                 
-          		if(VERBOSE)
-            		std::cout << "Spawning new receiver thread for child #" << i << std::endl;
+          		ROUTER_LOG(LOG_DEBUG, "root: spawning receiver thread for child %d", i);
                 
                 // _1 is a place holder for the argument of arguments passed to the functor ;; in this case the index
                 thread_vector.push_back(boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&root_impl::receive, this, _1), i)));
                 
             }
             
-        	if(VERBOSE){
-          		std::cout << "Finished calling Root Router's Constructor" << std::endl;
-          		myfile << "Calling Root Router Constructor v.2\n" << std::flush;
-        	}
+        	ROUTER_LOG(LOG_INFO, "root: connected to %d children", number_of_children);
 	    }
         
         /*!
@@ -121,10 +169,7 @@ namespace gr {
         root_impl::~root_impl()
         {
             
-            if(VERBOSE){
-                std::cout << "Calling Parent Router Destructor" << std::endl;
-                myfile << "Calling Root Router Destuctor\n" << std::flush;
-            }
+            ROUTER_LOG(LOG_DEBUG, "root: destructor");
             
             d_finished = true;
             
@@ -141,7 +186,13 @@ namespace gr {
             // Delete connector object and weights array
             delete connector;
             delete[] weights;
+            delete[] down;
             
+            for(int i = 0; i < number_of_children; i++)
+                delete[] metrics[i].sent_at;
+            
+            SegmentChannel::release(in_channel);
+            SegmentChannel::release(out_channel);
         }
         
         /*!
@@ -170,7 +221,6 @@ namespace gr {
         void root_impl::send(){
             
             std::vector<float> *temp; // Pointer to current vector of floats to be sent
-            int sent = 0;
             
             int index, data_size, window_count, packet_size;
             
@@ -190,25 +240,42 @@ namespace gr {
                 
                 //----------
                 
-		        int min_weight = weights[min()];
+                if(stats_period != 0 && MonotonicClock::ticks() >= next_stats){
+                    next_stats = MonotonicClock::ticks() + stats_period;
+                    publish_stats();
+                }
+                
+                unsigned ticket = in_channel->prepare(); // Any push from here on ends the wait below
                 
                 // If there is a window available, send it to indexed node
                 if(in_queue->pop(temp)){
                     
+                    in_channel->notify_pop(); // Room for a waiting queue sink
+                    
                 	int packet_type = (int)temp->at(0); // Get packet type
                     
-                	if(VERBOSE)
-                        myfile << "Packet type: packet_type" << std::endl;
+                	ROUTER_LOG(LOG_DEBUG, "root: packet type %d", packet_type);
                     
                 	// Switch on the packet_type
                 	switch(packet_type){
                     	case 1:
+                    	case 4: // Type 1 with a tag side-band; forwarded as is
                     	{
                         	index = min(); // Grab index of next target
+                        	if(index < 0){
+                        		// Every child's connection is gone; there is nowhere to send it
+                        		ROUTER_LOG(LOG_ERROR, "root: no child left to take segment %ld", (long)temp->at(1));
+                        		break;
+                        	}
+                        	long segment_index = (long)temp->at(1);
+                        	SegmentTrace::record(TRACE_ROOT_DEQUEUE, segment_index);
+                        	ROUTER_PROBE3(queue_pop, in_channel->id(), segment_index, in_channel->occupancy());
+                        	ROUTER_PROBE3(dispatch, segment_index, index, (long)weights[index]);
+                        	capture.record(*temp);
                             
                         	data_size = (int)temp->at(2); // The size of the data segment is located at index 2
                         	window_count = data_size / 768;
-                        	packet_size = (data_size + 3) * 4; // Size of the data + headers * 4 (chars per byte)
+                        	packet_size = temp->size() * 4; // Size of the headers + data (+ side-band) * 4 (chars per byte)
                             
                         	char* data_bytes = new char[packet_size];
                             
@@ -216,20 +283,21 @@ namespace gr {
                             
                         	d_total_samples += data_size;
                             
-                        	if(VERBOSE)
-                                myfile << "Sending packet index=" << temp->at(1) << " to child=" << index << std::endl;
+                        	ROUTER_LOG(LOG_DEBUG, "root: sending segment %ld to child %d", segment_index, index);
                             
                         	memcpy(&(data_bytes[0]), &(temp->data()[0]), packet_size);
                             
-                        	sent = 0;
-                        	while(sent < packet_size)
-                                sent += connector->send(index, &(data_bytes[sent]), (packet_size - sent));
+                        	// Note when it left, to time the round trip
+                        	__sync_lock_test_and_set(&metrics[index].sent_at[segment_index & (RTT_SLOTS - 1)], RTT_PACK(segment_index, MonotonicClock::ticks()));
                             
-                        	if(VERBOSE)
-                                myfile << "Finished sending" << std::endl;
+                        	// The connector owns data_bytes from here and frees it once it is on the wire
+                        	if(!connector->send_async(index, data_bytes, packet_size))
+                        		mark_down(index); // Its writer could not get an earlier segment out
+                        	SegmentTrace::record(TRACE_ROOT_SEND, segment_index);
+                        	ROUTER_PROBE3(send, segment_index, index, packet_size);
                             
-                        	// We've sent the data, so don't need the memory anymore
-                        	delete[] data_bytes;
+                        	metrics[index].segments_sent->add();
+                        	metrics[index].bytes_sent->add(packet_size);
                             
                         	for(int i = 0; i < window_count; i++)
                           		increment();
@@ -238,10 +306,11 @@ namespace gr {
                     	}
                     	case 3:
                     	{
+                        	// The kill goes through each child's queue, so it cannot overtake segments still waiting there
                         	for(int i = 0; i < number_of_children; i++){
-                                sent = 0;
-                                while(sent < 1)
-                                    sent += connector->send(i, (char*)&((temp->data())[sent]), (1-sent)); // Send the segment
+                                char* kill_bytes = new char[1];
+                                memcpy(kill_bytes, &(temp->data()[0]), 1);
+                                connector->send_async(i, kill_bytes, 1);
                         	}
                             
                         	break;
@@ -252,15 +321,22 @@ namespace gr {
                         	break;
                    	    }
                     }
+                    
+                    delete temp;
+                    
+                    // Once the input queue is drained, everything dispatched so far goes out in one batch
+                    if(in_queue->empty())
+                        connector->flush();
                 }
 		        else{
-                    boost::this_thread::sleep(boost::posix_time::microseconds(1000));
+                    connector->flush();
+                    
+                    // Until the queue sink pushes (the timeout lets the loop see d_finished)
+                    in_channel->wait(ticket, 1000);
 		        }
                 // Future Work: Include additonal code for redundancy; keep copy of window until it has been ACKd;; Is this required given we're using TCP?
                 
             }
-            
-            delete temp;
         }
         
         /*
@@ -279,6 +355,18 @@ namespace gr {
          < type :: [0] > -- contains the message type
          */
         
+        /*
+         Format of type-6 Segments (type-2 with stream tags)
+         |
+         < type :: [0] > -- contains the message type
+         < index :: [1,2,3,4] > -- contains the index of the window
+         < size :: [5,6,7,8] > -- contains the size of the data in the data field to come next
+         < tag size :: [9,10,11,12] > -- contains the size of the tag side-band in bytes
+         < data :: [...] > -- contains data
+         < tags :: [...] > -- contains the tag side-band (TagSideband.h)
+         < weight :: [1,2,3,4] > -- contains the weight of the sending child
+         */
+        
         
         /*!
          *	Receiver thread: One per child node.
@@ -289,15 +377,6 @@ namespace gr {
         
         void root_impl::receive(int index){
             
-            /* Output file Setup */
-            std::ofstream thread_file;
-            
-            if(VERBOSE){
-                char name_buff[32];
-                sprintf(name_buff, "root_router_%d.data", index);
-                thread_file.open(name_buff);
-            }
-            
             char * temp_buffer = new char[9];
      	    std::vector<char> *temp;
             int size = 0;
@@ -306,28 +385,46 @@ namespace gr {
             
             float weight;
             
-            if(VERBOSE)
-                std::cout << "Started receiver thread for child #" << index << std::endl;
+            ROUTER_LOG(LOG_DEBUG, "root: started receiver thread for child %d", index);
             
      	    // Until the thread is finished
-     	    while(!d_finished){
+     	    while(!d_finished && !down[index]){
                 
                 // Wait until there's something to receive (may want to replace with something more efficient than a spinning wait)
-                size = 0;
-                while(size < 9){
-                    size += connector->receive(index, (char*)&(temp_buffer[size]), (9-size)); // Grab first byte (type), float (index), float (size)
-                    if(size == 0 && d_finished)
-                        return; // We're done
-                }
+                // Grab first byte (type), float (index), float (size)
+                if(!receive_all(index, temp_buffer, 9))
+                    break;
                 
                 char packet_type = temp_buffer[0];
                 
                 float message_index;
                 memcpy(&message_index, &(temp_buffer[1]), 4);
+                SegmentTrace::record(TRACE_ROOT_RECEIVE, (long)message_index);
+                
+                // Time the round trip, if the send time is still there
+                if(packet_type == '3' || packet_type == '6'){
+                    long segment_index = (long)message_index;
+                    volatile uint64_t *slot = &metrics[index].sent_at[segment_index & (RTT_SLOTS - 1)];
+                    uint64_t sent = *slot;
+                    
+                    // Taking the slot back fails if the sender has reused it since; that round trip goes untimed
+                    if(sent != RTT_EMPTY && (sent >> RTT_TICK_BITS) == ((uint64_t)segment_index & 0xFFFFFF)
+                       && __sync_bool_compare_and_swap(slot, sent, RTT_EMPTY)){
+                        uint64_t elapsed = (MonotonicClock::ticks() - sent) & RTT_TICK_MASK;
+                        metrics[index].rtt->observe((uint64_t)(elapsed * 1e6 / tick_rate));
+                    }
+                }
                 
                 float data_size;
                 memcpy(&data_size, &(temp_buffer[5]), 4);
                 
+                // A size we cannot trust leaves us nowhere to find the next header; stop reading from this child
+                if(!wire_size_ok(data_size, 1)){
+                    ROUTER_LOG(LOG_ERROR, "root: child %d sent a segment of %g bytes", index, data_size);
+                    mark_down(index);
+                    break;
+                }
+                
                 int number_of_windows = data_size / 768;
                 int remaining_message_size = data_size + (1 * sizeof(int)); // One footer at the end (the weight)
                 
@@ -335,20 +432,23 @@ namespace gr {
                     case '1':
                     {
                         std::cout << "ERROR: Right now we're not supporting format 1 from the child routers" << std::endl;
+                        metrics[index].errors->add();
                         break;
                     }
                     case '2':
                     {
                         std::cout << "ERROR: Right now we're not supporting format 2 from the child routers" << std::endl;
+                        metrics[index].errors->add();
                         break;
                     }
                     case '3':
                     {
                         char * buffer = new char[remaining_message_size];
                         
-                        size = 0;
-                        while(size < remaining_message_size)
-                            size += connector->receive(index, (char*)&(buffer[size]), (remaining_message_size-size)); // Receive the data
+                        if(!receive_all(index, buffer, remaining_message_size)){ // Receive the data
+                            delete[] buffer;
+                            break;
+                        }
                         
                         float weight;
                         memcpy(&weight, &(buffer[remaining_message_size-4]), 4);
@@ -358,14 +458,62 @@ namespace gr {
                         arrival->insert(arrival->end(), &(temp_buffer[1]), &(temp_buffer[9])); // Insert index and data_size bytes
                         arrival->insert(arrival->end(), &buffer[0], &buffer[(int)data_size]);
                         
-                        while(!out_queue->push(arrival))
-                            ;
+                        ROUTER_PROBE3(receive, (long)message_index, index, 9 + remaining_message_size);
+                        
+                        // Push the segment (waiting for room if the queue is full) and wake the queue source
+                        out_channel->push(*out_queue, arrival);
+                        ROUTER_PROBE3(queue_push, out_channel->id(), (long)message_index, out_channel->occupancy());
                         
                         for(int i = 0; i < number_of_windows; i++)
                             decrement();
                         
                         weights[index] = weight;
                         delete[] buffer;
+                        
+                        metrics[index].segments_received->add();
+                        metrics[index].bytes_received->add(9 + remaining_message_size);
+                        metrics[index].weight->set(weight);
+                        break;
+                    }
+                    case '6': // Type 3 with a tag side-band between the data and the weight
+                    {
+                        float tag_bytes;
+                        if(!receive_all(index, (char*)&tag_bytes, 4))
+                            break;
+                        
+                        if(!wire_size_ok(tag_bytes, 1) || !wire_size_ok(data_size + tag_bytes, 1)){
+                            ROUTER_LOG(LOG_ERROR, "root: child %d sent a side-band of %g bytes", index, tag_bytes);
+                            mark_down(index);
+                            break;
+                        }
+                        
+                        int body_size = (int)data_size + (int)tag_bytes;
+                        
+                        // Rebuild it as a type-5 segment: header, side-band size, then data and side-band straight off the wire
+                        arrival = new std::vector<char>(13 + body_size);
+                        (*arrival)[0] = '5';
+                        memcpy(&((*arrival)[1]), &(temp_buffer[1]), 8); // Index and data_size bytes
+                        memcpy(&((*arrival)[9]), &tag_bytes, 4);
+                        
+                        float weight;
+                        if(!receive_all(index, &((*arrival)[13]), body_size) || !receive_all(index, (char*)&weight, 4)){
+                            delete arrival;
+                            break;
+                        }
+                        
+                        ROUTER_PROBE3(receive, (long)message_index, index, 9 + 4 + body_size + 4);
+                        
+                        out_channel->push(*out_queue, arrival);
+                        ROUTER_PROBE3(queue_push, out_channel->id(), (long)message_index, out_channel->occupancy());
+                        
+                        for(int i = 0; i < number_of_windows; i++)
+                            decrement();
+                        
+                        weights[index] = weight;
+                        
+                        metrics[index].segments_received->add();
+                        metrics[index].bytes_received->add(9 + 4 + body_size + 4);
+                        metrics[index].weight->set(weight);
                         break;
                     }
                     case '4':
@@ -378,8 +526,7 @@ namespace gr {
                          if(num_killed == number_of_children){
                          kill_msg = new std::vector<char>();
                          kill_msg->push_back('3');
-                         if(VERBOSE)
-                         thread_file << "Pushing kill message" << std::endl;
+                         ROUTER_LOG(LOG_INFO, "root: pushing kill message");
                          
                          while(!out_queue->push(kill_msg))
                          ;
@@ -391,6 +538,7 @@ namespace gr {
                     default:
                     {
                         std::cout << "ERROR: Receiving unacceptable image format" << std::endl;
+                        metrics[index].errors->add();
                         break;
                     }
                 }
@@ -400,26 +548,176 @@ namespace gr {
             delete [] temp_buffer; // We're done with our buffer
         }
         
+        /*!
+         *	Read exactly size bytes from a child. A read that fails (NetworkInterface::receive() gives -1 for a closed
+         *  connection and for errors alike) marks the child down and ends its receiver thread.
+         *
+         *  @param index The index of the child.
+         *  @param buffer Where the bytes go.
+         *  @param size The number of bytes to read.
+         *  @return True once all size bytes are in; False if the connection is gone.
+         */
+        
+        bool root_impl::receive_all(int index, char *buffer, int size){
+            
+            int got = 0;
+            while(got < size){
+                int received = connector->receive(index, &buffer[got], size - got);
+                if(received <= 0){
+                    if(!d_finished)
+                        mark_down(index);
+                    return false;
+                }
+                got += received;
+            }
+            return true;
+        }
+        
+        /*!
+         *	Take a child out of dispatch once its connection is gone, whether a read or a write found out, or once its
+         *  stream cannot be parsed. Counted (one error and one disconnect) and logged only the first time.
+         *
+         *  @param index The index of the child.
+         */
+        
+        void root_impl::mark_down(int index){
+            
+            boost::mutex::scoped_lock lock(down_lock);
+            if(down[index])
+                return;
+            
+            down[index] = true;
+            metrics[index].errors->add();
+            metrics[index].disconnects->add();
+            ROUTER_LOG(LOG_ERROR, "root: lost the connection to child %d", index);
+        }
+        
+        /*!
+         *	Statistics for a child.
+         *
+         *  @param child Index of the child.
+         *  @return The child's statistics; all zero (and child -1) for an index out of range.
+         */
+        
+        child_stats root_impl::stats(int child){
+            
+            child_stats s;
+            memset(&s, 0, sizeof(s));
+            s.child = -1;
+            
+            if(child < 0 || child >= number_of_children)
+                return s;
+            
+            child_metrics &m = metrics[child];
+            s.child = child;
+            s.segments_sent = m.segments_sent->get();
+            s.bytes_sent = m.bytes_sent->get();
+            s.segments_received = m.segments_received->get();
+            s.bytes_received = m.bytes_received->get();
+            s.in_flight = (long)s.segments_sent - (long)s.segments_received;
+            s.weight = weights[child];
+            s.errors = m.errors->get();
+            s.connected = !down[child];
+            
+            std::vector<unsigned long> counts;
+            uint64_t sum;
+            m.rtt->read(counts, sum);
+            for(size_t i = 0; i < counts.size(); i++)
+                s.rtt_count += counts[i];
+            
+            if(s.rtt_count > 0){
+                s.rtt_mean_us = (double)sum / s.rtt_count;
+                s.rtt_p50_us = m.rtt->quantile(0.5);
+                s.rtt_p90_us = m.rtt->quantile(0.9);
+                s.rtt_p99_us = m.rtt->quantile(0.99);
+                s.rtt_max_us = m.rtt->quantile(1);
+            }
+            
+            return s;
+        }
+        
+        /*!
+         *	How often the statistics go out on the stats port.
+         *
+         *  @param seconds The period; 0 publishes only on request.
+         */
+        
+        void root_impl::set_stats_period(double seconds){
+            stats_period = (seconds > 0) ? (uint64_t)(seconds * tick_rate) : 0;
+        }
+        
+        /*!
+         *	Start (or, with an empty path, stop) capturing the segments the root dequeues.
+         *
+         *  @param path File to write the capture to; replaced if it exists.
+         *  @return True if capturing (or stopped); False if the file cannot be created.
+         */
+        
+        bool root_impl::set_capture(const std::string &path){
+            
+            if(path.empty()){
+                if(capture.active())
+                    ROUTER_LOG(LOG_INFO, "root: capture closed after %lu segments", capture.segments());
+                capture.close();
+                return true;
+            }
+            
+            return capture.open(path);
+        }
+        
+        void root_impl::stats_requested(pmt::pmt_t msg){
+            publish_stats();
+        }
+        
+        /*!
+         *	Publish every child's statistics on the stats port: a vector with a dict per child.
+         */
+        
+        void root_impl::publish_stats(){
+            
+            boost::mutex::scoped_lock guard(stats_lock); // The send thread and request handler both publish
+            
+            pmt::pmt_t all = pmt::make_vector(number_of_children, pmt::PMT_NIL);
+            
+            for(int i = 0; i < number_of_children; i++){
+                child_stats s = stats(i);
+                
+                pmt::pmt_t d = pmt::make_dict();
+                d = pmt::dict_add(d, pmt::mp("child"), pmt::from_long(s.child));
+                d = pmt::dict_add(d, pmt::mp("segments_sent"), pmt::from_uint64(s.segments_sent));
+                d = pmt::dict_add(d, pmt::mp("bytes_sent"), pmt::from_uint64(s.bytes_sent));
+                d = pmt::dict_add(d, pmt::mp("segments_received"), pmt::from_uint64(s.segments_received));
+                d = pmt::dict_add(d, pmt::mp("bytes_received"), pmt::from_uint64(s.bytes_received));
+                d = pmt::dict_add(d, pmt::mp("in_flight"), pmt::from_long(s.in_flight));
+                d = pmt::dict_add(d, pmt::mp("weight"), pmt::from_double(s.weight));
+                d = pmt::dict_add(d, pmt::mp("rtt_count"), pmt::from_uint64(s.rtt_count));
+                d = pmt::dict_add(d, pmt::mp("rtt_mean_us"), pmt::from_double(s.rtt_mean_us));
+                d = pmt::dict_add(d, pmt::mp("rtt_p50_us"), pmt::from_double(s.rtt_p50_us));
+                d = pmt::dict_add(d, pmt::mp("rtt_p90_us"), pmt::from_double(s.rtt_p90_us));
+                d = pmt::dict_add(d, pmt::mp("rtt_p99_us"), pmt::from_double(s.rtt_p99_us));
+                d = pmt::dict_add(d, pmt::mp("rtt_max_us"), pmt::from_double(s.rtt_max_us));
+                d = pmt::dict_add(d, pmt::mp("errors"), pmt::from_uint64(s.errors));
+                d = pmt::dict_add(d, pmt::mp("connected"), pmt::from_bool(s.connected));
+                pmt::vector_set(all, i, d);
+            }
+            
+            message_port_pub(pmt::mp("stats"), all);
+        }
+        
     	// Find index of child with minimum weight BIG_OH(N)
     	// Might want to use a better algorithm for this
     	// Needs to become Configurable based on application (include XML for this)
         
         /*!
-         *	Returns the index of the child node with the minimum weight.
+         *	Returns the index of the child node with the minimum load: its weight plus the windows still waiting
+         *  in its outbound queue. Children whose queue is full are passed over unless every child is full;
+         *  children that are down are never picked.
          *
-         *  @return index The index of the child with the lowest weight.
+         *  @return index The index of the child with the lowest load, or -1 if every child is down.
          */
         
         int root_impl::min(){
-            float min = weights[0];
-            int index = 0;
-            for(int i = 1; i < number_of_children; i++){
-                if(weights[i] < min){
-                    min = weights[i];
-                    index = i;
-                }
-            }
-            return index;
+            return least_loaded(weights, number_of_children, *connector, (float)WINDOW_BYTES, down);
         }
         
         /*!
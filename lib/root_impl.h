@@ -21,6 +21,14 @@
 #define INCLUDED_ROUTER_ROOT_IMPL_H
 
 #include "NetworkInterface.h"
+#include "SegmentChannel.h"
+#include "MetricsRegistry.h"
+#include "SegmentTrace.h"
+#include "RouterProbes.h"
+#include "AsyncLog.h"
+#include "RateMeter.h"
+#include "SegmentCapture.h"
+#include "ChildSelection.h"
 #include <router/root.h>
 #include <memory>
 #include <boost/lockfree/queue.hpp>
@@ -44,8 +52,6 @@ namespace gr {
 			uint64_t d_total_samples;
 			//----------
             
- 			std::ofstream myfile; // Output file stream for debugging
-            
  			int number_of_children;	// Set the number of children to listen for
             
  			int num_killed;
@@ -53,12 +59,12 @@ namespace gr {
             
  			bool d_finished; // variable for destruction (kill threads)
             
-			// Shared pointer to queues (input, output) and counters (implemented later)
+			// Shared pointer to queues (input, output); the channels keep their counts
  			boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > *in_queue;
- 			float in_queue_counter;
-            
  			boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > *out_queue;
- 			float out_queue_counter;
+            
+ 			SegmentChannel *in_channel; // Wakeups for in_queue (pushed by the queue sink)
+ 			SegmentChannel *out_channel; // Wakeups for out_queue (popped by the queue source)
             
  			int global_counter;
  			boost::mutex global_lock;
@@ -76,6 +82,37 @@ namespace gr {
 			// Weights for each child
  			float * weights;
             
+			// Children whose connection is gone; nothing more is sent to them
+ 			volatile bool * down;
+ 			boost::mutex down_lock; // Only one thread marks a child down
+ 			void mark_down(int index);
+            
+			// Metrics for each child (the source of its child_stats)
+ 			struct child_metrics{
+ 				MetricCounter *segments_sent, *bytes_sent;
+ 				MetricCounter *segments_received, *bytes_received;
+ 				MetricCounter *errors;
+ 				MetricCounter *disconnects;
+ 				MetricGauge *weight;
+ 				MetricHistogram *rtt; // Microseconds
+                
+ 				// When recent segments were sent, by index modulo RTT_SLOTS, to time them when they come back
+ 				volatile uint64_t *sent_at; // RTT_PACK(index, ticks), or RTT_EMPTY
+ 			};
+ 			std::vector<child_metrics> metrics;
+            
+ 			double tick_rate; // MonotonicClock ticks per second
+            
+			// Publishing the statistics on the stats port
+ 			volatile uint64_t stats_period; // In ticks; 0 when only on request
+ 			uint64_t next_stats;
+ 			boost::mutex stats_lock;
+ 			void publish_stats();
+ 			void stats_requested(pmt::pmt_t msg);
+            
+			// Segments dequeued, recorded for replay (set_capture)
+ 			SegmentCapture capture;
+            
 			// Connector used for networking between nodes
  			NetworkInterface *connector;
             
@@ -90,6 +127,7 @@ namespace gr {
             
 			// Thread program for receiving for each index
  			void receive(int index);
+ 			bool receive_all(int index, char *buffer, int size);
             
 			// Determine index of min child
  			int min();
@@ -102,9 +140,14 @@ namespace gr {
  			void decrement();
             
  		public:
- 			root_impl(int number_of_children, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &out_queue, double throughput);
+ 			root_impl(int number_of_children, boost::lockfree::queue< std::vector<float>*, boost::lockfree::fixed_sized<true> > &in_queue, boost::lockfree::queue< std::vector<char>*, boost::lockfree::fixed_sized<true> > &out_queue, double throughput, const std::string &transport);
  			~root_impl();
             
+			int children(){ return number_of_children; }
+ 			child_stats stats(int child);
+ 			void set_stats_period(double seconds);
+ 			bool set_capture(const std::string &path);
+            
       		// Where all the action really happens
  			int work(int noutput_items, 
                      gr_vector_const_void_star &input_items,
@@ -19,17 +19,18 @@
  */
 
 /*
- *  This is the  throughput block. It prints the average throughput to std::out every d_print_counter times work() is called.
+ *  This is the throughput block. It measures the rate of the stream through it (instantaneous, EWMA and over a sliding
+ *  window) and reports it on its "rate" message port and through the metrics.
  *
- *  The following code is derived from the throttle block.
+ *  The following code was originally derived from the throttle block.
  */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
-#include <boost/thread/thread_time.hpp>
 #include <gnuradio/io_signature.h>
+#include <stdio.h>
 #include "throughput_impl.h"
 
 namespace gr {
@@ -39,8 +40,8 @@ namespace gr {
          *  This is the public constructor for the throughput block.
          *
          *  @param itemsize The size (in bytes) of the data being measured
-         *  @param print_counter The number of work() calls between prints of throughput value
-         *  @param index How many tabs in front of the throughput value to space them
+         *  @param print_counter The number of rate intervals between reports on the rate message port
+         *  @param index Number of the block, carried in its reports and metric labels
          *  @return A shared pointer to the throughput block
          */
         
@@ -55,8 +56,8 @@ namespace gr {
          *  This is the private constructor for the throughput block.
          *
          *  @param itemsize The size (in bytes) of the data being measured
-         *  @param print_counter The number of work() calls between prints of throughput value
-         *  @param index How many tabs in front of the throughput value to space them
+         *  @param print_counter The number of rate intervals between reports on the rate message port
+         *  @param index Number of the block, carried in its reports and metric labels
          */
         
         throughput_impl::throughput_impl(size_t itemsize, int print_counter, int index)
@@ -64,10 +65,16 @@ namespace gr {
                          gr::io_signature::make(1, 1, itemsize),
                          gr::io_signature::make(1, 1, itemsize)), d_itemsize(itemsize), d_print_counter(print_counter), d_index(index)
         {
-            d_start = boost::get_system_time();
-            d_total_samples = 0;
-            last_throughput = 0;
-            running_count = 0;
+            intervals_since_report = 0;
+            
+            char labels[32];
+            sprintf(labels, "index=\"%d\"", d_index);
+            items_metric = MetricsRegistry::get()->counter("router_throughput_items_total", "Items through the throughput block", labels);
+            rate_metric = MetricsRegistry::get()->gauge("router_throughput_rate", "Items per second through the throughput block over the last interval", labels);
+            ewma_metric = MetricsRegistry::get()->gauge("router_throughput_rate_ewma", "EWMA of the throughput block's interval rates", labels);
+            window_metric = MetricsRegistry::get()->gauge("router_throughput_rate_window", "Items per second through the throughput block over the sliding window", labels);
+            
+            message_port_register_out(pmt::mp("rate"));
         }
         
         /**
@@ -79,7 +86,25 @@ namespace gr {
         }
       
         /*!
-         *  This is the work() function. It prints the average throughput to std::out every d_print_counter times work() is called.
+         *  Publish the rates on the rate port: a dict of index, rate, ewma, window, average and items.
+         */
+        
+        void
+        throughput_impl::report()
+        {
+            pmt::pmt_t msg = pmt::make_dict();
+            msg = pmt::dict_add(msg, pmt::mp("index"), pmt::from_long(d_index));
+            msg = pmt::dict_add(msg, pmt::mp("rate"), pmt::from_double(meter.instantaneous()));
+            msg = pmt::dict_add(msg, pmt::mp("ewma"), pmt::from_double(meter.ewma()));
+            msg = pmt::dict_add(msg, pmt::mp("window"), pmt::from_double(meter.window()));
+            msg = pmt::dict_add(msg, pmt::mp("average"), pmt::from_double(meter.average()));
+            msg = pmt::dict_add(msg, pmt::mp("items"), pmt::from_uint64(meter.items()));
+            message_port_pub(pmt::mp("rate"), msg);
+        }
+      
+        /*!
+         *  This is the work() function. It counts the items into the rate meter; each time an interval closes, the
+         *  rate gauges are updated, and every d_print_counter intervals the rates are published on the rate port.
          *
          *  This block is transparent and the data on the input is copied to the output.
          *
@@ -96,27 +121,17 @@ namespace gr {
             const char *in = (const char *) input_items[0];
             char *out = (char *) output_items[0];
             
-            boost::system_time now = boost::get_system_time();
-            double ticks = (now - d_start).ticks(); // Total number of ticks since start
-            
-            double time_for_ticks = ticks / boost::posix_time::time_duration::ticks_per_second(); // Total time since start
-            
-            // throughput (in Samples per second) = total samples / total time
-            double throughput = (d_total_samples / time_for_ticks);
-            
-            d_total_samples += (double)noutput_items;
+            items_metric->add(noutput_items);
             
-            running_count++;
-            
-            // Print out the throughput every d_print_counter times work() is called
-            if((int)running_count % d_print_counter == 0){
-                for(int i = 0; i < d_index; i++)
-                    std::cout << '\t';
-                
+            if(meter.update(noutput_items)){
+                rate_metric->set(meter.instantaneous());
+                ewma_metric->set(meter.ewma());
+                window_metric->set(meter.window());
                 
-                // check if throughput has changed by enough; if so update
-
-                std::cout << d_index << ". " << throughput << std::endl;
+                if(++intervals_since_report >= d_print_counter){
+                    intervals_since_report = 0;
+                    report();
+                }
             }
 			
             std::memcpy(out, in, noutput_items * d_itemsize);
@@ -19,16 +19,16 @@
  */
 
 /*
- The following code is derived from the throttle block
- Unlike the throughput block, this block is a sink.
+ The following code was originally derived from the throttle block
+ Unlike the throughput block, this block is a sink. It measures the rate of the stream into it the same way.
  */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
-#include <boost/thread/thread_time.hpp>
 #include <gnuradio/io_signature.h>
+#include <stdio.h>
 #include "throughput_sink_impl.h"
 
 namespace gr {
@@ -38,8 +38,8 @@ namespace gr {
          *  This is the public constructor for the throughput sink block.
          *
          *  @param itemsize The size (in bytes) of the data being measured
-         *  @param print_counter The number of work() calls between prints of throughput value
-         *  @param index How many tabs in front of the throughput value to space them
+         *  @param print_counter The number of rate intervals between reports on the rate message port
+         *  @param index Number of the block, carried in its reports and metric labels
          *  @return A shared pointer to the throughput sink block
          */
         
@@ -54,8 +54,8 @@ namespace gr {
          *  This is the private constructor for the throughput block.
          *
          *  @param itemsize The size (in bytes) of the data being measured
-         *  @param print_counter The number of work() calls between prints of throughput value
-         *  @param index How many tabs in front of the throughput value to space them
+         *  @param print_counter The number of rate intervals between reports on the rate message port
+         *  @param index Number of the block, carried in its reports and metric labels
          */
         
         throughput_sink_impl::throughput_sink_impl(size_t itemsize, int print_counter, int index)
@@ -63,11 +63,16 @@ namespace gr {
                          gr::io_signature::make(1, 1, itemsize),
                          gr::io_signature::make(0, 0, 0)), d_itemsize(itemsize), d_print_counter(print_counter), d_index(index)
         {
-            d_start = boost::get_system_time();
-            d_total_samples = 0;
-            last_throughput = 0;
-            running_count = 0;
+            intervals_since_report = 0;
             
+            char labels[32];
+            sprintf(labels, "index=\"%d\"", d_index);
+            items_metric = MetricsRegistry::get()->counter("router_throughput_sink_items_total", "Items through the throughput sink", labels);
+            rate_metric = MetricsRegistry::get()->gauge("router_throughput_sink_rate", "Items per second into the throughput sink over the last interval", labels);
+            ewma_metric = MetricsRegistry::get()->gauge("router_throughput_sink_rate_ewma", "EWMA of the throughput sink's interval rates", labels);
+            window_metric = MetricsRegistry::get()->gauge("router_throughput_sink_rate_window", "Items per second into the throughput sink over the sliding window", labels);
+            
+            message_port_register_out(pmt::mp("rate"));
         }
         
         /*!
@@ -79,7 +84,25 @@ namespace gr {
         }
         
         /*!
-         *  This is the work() function of the throughput_sink
+         *  Publish the rates on the rate port: a dict of index, rate, ewma, window, average and items.
+         */
+        
+        void
+        throughput_sink_impl::report()
+        {
+            pmt::pmt_t msg = pmt::make_dict();
+            msg = pmt::dict_add(msg, pmt::mp("index"), pmt::from_long(d_index));
+            msg = pmt::dict_add(msg, pmt::mp("rate"), pmt::from_double(meter.instantaneous()));
+            msg = pmt::dict_add(msg, pmt::mp("ewma"), pmt::from_double(meter.ewma()));
+            msg = pmt::dict_add(msg, pmt::mp("window"), pmt::from_double(meter.window()));
+            msg = pmt::dict_add(msg, pmt::mp("average"), pmt::from_double(meter.average()));
+            msg = pmt::dict_add(msg, pmt::mp("items"), pmt::from_uint64(meter.items()));
+            message_port_pub(pmt::mp("rate"), msg);
+        }
+        
+        /*!
+         *  This is the work() function of the throughput_sink. It counts the items into the rate meter, as the
+         *  throughput block does.
          */
         
         int
@@ -87,23 +110,17 @@ namespace gr {
                                    gr_vector_const_void_star &input_items,
                                    gr_vector_void_star &output_items)
         {
-            const char *in = (const char *) input_items[0];
-            
-            boost::system_time now = boost::get_system_time();
-            double ticks = (now - d_start).ticks(); // Total number of ticks since start
-            
-            double time_for_ticks = ticks / boost::posix_time::time_duration::ticks_per_second(); // Total time since start
-            
-            double throughput = (d_total_samples / time_for_ticks) / 1e6; // (Total number of samples / total time) in MegaSamples / Second
-            d_total_samples += (double)noutput_items;
-            
-            running_count++;
+            items_metric->add(noutput_items);
             
-            if((int)running_count % d_print_counter == 0){
-                for(int i = 0; i < d_index; i++)
-                    std::cout << '\t';
+            if(meter.update(noutput_items)){
+                rate_metric->set(meter.instantaneous());
+                ewma_metric->set(meter.ewma());
+                window_metric->set(meter.window());
                 
-                std::cout << d_index << ". " << throughput << std::endl;
+                if(++intervals_since_report >= d_print_counter){
+                    intervals_since_report = 0;
+                    report();
+                }
             }
             
             // Tell runtime system how many output items we produced.
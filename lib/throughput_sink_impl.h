@@ -22,6 +22,8 @@
 #define INCLUDED_ROUTER_THROUGHPUT_SINK_IMPL_H
 
 #include <router/throughput_sink.h>
+#include "MetricsRegistry.h"
+#include "RateMeter.h"
 
 namespace gr {
     namespace router {
@@ -29,20 +31,33 @@ namespace gr {
         class throughput_sink_impl : public throughput_sink
         {
         private:
-            boost::system_time d_start;
             size_t d_itemsize;
-            double d_total_samples;
+            int d_print_counter; // Intervals between reports on the rate port
+            int d_index;
             
-            int d_print_counter;
-            double last_throughput;
-            double running_count;
+            RateMeter meter;
+            int intervals_since_report;
             
-            int d_index;
+            MetricCounter *items_metric; // Registered metrics
+            MetricGauge *rate_metric;
+            MetricGauge *ewma_metric;
+            MetricGauge *window_metric;
+            
+            void report();
             
         public:
             throughput_sink_impl(size_t itemsize, int print_counter, int index);
             ~throughput_sink_impl();
             
+            double rate(){ return meter.instantaneous_at(); }
+            double rate_ewma(){ return meter.ewma(); }
+            double rate_window(){ return meter.window_at(); }
+            double rate_average(){ return meter.average(); }
+            
+            void set_interval(double seconds){ meter.set_interval(seconds); }
+            void set_window(int intervals){ meter.set_window(intervals); }
+            void set_ewma_time(double seconds){ meter.set_ewma_time(seconds); }
+            
             int work(int noutput_items,
                      gr_vector_const_void_star &input_items,
                      gr_vector_void_star &output_items);
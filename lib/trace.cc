@@ -0,0 +1,50 @@
+/* -*- c++ -*- */
+/* 
+ * Copyright 2013 <+YOU OR YOUR COMPANY+>.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <router/trace.h>
+#include "SegmentTrace.h"
+
+namespace gr {
+  namespace router {
+
+    void
+    trace::set_sampling(int every)
+    {
+      SegmentTrace::set_sampling(every);
+    }
+
+    std::string
+    trace::json()
+    {
+      return SegmentTrace::chrome_json();
+    }
+
+    bool
+    trace::write(const std::string &path)
+    {
+      return SegmentTrace::write(path);
+    }
+
+  } /* namespace router */
+} /* namespace gr */
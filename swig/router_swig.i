@@ -17,6 +17,10 @@
 #include "router/throughput_sink.h"
 #include "router/queue_sink_byte.h"
 #include "router/queue_source_byte.h"
+#include "router/metrics.h"
+#include "router/trace.h"
+#include "router/logging.h"
+#include "router/replay.h"
 %}
 
 
@@ -38,3 +42,11 @@ GR_SWIG_BLOCK_MAGIC2(router, throughput_sink);
 GR_SWIG_BLOCK_MAGIC2(router, queue_sink_byte);
 %include "router/queue_source_byte.h"
 GR_SWIG_BLOCK_MAGIC2(router, queue_source_byte);
+%include "router/metrics.h"
+%include "router/trace.h"
+%include "router/logging.h"
+%include "router/replay.h"
+%template(replay_sptr) boost::shared_ptr<gr::router::replay>;
+%pythoncode %{
+replay = replay.make;
+%}